@@ -0,0 +1,454 @@
+/* edit
+ * Microbenchmarks of the editor's building blocks
+ *
+ * Each benchmark runs a batch of operations a few rounds over, and reports
+ * the median time per operation, as JSON or CSV so runs can be compared
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+
+#include "line.h"
+#include "file.h"
+#include "config.h"
+#include "cmd.h"
+
+#include "common.h"
+
+#define ROUNDS (7) /* Times each batch of operations is run */
+
+#define LINE_OPS (1000) /* Characters typed and erased per round */
+#define FILE_OPS (10000) /* Lines inserted and shifted up per round */
+#define CONFIG_OPS (100000) /* Lookups per round */
+#define CONFIG_KEY_LENGTH (32) /* Room for each key looked up */
+#define CMD_OPS (100000) /* Pushes per round */
+
+#define SEED (0x9e3779b97f4a7c15ULL) /* Seed of the positions picked */
+
+typedef enum _Format {
+	FORMAT_JSON,
+	FORMAT_CSV,
+} Format;
+
+/* How a benchmark went */
+typedef struct _Result {
+	const char *name;
+	size_t size; /* What the benchmark was run at, like a line length */
+	size_t ops; /* Operations per round */
+	double ns_per_op; /* Median time per operation */
+	double mib_per_s; /* Throughput, or 0 if it doesn't apply */
+} Result;
+
+static void _usage(const char *argv0);
+static bool _wanted(const char *name);
+
+static void _bench_line(bool scattered);
+static void _bench_file_lines(const char *dir);
+static void _bench_file_io(const char *dir);
+static void _bench_config(void);
+static void _bench_cmd(void);
+
+static void _report(const char *name, size_t size, size_t ops,
+	long long *rounds, size_t bytes);
+static int _compare_rounds(const void *a, const void *b);
+
+static bool _write_lines(const char *path, size_t lines);
+static size_t _random(size_t bound);
+
+static Format format = FORMAT_JSON;
+static const char *filter = NULL; /* Only run benchmarks with this in name */
+static size_t reported = 0; /* Results printed so far */
+static uint64_t state = SEED; /* State of the position generator */
+
+static const size_t line_lengths[] = { 16, 256, 4096, 65536, 1048576 };
+static const size_t file_lengths[] = { 1000, 100000, 1000000 };
+static const size_t file_sizes[] = { 1 << 20, 16 << 20 };
+static const size_t config_counts[] = { 8, 64, 256, 1024 };
+static const size_t cmd_budgets[] = { 64 << 10, CMD_DEFAULT_BUDGET };
+
+int main(int argc, char *argv[]) {
+	for( int i = 1; i < argc; ++i ) {
+		if( strcmp(argv[i], "--json") == 0 ) {
+			format = FORMAT_JSON;
+		} else if( strcmp(argv[i], "--csv") == 0 ) {
+			format = FORMAT_CSV;
+		} else if( argv[i][0] == '-' || filter ) {
+			_usage(argv[0]);
+			return EXIT_FAILURE;
+		} else {
+			filter = argv[i];
+		}
+	}
+
+	char dir[BENCH_PATH_MAX];
+	if( !bench_make_dir(dir, "edit_bench") ) {
+		return EXIT_FAILURE;
+	}
+
+	if( format == FORMAT_JSON ) {
+		printf("[\n");
+	} else {
+		printf("name,size,ops,ns_per_op,mib_per_s\n");
+	}
+
+	_bench_line(false);
+	_bench_line(true);
+	_bench_file_lines(dir);
+	_bench_file_io(dir);
+	_bench_config();
+	_bench_cmd();
+
+	if( format == FORMAT_JSON ) {
+		printf("%s]\n", reported ? "\n" : "");
+	}
+
+	bench_remove_dir(dir);
+
+	return EXIT_SUCCESS;
+}
+
+/* Prints how to run the benchmarks */
+static void _usage(const char *argv0) {
+	fprintf(stderr, "usage: %s [--json | --csv] [filter]\n", argv0);
+}
+
+/* Returns if the benchmark called @name should be run */
+static bool _wanted(const char *name) {
+	return filter == NULL || strstr(name, filter) != NULL;
+}
+
+/* Types LINE_OPS characters into lines of each length, then erases them,
+ * either one after another from the middle or all over the line
+ */
+static void _bench_line(bool scattered) {
+	const char *insert = "line_insert_char";
+	const char *delete = "line_delete_char";
+	if( scattered ) {
+		insert = "line_insert_char_scattered";
+		delete = "line_delete_char_scattered";
+	}
+
+	if( !_wanted(insert) && !_wanted(delete) ) {
+		return;
+	}
+
+	for( size_t l = 0; l < ARRAY_LENGTH(line_lengths); ++l ) {
+		const size_t length = line_lengths[l];
+
+		char *text = malloc(length);
+		if( !text ) {
+			fprintf(stderr, "Failed to allocate line of %zu bytes!\n", length);
+			exit(1);
+		}
+		memset(text, 'a', length);
+
+		long long inserts[ROUNDS], deletes[ROUNDS];
+		for( size_t r = 0; r < ROUNDS; ++r ) {
+			Line line;
+			line_init(&line);
+			line_insert_strn(&line, 0, text, length);
+
+			const size_t middle = length / 2;
+
+			long long start = bench_now_ns();
+			for( size_t i = 0; i < LINE_OPS; ++i ) {
+				const size_t idx = scattered ? _random(line.length + 1)
+					: middle + i;
+				line_insert_char(&line, idx, 'x');
+			}
+			inserts[r] = bench_now_ns() - start;
+
+			start = bench_now_ns();
+			for( size_t i = 0; i < LINE_OPS; ++i ) {
+				const size_t idx = scattered ? 1 + _random(line.length)
+					: middle + LINE_OPS - i;
+				line_delete_char(&line, idx);
+			}
+			deletes[r] = bench_now_ns() - start;
+
+			line_free(&line);
+		}
+
+		if( _wanted(insert) ) {
+			_report(insert, length, LINE_OPS, inserts, 0);
+		}
+
+		if( _wanted(delete) ) {
+			_report(delete, length, LINE_OPS, deletes, 0);
+		}
+
+		free(text);
+	}
+}
+
+/* Inserts FILE_OPS lines all over files of each length, then shifts as many
+ * up, which takes them back out
+ */
+static void _bench_file_lines(const char *dir) {
+	if( !_wanted("file_insert_line") && !_wanted("file_shift_lines_up") ) {
+		return;
+	}
+
+	for( size_t f = 0; f < ARRAY_LENGTH(file_lengths); ++f ) {
+		const size_t lines = file_lengths[f];
+
+		char path[BENCH_PATH_MAX];
+		if( !bench_make_path(path, dir, "lines-%zu", lines)
+			|| !_write_lines(path, lines) ) {
+			return;
+		}
+
+		File file;
+		file_init(&file, path, NULL);
+
+		long long inserts[ROUNDS], shifts[ROUNDS];
+		for( size_t r = 0; r < ROUNDS; ++r ) {
+			long long start = bench_now_ns();
+			for( size_t i = 0; i < FILE_OPS; ++i ) {
+				Line line;
+				line_init_slab(&line, &file.slab);
+				line_insert_strn(&line, 0, "inserted line", 13);
+
+				file_insert_line(&file, _random(file.length + 1), &line);
+			}
+			inserts[r] = bench_now_ns() - start;
+
+			start = bench_now_ns();
+			for( size_t i = 0; i < FILE_OPS; ++i ) {
+				file_shift_lines_up(&file, 1 + _random(file.length - 1));
+			}
+			shifts[r] = bench_now_ns() - start;
+		}
+
+		file_free(&file);
+
+		if( _wanted("file_insert_line") ) {
+			_report("file_insert_line", lines, FILE_OPS, inserts, 0);
+		}
+
+		if( _wanted("file_shift_lines_up") ) {
+			_report("file_shift_lines_up", lines, FILE_OPS, shifts, 0);
+		}
+	}
+}
+
+/* Loads and saves files of each size
+ * Saves run in the background, so they are timed until they are done
+ */
+static void _bench_file_io(const char *dir) {
+	if( !_wanted("file_load") && !_wanted("file_save") ) {
+		return;
+	}
+
+	for( size_t f = 0; f < ARRAY_LENGTH(file_sizes); ++f ) {
+		const size_t size = file_sizes[f];
+
+		/* Lines written by _write_lines() are 18 bytes long */
+		char path[BENCH_PATH_MAX], out[BENCH_PATH_MAX];
+		if( !bench_make_path(path, dir, "load-%zu", size)
+			|| !bench_make_path(out, dir, "save-%zu", size)
+			|| !_write_lines(path, size / 18) ) {
+			return;
+		}
+
+		const size_t bytes = size / 18 * 18;
+
+		long long loads[ROUNDS], saves[ROUNDS];
+		for( size_t r = 0; r < ROUNDS; ++r ) {
+			File file;
+
+			long long start = bench_now_ns();
+			file_init(&file, path, NULL);
+			loads[r] = bench_now_ns() - start;
+
+			start = bench_now_ns();
+			if( file_save(&file, out) ) {
+				file_wait_save(&file);
+			}
+			saves[r] = bench_now_ns() - start;
+
+			file_free(&file);
+		}
+
+		if( _wanted("file_load") ) {
+			_report("file_load", bytes, 1, loads, bytes);
+		}
+
+		if( _wanted("file_save") ) {
+			_report("file_save", bytes, 1, saves, bytes);
+		}
+	}
+}
+
+/* Looks up keys that are set, then keys that aren't, in configs of each size
+ * The keys are all made up front, so only the lookups are timed
+ */
+static void _bench_config(void) {
+	if( !_wanted("config_get") && !_wanted("config_get_missing") ) {
+		return;
+	}
+
+	for( size_t c = 0; c < ARRAY_LENGTH(config_counts); ++c ) {
+		const size_t count = config_counts[c];
+
+		char (*set)[CONFIG_KEY_LENGTH] = malloc(sizeof(*set) * count);
+		char (*unset)[CONFIG_KEY_LENGTH] = malloc(sizeof(*unset) * count);
+		if( !set || !unset ) {
+			fprintf(stderr, "Failed to allocate %zu keys!\n", count);
+			exit(1);
+		}
+
+		Config config;
+		config_init(&config);
+
+		for( size_t i = 0; i < count; ++i ) {
+			snprintf(set[i], sizeof(*set), "key_%zu", i);
+			snprintf(unset[i], sizeof(*unset), "unset_%zu", i);
+			config_set(&config, set[i], "value");
+		}
+
+		long long hits[ROUNDS], misses[ROUNDS];
+		volatile size_t found = 0;
+		for( size_t r = 0; r < ROUNDS; ++r ) {
+			long long start = bench_now_ns();
+			for( size_t i = 0; i < CONFIG_OPS; ++i ) {
+				found += config_get(&config, set[i % count]) != NULL;
+			}
+			hits[r] = bench_now_ns() - start;
+
+			start = bench_now_ns();
+			for( size_t i = 0; i < CONFIG_OPS; ++i ) {
+				found += config_get(&config, unset[i % count]) != NULL;
+			}
+			misses[r] = bench_now_ns() - start;
+		}
+
+		config_free(&config);
+		free(set);
+		free(unset);
+
+		if( _wanted("config_get") ) {
+			_report("config_get", count, CONFIG_OPS, hits, 0);
+		}
+
+		if( _wanted("config_get_missing") ) {
+			_report("config_get_missing", count, CONFIG_OPS, misses, 0);
+		}
+	}
+}
+
+/* Pushes commands onto stacks already full up to their budget, so every
+ * push drops the oldest command
+ */
+static void _bench_cmd(void) {
+	if( !_wanted("cmd_push") ) {
+		return;
+	}
+
+	for( size_t b = 0; b < ARRAY_LENGTH(cmd_budgets); ++b ) {
+		const size_t budget = cmd_budgets[b];
+
+		Command cmd = { .type = CMD_ADD_CH, .data.ch = 'x' };
+		const size_t fill = budget / cmd_get_size(&cmd) + 1;
+
+		CommandStack stack;
+		cmd_init(&stack);
+		cmd_set_budget(&stack, budget);
+		for( size_t i = 0; i < fill; ++i ) {
+			cmd_push(&stack, cmd);
+		}
+
+		long long pushes[ROUNDS];
+		for( size_t r = 0; r < ROUNDS; ++r ) {
+			long long start = bench_now_ns();
+			for( size_t i = 0; i < CMD_OPS; ++i ) {
+				cmd.line = i;
+				cmd_push(&stack, cmd);
+			}
+			pushes[r] = bench_now_ns() - start;
+		}
+
+		cmd_free(&stack);
+
+		_report("cmd_push", budget, CMD_OPS, pushes, 0);
+	}
+}
+
+/* Prints how a benchmark went, from the time each of its rounds took
+ * Throughput is worked out from @bytes handled per round, if it isn't 0
+ */
+static void _report(const char *name, size_t size, size_t ops,
+	long long *rounds, size_t bytes) {
+	qsort(rounds, ROUNDS, sizeof(*rounds), _compare_rounds);
+	const long long median = rounds[ROUNDS / 2];
+
+	Result result = {
+		.name = name,
+		.size = size,
+		.ops = ops,
+		.ns_per_op = (double)median / ops,
+		.mib_per_s = bytes && median
+			? bytes / (1024.0 * 1024.0) / (median / 1e9)
+			: 0.0,
+	};
+
+	if( format == FORMAT_CSV ) {
+		printf("%s,%zu,%zu,%.2f,", result.name, result.size, result.ops,
+			result.ns_per_op);
+		if( bytes ) {
+			printf("%.2f", result.mib_per_s);
+		}
+		printf("\n");
+	} else {
+		printf("%s  { \"name\": \"%s\", \"size\": %zu, \"ops\": %zu, "
+			   "\"ns_per_op\": %.2f",
+			reported ? ",\n" : "", result.name, result.size, result.ops,
+			result.ns_per_op);
+		if( bytes ) {
+			printf(", \"mib_per_s\": %.2f", result.mib_per_s);
+		}
+		printf(" }");
+	}
+
+	++reported;
+	fflush(stdout);
+}
+
+/* Orders rounds from fastest to slowest */
+static int _compare_rounds(const void *a, const void *b) {
+	const long long x = *(const long long *)a, y = *(const long long *)b;
+	return (x > y) - (x < y);
+}
+
+/* Writes @lines lines of 18 bytes to the file at @path
+ * Returns false if it couldn't be written
+ */
+static bool _write_lines(const char *path, size_t lines) {
+	FILE *fp = fopen(path, "wb");
+	if( fp == NULL ) {
+		perror("Failed to write the fixture");
+		return false;
+	}
+
+	for( size_t i = 0; i < lines; ++i ) {
+		fprintf(fp, "%07zu short line\n", i % 10000000);
+	}
+
+	fclose(fp);
+	return true;
+}
+
+/* Returns a pseudo-random number below @bound, the same every run */
+static size_t _random(size_t bound) {
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+
+	return bound ? (size_t)(state % bound) : 0;
+}
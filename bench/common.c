@@ -0,0 +1,85 @@
+/* edit
+ * Helpers shared by the benchmarks
+ */
+
+#include <dirent.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+
+/* Creates a new directory for @name to keep its files in, writing its path
+ * to @dir, which has room for BENCH_PATH_MAX characters
+ * Returns false if it couldn't be created
+ */
+bool bench_make_dir(char *dir, const char *name) {
+	const char *tmp = getenv("TMPDIR");
+	snprintf(dir, BENCH_PATH_MAX, "%s/%s.XXXXXX", tmp ? tmp : "/tmp", name);
+
+	if( mkdtemp(dir) == NULL ) {
+		perror("Failed to create a directory for the fixtures");
+		return false;
+	}
+
+	return true;
+}
+
+/* Writes the path of the file in @dir named by @fmt to @path, which has room
+ * for BENCH_PATH_MAX characters
+ * Returns false if it doesn't fit
+ */
+bool bench_make_path(char *path, const char *dir, const char *fmt, ...) {
+	const int n = snprintf(path, BENCH_PATH_MAX, "%s/", dir);
+	if( n < 0 || n >= BENCH_PATH_MAX ) {
+		fprintf(stderr, "Path in %s is too long!\n", dir);
+		return false;
+	}
+
+	va_list args;
+	va_start(args, fmt);
+	const int m = vsnprintf(path + n, BENCH_PATH_MAX - n, fmt, args);
+	va_end(args);
+
+	if( m < 0 || m >= BENCH_PATH_MAX - n ) {
+		fprintf(stderr, "Path in %s is too long!\n", dir);
+		return false;
+	}
+
+	return true;
+}
+
+/* Removes @dir along with everything in it */
+void bench_remove_dir(const char *dir) {
+	DIR *d = opendir(dir);
+	if( d ) {
+		struct dirent *entry;
+		while( (entry = readdir(d)) ) {
+			if( strcmp(entry->d_name, ".") == 0
+				|| strcmp(entry->d_name, "..") == 0 ) {
+				continue;
+			}
+
+			char path[BENCH_PATH_MAX];
+			snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+			unlink(path);
+		}
+
+		closedir(d);
+	}
+
+	rmdir(dir);
+}
+
+/* Returns a monotonic clock reading, in nanoseconds */
+long long bench_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,17 @@
+#ifndef GUARD_EDIT_BENCH_COMMON_H_
+#define GUARD_EDIT_BENCH_COMMON_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ARRAY_LENGTH(A) (sizeof(A) / sizeof(*(A)))
+
+#define BENCH_PATH_MAX (4096)
+
+bool bench_make_dir(char *dir, const char *name);
+bool bench_make_path(char *path, const char *dir, const char *fmt, ...);
+void bench_remove_dir(const char *dir);
+
+long long bench_now_ns(void);
+
+#endif // !GUARD_EDIT_BENCH_COMMON_H_
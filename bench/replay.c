@@ -0,0 +1,519 @@
+/* edit
+ * Keystroke replay benchmark
+ *
+ * Feeds keystroke scripts through edit_update() against fixture files, on a
+ * terminal in memory, and reports how long each key took to apply and draw,
+ * how many allocations it made and how many bytes it would have sent
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+
+#include "term.h"
+#include "edit.h"
+
+#include "common.h"
+
+#define DEFAULT_W (120) /* Columns of the terminal keys are replayed on */
+#define DEFAULT_H (40) /* Rows of the terminal keys are replayed on */
+
+#define LONG_LINE_BYTES (1024 * 1024) /* Length of the long-line fixture */
+#define MANY_LINES_COUNT (1000 * 1000) /* Lines of the many-lines fixture */
+#define DEEP_UNDO_LINES (1000) /* Lines of the deep-undo fixture */
+#define DEEP_UNDO_STATES (2000) /* Undo states the deep-undo script makes */
+
+#define ESC (0x1b)
+
+/* Keys to replay */
+typedef struct _Script {
+	int *keys;
+	size_t length;
+	size_t capacity;
+} Script;
+
+/* A file to replay keys against, and the keys replayed by default */
+typedef struct _Fixture {
+	const char *name;
+	void (*write)(FILE *fp);
+	void (*script)(Script *script);
+} Fixture;
+
+/* Escape sequences of keys a recorded script may hold */
+typedef struct _KeySeq {
+	const char *seq;
+	int key;
+} KeySeq;
+
+static void _usage(const char *argv0);
+static const Fixture *_find_fixture(const char *name);
+
+static bool _run(const Fixture *fixture, Script *custom, const char *dir,
+	size_t w, size_t h);
+static void _report(const Fixture *fixture, long long *samples, size_t count,
+	size_t keys, long long load, size_t allocs, size_t bytes);
+static int _compare_samples(const void *a, const void *b);
+static long long _percentile(long long *sorted, size_t count, size_t p);
+
+static bool _read_script(Script *script, const char *path);
+static void _decode_script(Script *script, const char *buf, size_t length);
+
+static void _push(Script *script, int key);
+static void _push_str(Script *script, const char *str);
+static void _push_times(Script *script, const char *str, size_t times);
+
+static void _write_long_line(FILE *fp);
+static void _write_many_lines(FILE *fp);
+static void _write_deep_undo(FILE *fp);
+
+static void _script_long_line(Script *script);
+static void _script_many_lines(Script *script);
+static void _script_deep_undo(Script *script);
+
+
+static const Fixture fixtures[] = {
+	{ "long-line", _write_long_line, _script_long_line },
+	{ "many-lines", _write_many_lines, _script_many_lines },
+	{ "deep-undo", _write_deep_undo, _script_deep_undo },
+};
+
+/* What terminals send for the keys the editor knows about */
+static const KeySeq key_seqs[] = {
+	{ "\x1b[200~", KEY_PASTE_BEGIN },
+	{ "\x1b[201~", KEY_PASTE_END },
+	{ "\x1b[2~", KEY_IC },
+	{ "\x1b[A", KEY_UP },
+	{ "\x1b[B", KEY_DOWN },
+	{ "\x1b[C", KEY_RIGHT },
+	{ "\x1b[D", KEY_LEFT },
+	{ "\x1bOA", KEY_UP },
+	{ "\x1bOB", KEY_DOWN },
+	{ "\x1bOC", KEY_RIGHT },
+	{ "\x1bOD", KEY_LEFT },
+};
+
+#ifdef REPLAY_COUNT_ALLOCS
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static size_t allocs = 0; /* Allocations made so far */
+
+void *__wrap_malloc(size_t size) {
+	++allocs;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+	++allocs;
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	++allocs;
+	return __real_realloc(ptr, size);
+}
+#endif
+
+int main(int argc, char *argv[]) {
+	size_t w = DEFAULT_W, h = DEFAULT_H;
+	const char *script_path = NULL;
+
+	const Fixture *chosen[ARRAY_LENGTH(fixtures)];
+	size_t count = 0;
+
+	for( int i = 1; i < argc; ++i ) {
+		if( strcmp(argv[i], "-s") == 0 && i + 1 < argc ) {
+			script_path = argv[++i];
+		} else if( strcmp(argv[i], "-w") == 0 && i + 1 < argc ) {
+			w = strtoul(argv[++i], NULL, 10);
+		} else if( strcmp(argv[i], "-h") == 0 && i + 1 < argc ) {
+			h = strtoul(argv[++i], NULL, 10);
+		} else if( argv[i][0] == '-' ) {
+			_usage(argv[0]);
+			return EXIT_FAILURE;
+		} else {
+			const Fixture *fixture = _find_fixture(argv[i]);
+			if( fixture == NULL || count == ARRAY_LENGTH(chosen) ) {
+				fprintf(stderr, "Unknown fixture '%s'!\n", argv[i]);
+				_usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+
+			chosen[count++] = fixture;
+		}
+	}
+
+	/* The editor needs a status bar, a command line and a row of text */
+	if( w < STATUS_MSG_LEN || h < 4 ) {
+		fprintf(stderr, "The terminal must be at least %dx4!\n", STATUS_MSG_LEN);
+		return EXIT_FAILURE;
+	}
+
+	if( count == 0 ) {
+		for( size_t i = 0; i < ARRAY_LENGTH(fixtures); ++i ) {
+			chosen[count++] = &fixtures[i];
+		}
+	}
+
+	Script custom = { 0 };
+	if( script_path && !_read_script(&custom, script_path) ) {
+		return EXIT_FAILURE;
+	}
+
+	char dir[BENCH_PATH_MAX];
+	if( !bench_make_dir(dir, "edit_replay") ) {
+		return EXIT_FAILURE;
+	}
+
+	printf("%-12s %8s %9s %9s %9s %9s %11s %10s\n", "fixture", "keys",
+		"load ms", "p50 us", "p99 us", "max us", "allocs/key", "bytes/key");
+
+	bool ok = true;
+	for( size_t i = 0; i < count && ok; ++i ) {
+		ok = _run(chosen[i], script_path ? &custom : NULL, dir, w, h);
+	}
+
+	bench_remove_dir(dir);
+	free(custom.keys);
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Prints how to run the benchmark */
+static void _usage(const char *argv0) {
+	fprintf(stderr, "usage: %s [-s script] [-w cols] [-h rows] [fixture...]\n",
+		argv0);
+	fprintf(stderr, "fixtures:");
+	for( size_t i = 0; i < ARRAY_LENGTH(fixtures); ++i ) {
+		fprintf(stderr, " %s", fixtures[i].name);
+	}
+	fprintf(stderr, "\n");
+}
+
+/* Returns the fixture called @name, or NULL */
+static const Fixture *_find_fixture(const char *name) {
+	for( size_t i = 0; i < ARRAY_LENGTH(fixtures); ++i ) {
+		if( strcmp(fixtures[i].name, name) == 0 ) {
+			return &fixtures[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* Replays @custom, or the fixture's own script, against a fresh copy of
+ * @fixture in @dir
+ *
+ * Keys are all queued up front, and a frame may only apply one, so each
+ * edit_update() times a single key along with the frame drawing it. Keys a
+ * command reads as its arguments, like counts, count with the key that
+ * started it
+ */
+static bool _run(const Fixture *fixture, Script *custom, const char *dir,
+	size_t w, size_t h) {
+	char path[BENCH_PATH_MAX];
+	if( !bench_make_path(path, dir, "%s", fixture->name) ) {
+		return false;
+	}
+
+	FILE *fp = fopen(path, "wb");
+	if( fp == NULL ) {
+		perror("Failed to write the fixture");
+		return false;
+	}
+
+	fixture->write(fp);
+	fclose(fp);
+
+	Script own = { 0 };
+	Script *script = custom;
+	if( script == NULL ) {
+		fixture->script(&own);
+		script = &own;
+	}
+
+	long long *samples = malloc(sizeof(*samples) * MAX(script->length, 1));
+	if( !samples ) {
+		fprintf(stderr, "Failed to allocate %zu samples!\n", script->length);
+		exit(1);
+	}
+
+	Term term;
+	term_init_memory(&term, w, h);
+	term_use(&term);
+
+	Edit edit;
+	const long long load = bench_now_ns();
+	edit_init(&edit, path);
+	const long long loaded = bench_now_ns();
+
+	edit_set_config(&edit, "frame_budget", "0");
+	for( size_t i = 0; i < script->length; ++i ) {
+		term_push_key(&term, script->keys[i]);
+	}
+
+#ifdef REPLAY_COUNT_ALLOCS
+	const size_t allocs_before = allocs;
+#endif
+	const size_t bytes_before = term.stats.bytes;
+
+	size_t count = 0;
+	while( edit.running && term.as.memory.length > 0 ) {
+		const long long start = bench_now_ns();
+		edit_update(&edit);
+		samples[count++] = bench_now_ns() - start;
+	}
+
+	const size_t keys = script->length - term.as.memory.length;
+	size_t allocated = 0;
+#ifdef REPLAY_COUNT_ALLOCS
+	allocated = allocs - allocs_before;
+#endif
+
+	_report(fixture, samples, count, keys, loaded - load, allocated,
+		term.stats.bytes - bytes_before);
+
+	/* Quitting frees the editor already */
+	if( edit.running ) {
+		edit_free(&edit);
+	}
+
+	term_free(&term);
+	free(samples);
+	free(own.keys);
+
+	return true;
+}
+
+/* Prints a row of results */
+static void _report(const Fixture *fixture, long long *samples, size_t count,
+	size_t keys, long long load, size_t allocs, size_t bytes) {
+	qsort(samples, count, sizeof(*samples), _compare_samples);
+
+	const double per_key = keys ? 1.0 / keys : 0.0;
+	printf("%-12s %8zu %9.1f %9.1f %9.1f %9.1f", fixture->name, keys,
+		load / 1e6, _percentile(samples, count, 50) / 1e3,
+		_percentile(samples, count, 99) / 1e3,
+		(count ? samples[count - 1] : 0) / 1e3);
+
+#ifdef REPLAY_COUNT_ALLOCS
+	printf(" %11.2f", allocs * per_key);
+#else
+	UNUSED(allocs);
+	printf(" %11s", "-");
+#endif
+
+	printf(" %10.1f\n", bytes * per_key);
+	fflush(stdout);
+}
+
+/* Orders samples from fastest to slowest */
+static int _compare_samples(const void *a, const void *b) {
+	const long long x = *(const long long *)a, y = *(const long long *)b;
+	return (x > y) - (x < y);
+}
+
+/* Returns the @p-th percentile of @count @sorted samples, by nearest rank */
+static long long _percentile(long long *sorted, size_t count, size_t p) {
+	if( count == 0 ) {
+		return 0;
+	}
+
+	const size_t rank = (count * p + 99) / 100;
+	return sorted[rank ? rank - 1 : 0];
+}
+
+/* Reads the keys recorded in the file at @path
+ * Returns false if it couldn't be read
+ */
+static bool _read_script(Script *script, const char *path) {
+	FILE *fp = fopen(path, "rb");
+	if( fp == NULL ) {
+		perror("Failed to open the script");
+		return false;
+	}
+
+	size_t length = 0, capacity = 4096;
+	char *buf = malloc(capacity);
+	size_t n;
+	while( buf && (n = fread(buf + length, 1, capacity - length, fp)) > 0 ) {
+		length += n;
+		if( length == capacity ) {
+			capacity *= 2;
+			buf = realloc(buf, capacity);
+		}
+	}
+
+	fclose(fp);
+	if( !buf ) {
+		fprintf(stderr, "Failed to allocate script of %zu bytes!\n", capacity);
+		exit(1);
+	}
+
+	_decode_script(script, buf, length);
+	free(buf);
+
+	return true;
+}
+
+/* Turns the bytes a terminal sent into keys, as ncurses would
+ * Escape sequences of keys the editor doesn't know are left as bytes
+ */
+static void _decode_script(Script *script, const char *buf, size_t length) {
+	size_t i = 0;
+	while( i < length ) {
+		const unsigned char ch = buf[i];
+
+		if( ch == ESC ) {
+			bool found = false;
+			for( size_t k = 0; k < ARRAY_LENGTH(key_seqs) && !found; ++k ) {
+				const size_t n = strlen(key_seqs[k].seq);
+				if( n <= length - i && memcmp(buf + i, key_seqs[k].seq, n) == 0 ) {
+					_push(script, key_seqs[k].key);
+					i += n;
+					found = true;
+				}
+			}
+
+			if( found ) {
+				continue;
+			}
+		}
+
+		switch( ch ) {
+		case '\r':
+			_push(script, '\n');
+			break;
+		case 0x7f:
+		case '\b':
+			_push(script, KEY_BACKSPACE);
+			break;
+		default:
+			_push(script, ch);
+		}
+
+		++i;
+	}
+}
+
+/* Adds @key to the end of the script */
+static void _push(Script *script, int key) {
+	if( script->length == script->capacity ) {
+		script->capacity = script->capacity ? script->capacity * 2 : 256;
+		script->keys = realloc(
+			script->keys, sizeof(*script->keys) * script->capacity);
+		if( !script->keys ) {
+			fprintf(stderr, "Failed to allocate script of %zu keys!\n",
+				script->capacity);
+			exit(1);
+		}
+	}
+
+	script->keys[script->length++] = key;
+}
+
+/* Adds every character of @str to the end of the script */
+static void _push_str(Script *script, const char *str) {
+	while( *str ) {
+		_push(script, (unsigned char)*str++);
+	}
+}
+
+/* Adds @str to the end of the script @times times */
+static void _push_times(Script *script, const char *str, size_t times) {
+	for( size_t i = 0; i < times; ++i ) {
+		_push_str(script, str);
+	}
+}
+
+/* Writes a single line of LONG_LINE_BYTES */
+static void _write_long_line(FILE *fp) {
+	static const char pattern[] = "abcdefghijklmnopqrstuvwxyz 0123456789 ";
+
+	for( size_t i = 0; i < LONG_LINE_BYTES; ++i ) {
+		fputc(pattern[i % (sizeof(pattern) - 1)], fp);
+	}
+
+	fputc('\n', fp);
+}
+
+/* Writes MANY_LINES_COUNT short lines */
+static void _write_many_lines(FILE *fp) {
+	for( size_t i = 0; i < MANY_LINES_COUNT; ++i ) {
+		fprintf(fp, "%07zu short line\n", i);
+	}
+}
+
+/* Writes DEEP_UNDO_LINES lines to make a history on */
+static void _write_deep_undo(FILE *fp) {
+	for( size_t i = 0; i < DEEP_UNDO_LINES; ++i ) {
+		fprintf(fp, "line %zu of the deep undo fixture\n", i);
+	}
+}
+
+/* Types at both ends of the long line, then takes some of it back */
+static void _script_long_line(Script *script) {
+	_push(script, 'i');
+	_push_times(script, "word ", 64);
+	for( size_t i = 0; i < 32; ++i ) {
+		_push(script, KEY_BACKSPACE);
+	}
+	_push(script, ESC);
+
+	_push_str(script, "$a");
+	_push_times(script, "tail ", 16);
+	_push(script, ESC);
+
+	_push_times(script, "u", 3);
+	_push_str(script, "^");
+	_push_times(script, "l", 64);
+}
+
+/* Jumps and scrolls around a million lines, adding and taking out lines */
+static void _script_many_lines(Script *script) {
+	_push_str(script, "G");
+	_push_str(script, "gg");
+	_push_str(script, "500000G");
+	_push_times(script, "j", 100);
+	_push_times(script, "k", 100);
+
+	_push_str(script, "otyped on a new line");
+	_push(script, ESC);
+
+	_push(script, 'i');
+	_push_times(script, "\n", 10);
+	_push(script, ESC);
+
+	_push_times(script, "5dd", 4);
+	_push_times(script, "u", 6);
+	for( size_t i = 0; i < 3; ++i ) {
+		_push(script, CTRL('y'));
+	}
+
+	_push_str(script, "Gdd");
+}
+
+/* Makes DEEP_UNDO_STATES states, undoes and redoes all of them, then travels
+ * through the history by number
+ */
+static void _script_deep_undo(Script *script) {
+	for( size_t i = 0; i < DEEP_UNDO_STATES; ++i ) {
+		_push(script, i % 2 ? 'j' : 'i');
+		_push_str(script, "ab");
+		_push(script, ESC);
+	}
+
+	_push_times(script, "u", DEEP_UNDO_STATES);
+	for( size_t i = 0; i < DEEP_UNDO_STATES; ++i ) {
+		_push(script, CTRL('y'));
+	}
+
+	_push_str(script, ":undo 1000\n");
+	_push_str(script, ":earlier 500\n");
+	_push_str(script, ":later 1500\n");
+}
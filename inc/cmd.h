@@ -1,23 +1,36 @@
 #ifndef GUARD_EDIT_CMD_H_
 #define GUARD_EDIT_CMD_H_
 
+#include <stdbool.h>
 #include <stddef.h>
 
 #include "line.h"
+#include "piece.h"
 
-#define MAX_COMMANDS (64)
+#define CMD_INITIAL_CAPACITY (64)
+#define CMD_DEFAULT_BUDGET (16 * 1024 * 1024) /* Bytes of history to keep */
 
 typedef enum _CommandType {
 	CMD_REP_CH, /* Replaces a character */
 	CMD_ADD_CH, /* Adds a character */
 	CMD_DEL_CH, /* Deletes a character */
 	CMD_NEW_LINE, /* Adds a line break */
-	CMD_ADD_LINE, /* Adds a line */
-	CMD_DEL_LINE, /* Deletes a line */
+	CMD_ADD_LINE, /* Adds back a block of lines that was cut out */
+	CMD_DEL_LINE, /* Cuts out a block of lines */
+	CMD_REP_STR, /* Replaces a run of characters */
+	CMD_ADD_STR, /* Adds a run of text */
+	CMD_DEL_STR, /* Deletes the run of text ending at its position */
 } CommandType;
 
 /* Structure representing a command
  * This is used for the undo/redo system
+ *
+ * Runs of typing, erasing or replacing are merged into a single string
+ * command as they are pushed, which keeps its text in @data.line
+ *
+ * Whole lines aren't copied: the pieces holding them are cut out of the
+ * table and kept in @data.block, and a command cutting them again only needs
+ * their number, in @length
  */
 typedef struct _Command {
 	CommandType type;
@@ -27,28 +40,58 @@ typedef struct _Command {
 	union {
 		char ch;
 		Line line;
+		struct {
+			PieceTable *table; /* Table the lines were cut out of */
+			Piece *pieces; /* Pieces holding the lines */
+			bool placeholder; /* Whether the cut left an empty line behind */
+		} block;
 	} data;
 } Command;
 
-/* Structure representing a stack of Commands */
+/* Structure representing a stack of Commands
+ *
+ * The commands live in a ring that grows as needed, so pushing and popping
+ * never move the rest of the stack. Once the commands take up more than
+ * @budget bytes, the oldest ones are dropped
+ */
 typedef struct _CommandStack {
-	Command cmds[MAX_COMMANDS];
-	size_t length;
+	Command *cmds; /* Ring of commands, the oldest at @head */
+	size_t head; /* Index of the oldest command */
+	size_t length; /* Number of commands */
+	size_t capacity; /* Size of the ring, a power of two */
+
+	size_t bytes; /* Memory taken up by the commands */
+	size_t budget; /* Most memory the commands may take up, or 0 for no limit */
+
+	bool sealed; /* Whether the command on top may no longer be merged into */
 } CommandStack;
 
 void cmd_init(CommandStack *cmds);
+void cmd_free(CommandStack *cmds);
+
+void cmd_set_budget(CommandStack *cmds, size_t budget);
 
 void cmd_push(CommandStack *cmds, Command cmd);
 Command *cmd_pop(CommandStack *cmds);
+Command *cmd_shift(CommandStack *cmds);
+
+void cmd_seal(CommandStack *cmds);
 
 void cmd_rep_ch(CommandStack *cmds, size_t line, size_t idx, char ch);
 void cmd_add_ch(CommandStack *cmds, size_t line, size_t idx, char ch);
 void cmd_del_ch(CommandStack *cmds, size_t line, size_t idx, char ch);
 
 void cmd_new_line(CommandStack *cmds, size_t line, size_t idx);
-void cmd_add_line(CommandStack *cmds, size_t line, size_t idx, Line l);
-void cmd_del_line(CommandStack *cmds, size_t line, size_t idx, Line l);
+void cmd_add_line(CommandStack *cmds, size_t line, PieceTable *table,
+	Piece *pieces, bool placeholder);
+void cmd_del_line(CommandStack *cmds, size_t line, size_t count);
+
+void cmd_rep_str(CommandStack *cmds, size_t line, size_t idx, Line text);
+void cmd_add_str(CommandStack *cmds, size_t line, size_t idx, Line text);
+void cmd_del_str(CommandStack *cmds, size_t line, size_t idx, Line text);
 
 void cmd_free_cmd(Command *cmd);
+bool cmd_has_text(Command *cmd);
+size_t cmd_get_size(Command *cmd);
 
 #endif // !GUARD_EDIT_CMD_H_
@@ -5,13 +5,25 @@
 #include <stddef.h>
 #include <stdio.h>
 
+#ifdef USE_PDCURSES
+#include <curses.h>
+#else
+#include <ncurses.h>
+#endif
+
 #include "file.h"
 #include "line.h"
 #include "cmd.h"
 #include "config.h"
+#include "undo.h"
+#include "sidecar.h"
+#include "screen.h"
+#include "stats.h"
 
 #define STATUS_MSG_LEN (60)
 
+#define FRAME_BUDGET_MS (16) /* Default time a frame may spend applying keys */
+
 /* Editor modes */
 typedef enum _Mode {
 	EDIT_MODE_NORMAL,
@@ -32,11 +44,19 @@ typedef struct _Edit {
 	size_t w, h; /* Terminal dimensions */
 	size_t gutter; /* Gutter size */
 
+	Screen screen; /* What the rows of the file look like on the terminal */
+
 	char msg[STATUS_MSG_LEN]; /* Status message */
 	int msg_len; /* Cached status message length */
 
 	bool running;
 
+	bool batching; /* Whether keys are being applied as part of a frame */
+	long frame_budget; /* Longest a frame applies keys for, in milliseconds */
+#ifdef EDIT_STATS
+	Stats stats; /* How long recent frames took */
+#endif
+
 	Config config; /* Configuration */
 
 	Mode mode; /* Current editor mode */
@@ -49,8 +69,10 @@ typedef struct _Edit {
 	size_t vis_start_idx; /* Starting index of selection */
 	size_t vis_length; /* Length of the selection */
 
-	CommandStack undo; /* Undo stack */
-	CommandStack redo; /* Redo stack */
+	CommandStack undo; /* Edits not yet added to the history */
+	CommandStack inverse; /* Catches the inverse of an undone or redone edit */
+	UndoTree history; /* Every state the file went through */
+	Sidecar sidecar; /* History kept next to the file */
 
 	size_t last_ins_line; /* Line of the last insert */
 	size_t last_ins_idx; /* Character index of the last insert */
@@ -85,12 +107,17 @@ void edit_add_ch(Edit *edit, CommandStack *stack, char ch);
 void edit_del_ch(Edit *edit, CommandStack *stack, char ch);
 
 void edit_new_line(Edit *edit, CommandStack *stack);
-void edit_add_line(Edit *edit, CommandStack *stack, Line l);
-void edit_del_line(Edit *edit, CommandStack *stack, Line l);
+void edit_add_line(
+	Edit *edit, CommandStack *stack, Piece *pieces, bool placeholder);
+void edit_del_line(Edit *edit, CommandStack *stack, size_t count);
 
 void edit_undo(Edit *edit);
 void edit_redo(Edit *edit);
 
+void edit_travel(Edit *edit, long steps);
+void edit_travel_to(Edit *edit, size_t seq);
+void edit_travel_time(Edit *edit, long seconds);
+
 void edit_perform_cmd(Edit *edit, CommandStack *stack, Command *cmd);
 
 void edit_yank(Edit *edit, char into, bool kill);
@@ -102,6 +129,8 @@ void edit_replace_char(Edit *edit, CommandStack *stack, char ch);
 void edit_insert_char(Edit *edit, CommandStack *stack, char ch);
 void edit_delete_char(Edit *edit, CommandStack *stack);
 
+void edit_delete_lines(Edit *edit, CommandStack *stack, size_t count);
+
 bool edit_move_up(Edit *edit);
 bool edit_move_down(Edit *edit);
 bool edit_move_left(Edit *edit);
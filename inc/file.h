@@ -3,38 +3,71 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
+#if defined(__linux__) || defined(__APPLE__)
+#include <pthread.h>
+#endif
+
 #include "line.h"
+#include "piece.h"
+#include "slab.h"
+#include "screen.h"
 #include "config.h"
+#include "save.h"
+#include "journal.h"
 
 #define MAX_FILE_NAME_SIZE (256)
+#define FILE_HASH_THREAD_MIN (1024 * 1024) /* Smallest file hashed on a thread */
 
 typedef struct _File {
 	char name[MAX_FILE_NAME_SIZE]; /* File name */
 
-	Line *lines; /* Lines in the file */
-	size_t length; /* Number of lines in the line array */
-	size_t capacity; /* Maximum capacity of the line array */
+	Slab slab; /* Allocator for line text */
+	PieceTable table; /* Lines in the file */
+	size_t length; /* Number of lines in the file */
 
 	Config config; /* Configuration */
+	Config *parent; /* Configuration to fall back on */
+
+	Save save; /* Save running in the background */
+	Journal journal; /* Edits made since the file was last saved */
+
+	uint64_t loaded_hash; /* Hash of the file as it was loaded */
+#if defined(__linux__) || defined(__APPLE__)
+	pthread_t hasher; /* Thread working out the hash */
+#endif
+	bool hashing; /* Whether the hasher has yet to be joined */
 
 	bool unnamed;
 	bool dirty;
 } File;
 
-bool file_init(File *file, const char *filename);
+bool file_init(File *file, const char *filename, Config *parent);
 void file_free(File *file);
 
 bool file_load(File *file, const char *filename);
 bool file_load_from_fp(File *file, FILE *fp);
 bool file_save(File *file, const char *as);
 
-void file_render(File *file, size_t from, int gutter);
-void file_render_line(File *file, size_t idx, size_t from, int gutter);
+SaveState file_poll_save(File *file, size_t *written, size_t *total);
+SaveState file_wait_save(File *file);
+bool file_is_saving(File *file);
+
+uint64_t file_get_saved_hash(File *file);
+void file_start_hash(File *file);
+uint64_t file_get_loaded_hash(File *file);
 
-void file_render_color(File *file, size_t from, int gutter);
-void file_render_line_color(File *file, size_t idx, size_t from, int gutter);
+bool file_has_recovery(File *file);
+size_t file_recover(File *file);
+void file_discard_recovery(File *file);
+
+int file_get_journal_timeout(File *file);
+void file_tick_journal(File *file);
+void file_flush_journal(File *file);
+
+void file_render(File *file, Screen *screen, size_t from, int gutter);
 
 void file_mark_dirty(File *file);
 bool file_is_dirty(File *file);
@@ -47,11 +80,19 @@ void file_insert_string(File *file, size_t idx, char *str);
 
 void file_break_line(File *file, size_t line, size_t idx);
 
+size_t file_insert_text(File *file, size_t line, size_t idx, const char *text,
+	size_t length, size_t *end);
+void file_delete_text(
+	File *file, size_t line, size_t idx, size_t end_line, size_t end_idx);
+
 void file_insert_empty_line(File *file, size_t idx);
 
 void file_insert_line(File *file, size_t idx, Line *line);
 void file_delete_line(File *file, size_t idx);
 
+Piece *file_cut_lines(File *file, size_t idx, size_t count);
+void file_paste_lines(File *file, size_t idx, Piece *pieces, bool placeholder);
+
 size_t file_move_line_up(File *file, size_t idx);
 
 void file_shift_lines_up(File *file, size_t idx);
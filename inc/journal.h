@@ -0,0 +1,82 @@
+#ifndef GUARD_EDIT_JOURNAL_H_
+#define GUARD_EDIT_JOURNAL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define JOURNAL_MAGIC "EDJ2"
+#define JOURNAL_HEADER_SIZE (32) /* Magic, padding, and the base file */
+
+#define JOURNAL_FLUSH_MS (500) /* How long records may wait to be written */
+#define JOURNAL_BUFFER (64 * 1024) /* Bytes of records to write at once */
+
+/* Kind of edit a record describes */
+typedef enum _JournalOp {
+	JOURNAL_REPLACE_CHAR, /* Replaces the character at (line, idx) */
+	JOURNAL_INSERT_CHAR, /* Inserts a character at (line, idx) */
+	JOURNAL_DELETE_CHAR, /* Deletes the character at (line, idx) */
+	JOURNAL_BREAK_LINE, /* Breaks a line in two at (line, idx) */
+	JOURNAL_JOIN_LINE, /* Appends a line to the one above it */
+	JOURNAL_INSERT_LINE, /* Inserts a line of text before a line */
+	JOURNAL_DELETE_LINE, /* Deletes a line */
+	JOURNAL_DELETE_LINES, /* Deletes (idx) lines from a line on */
+} JournalOp;
+
+/* A single edit, as written to the journal */
+typedef struct _JournalRecord {
+	JournalOp op;
+	size_t line; /* Line the edit happened on */
+	size_t idx; /* Character the edit happened at */
+	char ch; /* Character inserted or replaced with */
+
+	const char *text; /* Text of an inserted line */
+	size_t length; /* Length of the text */
+} JournalRecord;
+
+/* An append-only log of every edit made to a file since it was last saved
+ *
+ * It lives next to the file, so edits that were never saved can be replayed
+ * on top of it after a crash. Records are buffered, and written out once the
+ * oldest has waited JOURNAL_FLUSH_MS, or once JOURNAL_BUFFER bytes pile up
+ */
+typedef struct _Journal {
+	char *path; /* Path to the journal, or NULL if not journaling */
+	int fd; /* Journal file, or -1 if it hasn't been created yet */
+
+	char *buf; /* Records waiting to be written */
+	size_t length; /* Bytes waiting to be written */
+	size_t capacity; /* Size of the buffer */
+
+	size_t written; /* Bytes of records in the journal file */
+	size_t mark; /* Bytes of records taken into the last save */
+	long long pending_since; /* When the oldest waiting record was made (ms) */
+
+	uint64_t base_size; /* Size of the file the records apply to */
+	int64_t base_mtime; /* Modification time of that file, in nanoseconds */
+	uint64_t base_inode; /* Inode of that file */
+
+	bool recoverable; /* Whether an old journal was found for the file */
+	bool paused; /* Whether recording is paused */
+} Journal;
+
+void journal_init(Journal *journal);
+void journal_free(Journal *journal);
+
+void journal_open(Journal *journal, const char *filename);
+
+size_t journal_replay(Journal *journal,
+	bool (*apply)(void *ctx, JournalRecord *record), void *ctx);
+void journal_discard(Journal *journal);
+
+bool journal_is_recording(Journal *journal);
+void journal_record(Journal *journal, JournalRecord *record);
+
+int journal_get_timeout(Journal *journal);
+void journal_tick(Journal *journal);
+void journal_flush(Journal *journal);
+
+void journal_mark(Journal *journal);
+void journal_rebase(Journal *journal, const char *filename);
+
+#endif // !GUARD_EDIT_JOURNAL_H_
@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#include "slab.h"
+
 /* Syntax highlighting data */
 typedef struct _ColorData {
 	struct {
@@ -14,22 +16,51 @@ typedef struct _ColorData {
 	int capacity; /* Maximum size of the color array */
 } ColorData;
 
-/* A line of text */
+/* Size of the inline buffer of short lines */
+#define LINE_SMALL_SIZE (24)
+
+/* Length a long line has to fall below to move back inline */
+#define LINE_SHRINK_SIZE (LINE_SMALL_SIZE / 2)
+
+/* A line of text
+ *
+ * Lines shorter than LINE_SMALL_SIZE - 1 keep their text inline, with room for
+ * a NUL terminator. Longer lines are stored as a gap buffer: the unused
+ * capacity sits at column @gap, so edits near the cursor don't need to move
+ * the rest of the line. They only move back inline once shorter than
+ * LINE_SHRINK_SIZE, so typing back and forth around the boundary doesn't
+ * reallocate every time
+ *
+ * The last byte of the inline buffer tells the two apart. It is always NUL in
+ * a short line, and holds the order of the capacity of a long one, which is
+ * never zero
+ */
 typedef struct _Line {
-	char *text; /* Characters in the line */
+	union {
+		struct {
+			char *text; /* Characters in the line, with the gap */
+			size_t gap; /* Column where the gap starts */
+			char unused[LINE_SMALL_SIZE - sizeof(char *) - sizeof(size_t) - 1];
+			unsigned char order; /* Capacity of the string, as a power of 2 */
+		} big;
+		char small[LINE_SMALL_SIZE]; /* Characters in a short line */
+	} as;
 	size_t length; /* Number of characters in the string */
-	size_t capacity; /* Maximum capacity of the string */
 
-	ColorData color;
+	Slab *slab; /* Allocator for the text, or NULL for the heap */
+
+	ColorData *color; /* Syntax highlighting data, if any */
 } Line;
 
 void line_init(Line *line);
+void line_init_slab(Line *line, Slab *slab);
 void line_free(Line *line);
 
 void line_zero(Line *line);
 void line_erase(Line *line);
 
 void line_render(Line *line);
+void line_render_str(const char *text, size_t length);
 void line_render_color(Line *line);
 
 void line_update_color(Line *line);
@@ -43,6 +74,7 @@ void line_insert_char(Line *line, size_t idx, char ch);
 char line_delete_char(Line *line, size_t idx);
 
 void line_insert_str(Line *line, size_t idx, char *str);
+void line_insert_strn(Line *line, size_t idx, const char *str, size_t len);
 void line_delete_str(Line *line, size_t idx, size_t len);
 
 char *line_copy(Line *line, size_t idx, long len, bool kill);
@@ -51,8 +83,14 @@ void line_shift_chars_forwards(Line *line, size_t idx, size_t by);
 void line_shift_chars_backwards(Line *line, size_t idx, size_t by);
 
 void line_clone(Line *from, Line *to, bool deep);
+void line_set_slab(Line *line, Slab *slab);
 
 void line_null_terminate(Line *line);
 char *line_get_c_str(Line *line, bool clone);
 
+bool line_is_small(Line *line);
+
+void line_get_spans(Line *line, const char **first, size_t *first_len,
+	const char **second, size_t *second_len);
+
 #endif // !GUARD_EDIT_LINE_H_
@@ -0,0 +1,100 @@
+#ifndef GUARD_EDIT_PIECE_H_
+#define GUARD_EDIT_PIECE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "line.h"
+#include "slab.h"
+
+/* Number of lines in each chunk of the add buffer */
+#define PIECE_ADD_CHUNK (1024)
+
+/* Buffer a piece points into */
+typedef enum _PieceBuffer {
+	PIECE_ORIG, /* Original file contents (read-only) */
+	PIECE_ADD, /* Lines added or edited since loading (append-only) */
+} PieceBuffer;
+
+/* A run of consecutive lines from one of the buffers
+ *
+ * Pieces are kept in a treap ordered by their position in the document, with
+ * each node caching the number of lines in its subtree
+ */
+typedef struct _Piece {
+	struct _Piece *left; /* Pieces before this one */
+	struct _Piece *right; /* Pieces after this one */
+	unsigned priority; /* Random heap priority */
+	size_t lines; /* Number of lines in this subtree */
+
+	PieceBuffer buf; /* Buffer the lines come from */
+	size_t start; /* Index of the first line in the buffer */
+	size_t length; /* Number of lines in the run */
+} Piece;
+
+/* A piece table of lines
+ *
+ * The original file is kept as one read-only buffer, indexed by line. It may be
+ * mapped straight from disk, in which case lines are only paged in once read.
+ * Any line that is created or edited lives in the append-only add buffer, and
+ * the document itself is the sequence of pieces
+ */
+typedef struct _PieceTable {
+	Slab *slab; /* Allocator for the text of added lines */
+
+	char *orig; /* Original file contents */
+	bool orig_mapped; /* Whether the contents are mapped from disk */
+	size_t orig_size; /* Size of the original contents in bytes */
+	size_t *orig_lines; /* Offset of each original line, plus the end */
+	size_t orig_length; /* Number of lines in the original buffer */
+
+	bool crlf; /* Whether lines end in "\r\n" rather than just "\n" */
+	bool nul; /* Whether the original contents have NUL bytes */
+
+	Line **add; /* Chunks of the add buffer */
+	size_t add_length; /* Number of lines in the add buffer */
+	size_t add_chunks; /* Number of allocated chunks */
+
+	Piece *root; /* Root of the tree of pieces */
+	size_t piece_count; /* Number of pieces */
+
+	size_t length; /* Number of lines in the document */
+} PieceTable;
+
+/* Iterator over the lines of a piece table, or of a block cut out of it */
+typedef struct _PieceIter {
+	PieceTable *table;
+	Piece *root; /* Root of the pieces being iterated over */
+	Piece *piece; /* Current piece */
+	size_t offset; /* Line offset into the current piece */
+	size_t line; /* Index of the next line in the document */
+} PieceIter;
+
+void piece_init(PieceTable *table, Slab *slab);
+void piece_free(PieceTable *table);
+
+void piece_load(
+	PieceTable *table, char *data, size_t size, bool mapped, size_t threads);
+
+Line *piece_get_line(PieceTable *table, size_t idx);
+size_t piece_get_line_length(PieceTable *table, size_t idx);
+
+Line *piece_peek_line(
+	PieceTable *table, size_t idx, const char **text, size_t *length);
+
+void piece_insert_line(PieceTable *table, size_t idx, Line *line);
+void piece_delete_line(PieceTable *table, size_t idx);
+
+Piece *piece_cut_lines(PieceTable *table, size_t idx, size_t count);
+void piece_paste_lines(PieceTable *table, size_t idx, Piece *pieces);
+void piece_free_lines(PieceTable *table, Piece *pieces);
+Piece *piece_make_lines(PieceTable *table, Line *lines, size_t count);
+
+void piece_iter_init(PieceIter *iter, PieceTable *table, size_t from);
+void piece_iter_init_cut(PieceIter *iter, PieceTable *table, Piece *pieces);
+bool piece_iter_next(
+	PieceIter *iter, Line **line, const char **text, size_t *length);
+size_t piece_iter_next_run(
+	PieceIter *iter, Line **line, const char **text, size_t *length);
+
+#endif // !GUARD_EDIT_PIECE_H_
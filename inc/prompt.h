@@ -1,18 +1,14 @@
 #ifndef GUARD_EDIT_PROMPT_H_
 #define GUARD_EDIT_PROMPT_H_
 
-#ifdef USE_PDCURSES
-#include <curses.h>
-#else
-#include <ncurses.h>
-#endif
-
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef enum _PromptType {
 	PROMPT_YES_NO,
 	PROMPT_YES_NO_CANCEL,
 	PROMPT_STR,
+	PROMPT_INFO,
 } PromptType;
 
 typedef enum _PromptOptResult {
@@ -22,7 +18,6 @@ typedef enum _PromptOptResult {
 } PromptOptResult;
 
 typedef struct _Prompt {
-	WINDOW *win;
 	int w;
 	int h;
 
@@ -30,9 +25,12 @@ typedef struct _Prompt {
 } Prompt;
 
 void prompt_init(Prompt *prompt, PromptType type, const char *msg, ...);
+void prompt_init_info(
+	Prompt *prompt, const char *title, const char *const *lines, size_t count);
 
 PromptOptResult prompt_opt_get(Prompt *prompt);
 char *prompt_str_get(Prompt *prompt);
+void prompt_wait(Prompt *prompt);
 
 void prompt_free(Prompt *prompt);
 
@@ -0,0 +1,85 @@
+#ifndef GUARD_EDIT_SAVE_H_
+#define GUARD_EDIT_SAVE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+#include "piece.h"
+
+#define SAVE_IOVECS (512) /* Spans handed to each writev() call */
+#define SAVE_BATCH (1024 * 1024) /* Bytes handed to each writev() call */
+#define SAVE_ATTEMPTS (64) /* Names to try for the temporary file */
+
+#define SAVE_FNV_PRIME (0x100000001b3ULL)
+#define SAVE_FNV_OFFSET_BASIS (0xcbf29ce484222325ULL)
+
+/* When to flush a saved file to disk */
+typedef enum _SyncPolicy {
+	SYNC_NEVER, /* Leave it to the system */
+	SYNC_FILE, /* Flush the file before renaming it into place */
+	SYNC_ALWAYS, /* Also flush the directory, so the rename sticks */
+} SyncPolicy;
+
+/* Progress of a save */
+typedef enum _SaveState {
+	SAVE_IDLE, /* Nothing being saved */
+	SAVE_RUNNING, /* Still writing */
+	SAVE_DONE, /* Written, but not yet reported */
+	SAVE_FAILED, /* Failed, but not yet reported */
+} SaveState;
+
+/* Text of one or more lines to save, without the last line ending */
+typedef struct _SaveSpan {
+	const char *text;
+	size_t length;
+} SaveSpan;
+
+/* A snapshot of a piece table, being written to disk
+ *
+ * Runs of original lines point straight into the original buffer, which never
+ * changes, and added lines are copied, so the table can keep being edited
+ * while the snapshot is written
+ */
+typedef struct _Save {
+	char *name; /* File to write to */
+	SyncPolicy policy;
+
+	SaveSpan *spans; /* Lines to write, in order */
+	size_t span_count; /* Number of spans */
+	char *copy; /* Copied text of the added lines */
+
+	const char *eol; /* Line ending */
+	size_t total; /* Bytes to write */
+	uint64_t hash; /* Hash of the bytes written, only read once joined */
+
+#if defined(__linux__) || defined(__APPLE__)
+	pthread_t thread; /* Thread doing the writing */
+	pthread_mutex_t lock; /* Guards the fields below */
+#endif
+	bool threaded; /* Whether the thread has yet to be joined */
+
+	SaveState state;
+	size_t written; /* Bytes written so far */
+	int error; /* Reason the save failed */
+} Save;
+
+void save_init(Save *save);
+void save_free(Save *save);
+
+void save_snapshot(
+	Save *save, PieceTable *table, const char *name, SyncPolicy policy);
+void save_start(Save *save);
+
+bool save_is_pending(Save *save);
+
+SaveState save_poll(Save *save, size_t *written, size_t *total);
+SaveState save_wait(Save *save);
+
+uint64_t save_hash(uint64_t hash, const char *data, size_t length);
+
+#endif // !GUARD_EDIT_SAVE_H_
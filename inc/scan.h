@@ -0,0 +1,33 @@
+#ifndef GUARD_EDIT_SCAN_H_
+#define GUARD_EDIT_SCAN_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SCAN_MIN_CHUNK (8 * 1024 * 1024) /* Smallest range given to a thread */
+#define SCAN_MAX_THREADS (64)
+
+/* Line index of a buffer, built in a single pass over it
+ *
+ * Line @i spans from lines[i] up to lines[i + 1] minus the line ending, as if
+ * the last line also ended in one
+ */
+typedef struct _ScanIndex {
+	size_t *lines; /* Offset of each line, plus the end */
+	size_t length; /* Number of lines */
+	size_t capacity; /* Number of offsets the array can hold */
+
+	size_t crlfs; /* Number of lines ending in "\r\n" */
+
+	bool crlf; /* Whether every line ends in "\r\n" */
+	bool nul; /* Whether the buffer contains NUL bytes */
+} ScanIndex;
+
+void scan_index(ScanIndex *index, const char *data, size_t size);
+void scan_index_parallel(
+	ScanIndex *index, const char *data, size_t size, size_t threads);
+void scan_free(ScanIndex *index);
+
+size_t scan_get_eol_length(ScanIndex *index);
+
+#endif // !GUARD_EDIT_SCAN_H_
@@ -0,0 +1,47 @@
+#ifndef GUARD_EDIT_SCREEN_H_
+#define GUARD_EDIT_SCREEN_H_
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SCREEN_WORD_BITS (sizeof(unsigned long) * CHAR_BIT)
+#define SCREEN_UNKNOWN ((size_t)-1) /* Length of a row whose text is unknown */
+
+/* What is on the terminal, and which rows of it may need drawing again
+ *
+ * Every row keeps a copy of the text last drawn to it, so drawing the same
+ * text again is skipped, and drawing different text only sends what changed.
+ * Rows that edits or scrolling may have changed are marked in a bitmap, and
+ * only those are put together again at all. Scrolling moves the rows already
+ * on the terminal, so only the rows it uncovers are drawn
+ */
+typedef struct _Screen {
+	size_t w, h; /* Size of the screen */
+
+	char *cells; /* Text last drawn to each row, @w bytes apiece */
+	size_t *lengths; /* Length of the text of each row, or SCREEN_UNKNOWN */
+	unsigned long *damage; /* Rows that may need drawing again, one bit each */
+
+	char *row; /* Text of the row being put together */
+	size_t length; /* Length of the row being put together */
+	size_t current; /* Index of the row being put together */
+} Screen;
+
+void screen_init(Screen *screen);
+void screen_free(Screen *screen);
+
+void screen_resize(Screen *screen, size_t w, size_t h);
+void screen_invalidate(Screen *screen);
+
+void screen_scroll(Screen *screen, long by);
+
+void screen_damage(Screen *screen, size_t from, size_t to);
+bool screen_is_damaged(Screen *screen, size_t row);
+size_t screen_get_damaged(Screen *screen, size_t from, size_t to);
+
+void screen_begin_row(Screen *screen, size_t row);
+void screen_add(Screen *screen, const char *text, size_t length);
+bool screen_end_row(Screen *screen);
+
+#endif // !GUARD_EDIT_SCREEN_H_
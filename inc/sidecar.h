@@ -0,0 +1,42 @@
+#ifndef GUARD_EDIT_SIDECAR_H_
+#define GUARD_EDIT_SIDECAR_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "piece.h"
+#include "undo.h"
+
+#define SIDECAR_MAGIC "EDU3"
+#define SIDECAR_HEADER_SIZE (72) /* Magic, base, hash, and where the tree was */
+#define SIDECAR_RECORD_SIZE (72) /* Command, links, and when it was made */
+
+/* Undo history kept in a hidden file next to the file it belongs to
+ *
+ * It is written each time a save finishes, from an image of the tree taken
+ * when the save started, and is keyed by a hash of what the save wrote. On
+ * load, only its header is read; the rest is mapped, and grafted onto the
+ * tree the first time the history is used
+ */
+typedef struct _Sidecar {
+	char *map; /* Mapped sidecar left by an earlier session, or NULL */
+	size_t size; /* Size of the mapping */
+	uint64_t hash; /* Hash of the file the mapped history applies to */
+
+	char *image; /* Tree as it was when the running save started */
+	size_t length; /* Size of the image */
+} Sidecar;
+
+void sidecar_init(Sidecar *sidecar);
+void sidecar_free(Sidecar *sidecar);
+
+void sidecar_open(Sidecar *sidecar, const char *filename, UndoTree *tree);
+bool sidecar_is_pending(Sidecar *sidecar);
+bool sidecar_import(
+	Sidecar *sidecar, UndoTree *tree, PieceTable *table, uint64_t hash);
+
+void sidecar_snapshot(Sidecar *sidecar, UndoTree *tree);
+bool sidecar_write(Sidecar *sidecar, const char *filename, uint64_t hash);
+
+#endif // !GUARD_EDIT_SIDECAR_H_
@@ -0,0 +1,52 @@
+#ifndef GUARD_EDIT_SLAB_H_
+#define GUARD_EDIT_SLAB_H_
+
+#include <stddef.h>
+
+#define SLAB_SIZE (64 * 1024) /* Size of each slab */
+
+#define SLAB_MIN_BLOCK (8) /* Size of the smallest block */
+#define SLAB_CLASSES (10) /* Number of size classes (8 up to 4096 bytes) */
+#define SLAB_MAX_BLOCK (SLAB_MIN_BLOCK << (SLAB_CLASSES - 1))
+
+/* Header of a slab, or of a block too big for any size class */
+typedef struct _SlabHeader {
+	struct _SlabHeader *prev;
+	struct _SlabHeader *next;
+} SlabHeader;
+
+/* A free block, linked into the free list of its size class */
+typedef struct _SlabBlock {
+	struct _SlabBlock *next;
+} SlabBlock;
+
+/* An allocator for line text
+ *
+ * Blocks are powers of two, carved out of large slabs and recycled through
+ * one free list per size class. Blocks bigger than the largest class are
+ * allocated on their own, but still tracked, so the whole allocator can be
+ * released at once
+ */
+typedef struct _Slab {
+	SlabHeader *slabs; /* List of slabs */
+	SlabHeader *big; /* List of blocks bigger than any size class */
+
+	char *cursor; /* Start of the unused part of the newest slab */
+	size_t remaining; /* Size of the unused part of the newest slab */
+
+	SlabBlock *free[SLAB_CLASSES]; /* Free lists, by size class */
+
+	size_t reserved; /* Bytes held from the system */
+	size_t live; /* Bytes in blocks currently handed out */
+} Slab;
+
+void slab_init(Slab *slab);
+void slab_free(Slab *slab);
+
+void *slab_alloc(Slab *slab, size_t size);
+void *slab_realloc(Slab *slab, void *ptr, size_t old_size, size_t new_size);
+void slab_release(Slab *slab, void *ptr, size_t size);
+
+size_t slab_get_slack(Slab *slab);
+
+#endif // !GUARD_EDIT_SLAB_H_
@@ -0,0 +1,72 @@
+#ifndef GUARD_EDIT_STATS_H_
+#define GUARD_EDIT_STATS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define STATS_WINDOW (1024) /* Number of frames the statistics cover */
+
+/* Phases of a frame, timed apart */
+typedef enum _StatsPhase {
+	STATS_INPUT, /* Reading keys that were waiting, and pastes */
+	STATS_APPLY, /* Applying keys to the file and the editor */
+	STATS_LAYOUT, /* Working out what changed on the screen */
+	STATS_RENDER, /* Sending it to the terminal */
+	STATS_FRAME, /* All of the above */
+	STATS_IDLE, /* Waiting for a key in the middle of a frame, not counted */
+	STATS_PHASES,
+} StatsPhase;
+
+/* A phase being timed */
+typedef struct _StatsTimer {
+	long long start; /* When it started */
+	long long accrued; /* Time the frame had accrued by then */
+} StatsTimer;
+
+/* Times of the last STATS_WINDOW frames, phase by phase
+ * Timers nest, and a phase only counts the time not taken by phases timed
+ * inside it
+ */
+typedef struct _Stats {
+	long long current[STATS_PHASES]; /* Time the frame spent in each phase */
+	long long accrued; /* Time spent in any phase this frame */
+	bool skip; /* Whether the frame is dropped rather than added when it ends */
+
+	long long window[STATS_FRAME + 1][STATS_WINDOW]; /* Times of past frames */
+	size_t head; /* Where the next frame goes */
+	size_t count; /* Number of frames in the window */
+	size_t frames; /* Number of frames ever timed */
+} Stats;
+
+/* Timing is left out unless EDIT_STATS is defined, so it costs nothing */
+#ifdef EDIT_STATS
+#define STATS_INIT(S) stats_init(S)
+#define STATS_START(S, T) StatsTimer T = stats_start(S)
+#define STATS_STOP(S, T, P) stats_stop((S), &(T), (P))
+#define STATS_END_FRAME(S) stats_end_frame(S)
+#define STATS_DROP_FRAME(S) stats_drop_frame(S)
+#define STATS_SKIP_FRAME(S) stats_skip_frame(S)
+#else
+#define STATS_INIT(S) ((void)0)
+#define STATS_START(S, T) ((void)0)
+#define STATS_STOP(S, T, P) ((void)0)
+#define STATS_END_FRAME(S) ((void)0)
+#define STATS_DROP_FRAME(S) ((void)0)
+#define STATS_SKIP_FRAME(S) ((void)0)
+#endif
+
+void stats_init(Stats *stats);
+
+StatsTimer stats_start(Stats *stats);
+void stats_stop(Stats *stats, StatsTimer *timer, StatsPhase phase);
+
+void stats_end_frame(Stats *stats);
+void stats_drop_frame(Stats *stats);
+void stats_skip_frame(Stats *stats);
+
+void stats_get_percentiles(
+	Stats *stats, StatsPhase phase, long long *p50, long long *p95,
+	long long *p99);
+const char *stats_get_phase_name(StatsPhase phase);
+
+#endif // !GUARD_EDIT_STATS_H_
@@ -0,0 +1,128 @@
+#ifndef GUARD_EDIT_TERM_H_
+#define GUARD_EDIT_TERM_H_
+
+#ifdef USE_PDCURSES
+#include <curses.h>
+#else
+#include <ncurses.h>
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "line.h"
+
+#define KEY_PASTE_BEGIN (KEY_MAX + 1) /* Key code of the start of a paste */
+#define KEY_PASTE_END (KEY_MAX + 2) /* Key code of the end of a paste */
+
+#define TERM_PRINTF_MAX (512) /* Longest text term_printf() writes at once */
+
+typedef struct _Term Term;
+
+/* What a terminal backend does
+ *
+ * Positions are in cells from the top left of the terminal, or of the popup
+ * for the popup_* operations. Only one popup is open at a time, and it is
+ * drawn over the rest of the terminal until it is closed
+ *
+ * Names ncurses takes for macros, like move and refresh, are avoided
+ */
+typedef struct _TermOps {
+	void (*free)(Term *term);
+
+	void (*move_to)(Term *term, size_t y, size_t x);
+	void (*put)(Term *term, const char *text, size_t length);
+	void (*clear_to_eol)(Term *term);
+	void (*scroll_rows)(Term *term, size_t top, size_t bottom, long by);
+
+	void (*popup_open)(Term *term, size_t y, size_t x, size_t h, size_t w);
+	void (*popup_put)(
+		Term *term, size_t y, size_t x, const char *text, size_t length);
+	void (*popup_clear_to_eol)(Term *term, size_t y, size_t x);
+	void (*popup_border)(Term *term);
+	void (*popup_close)(Term *term);
+
+	void (*show_cursor)(Term *term, bool visible);
+	void (*write_raw)(Term *term, const char *seq);
+	void (*flush)(Term *term);
+
+	int (*get_key)(Term *term, int timeout);
+	void (*read_paste)(Term *term, Line *text);
+	void (*push_keys)(Term *term, const char *text, size_t length);
+} TermOps;
+
+/* What was sent to a terminal, as counted by the memory backend */
+typedef struct _TermStats {
+	size_t cells; /* Cells written to */
+	size_t bytes; /* Bytes a real terminal would have been sent */
+	size_t frames; /* Number of refreshes */
+} TermStats;
+
+/* A terminal to draw to and read keys from
+ *
+ * Either the real one, through ncurses, or a grid of cells in memory that
+ * reads keys from a queue, so the editor can run without a terminal at all
+ */
+struct _Term {
+	const TermOps *ops;
+	size_t w, h; /* Size of the terminal */
+
+	TermStats stats;
+
+	union {
+		struct {
+			WINDOW *input; /* Pad keys are read from, as reading it draws nothing */
+			WINDOW *popup; /* Window of the open popup, if any */
+
+			char *pushed; /* Keys put back to be read first, last one first */
+			size_t pushed_length; /* Number of keys put back */
+			size_t pushed_capacity; /* Room for keys put back */
+		} curses;
+		struct {
+			char *cells; /* Text in each cell, row after row */
+			size_t y, x; /* Where the next text goes */
+			size_t cy, cx; /* Where the terminal's cursor would be */
+
+			char *popup; /* Text in each cell of the open popup, if any */
+			size_t py, px; /* Position of the popup */
+			size_t ph, pw; /* Size of the popup */
+
+			int *keys; /* Ring of keys waiting to be read */
+			size_t head; /* Index of the next key */
+			size_t length; /* Number of keys waiting */
+			size_t capacity; /* Size of the ring, a power of two */
+		} memory;
+	} as;
+};
+
+void term_init_curses(Term *term);
+void term_init_memory(Term *term, size_t w, size_t h);
+void term_free(Term *term);
+
+void term_use(Term *term);
+Term *term_get(void);
+
+void term_push_key(Term *term, int key);
+const char *term_get_row(Term *term, size_t y);
+
+void term_move(size_t y, size_t x);
+void term_put(const char *text, size_t length);
+void term_printf(const char *fmt, ...);
+void term_clear_to_eol(void);
+void term_scroll(size_t top, size_t bottom, long by);
+
+void term_popup_open(size_t y, size_t x, size_t h, size_t w);
+void term_popup_put(size_t y, size_t x, const char *text, size_t length);
+void term_popup_clear_to_eol(size_t y, size_t x);
+void term_popup_border(void);
+void term_popup_close(void);
+
+void term_show_cursor(bool visible);
+void term_write_raw(const char *seq);
+void term_refresh(void);
+
+int term_get_key(int timeout);
+void term_read_paste(Line *text);
+void term_push_keys(const char *text, size_t length);
+
+#endif // !GUARD_EDIT_TERM_H_
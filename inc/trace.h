@@ -0,0 +1,33 @@
+#ifndef GUARD_EDIT_TRACE_H_
+#define GUARD_EDIT_TRACE_H_
+
+#include <stdbool.h>
+
+#define TRACE_RING (8192) /* Events each thread can have waiting, a power of 2 */
+#define TRACE_FLUSH_MS (50) /* How often waiting events are written out */
+
+/* A span of time being traced, named by a string literal */
+typedef struct _TraceSpan {
+	const char *name;
+	long long start; /* When it started, or -1 if nothing is being traced */
+} TraceSpan;
+
+/* Spans are left out unless EDIT_TRACE is defined, so they cost nothing */
+#ifdef EDIT_TRACE
+#define TRACE_BEGIN(T, NAME) TraceSpan T = trace_begin(NAME)
+#define TRACE_END(T) trace_end(&(T), NULL, 0)
+#define TRACE_END_ARG(T, ARG, V) trace_end(&(T), (ARG), (V))
+#else
+#define TRACE_BEGIN(T, NAME) ((void)0)
+#define TRACE_END(T) ((void)0)
+#define TRACE_END_ARG(T, ARG, V) ((void)(V))
+#endif
+
+bool trace_start(const char *filename);
+bool trace_stop(void);
+bool trace_is_running(void);
+
+TraceSpan trace_begin(const char *name);
+void trace_end(TraceSpan *span, const char *arg, long long value);
+
+#endif // !GUARD_EDIT_TRACE_H_
@@ -0,0 +1,75 @@
+#ifndef GUARD_EDIT_UNDO_H_
+#define GUARD_EDIT_UNDO_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "cmd.h"
+
+#define UNDO_NONE ((size_t)-1) /* No node */
+#define UNDO_INITIAL_NODES (64)
+
+/* A state of the file, reached by applying a group of edits to its parent
+ *
+ * While the node is applied, @cmd takes the file back to the parent's state.
+ * Once undone, it holds the command that redoes it instead
+ */
+typedef struct _UndoNode {
+	Command cmd; /* Undoes or redoes the node */
+
+	size_t parent; /* State the node was made from */
+	size_t child; /* Child last made or visited, which redo goes to */
+	size_t first_child; /* Newest child */
+	size_t sibling; /* Next older child of the same parent */
+
+	size_t seq; /* Number of the state, in the order they were made */
+	size_t depth; /* Number of nodes above this one */
+	time_t time; /* When the state was made */
+} UndoNode;
+
+/* History of every state the file went through, kept as a tree
+ *
+ * Making an edit after undoing starts a new branch instead of throwing the
+ * undone edits away. The nodes live in a single array, link to each other by
+ * index, and reuse the slots of dropped nodes. Once the commands take up more
+ * than @budget bytes, the oldest states are dropped
+ */
+typedef struct _UndoTree {
+	UndoNode *nodes; /* Nodes, by index */
+	size_t length; /* Number of slots in use or freed */
+	size_t capacity; /* Number of slots */
+	size_t free; /* First freed slot, linked through @parent */
+
+	size_t root; /* Oldest state still known */
+	size_t current; /* State the file is in */
+	size_t seq; /* Number of the newest state */
+
+	size_t bytes; /* Memory taken up by the commands */
+	size_t budget; /* Most memory the commands may take up, or 0 for no limit */
+} UndoTree;
+
+void undo_init(UndoTree *tree);
+void undo_free(UndoTree *tree);
+
+void undo_set_budget(UndoTree *tree, size_t budget);
+
+void undo_add(UndoTree *tree, Command cmd);
+void undo_absorb(UndoTree *tree, CommandStack *stack, bool all);
+
+UndoNode *undo_back(UndoTree *tree);
+UndoNode *undo_forward(UndoTree *tree, size_t idx);
+void undo_store(UndoTree *tree, UndoNode *node, Command cmd);
+
+size_t undo_get_common(UndoTree *tree, size_t a, size_t b);
+size_t undo_get_path(UndoTree *tree, size_t from, size_t to, size_t *path);
+
+size_t undo_find_seq(UndoTree *tree, size_t seq);
+size_t undo_find_time(UndoTree *tree, time_t time);
+
+void undo_resume(UndoTree *tree, size_t current_seq, size_t seq);
+void undo_graft(UndoTree *tree, UndoNode *nodes, size_t count, size_t current);
+
+UndoNode *undo_get(UndoTree *tree, size_t idx);
+
+#endif // !GUARD_EDIT_UNDO_H_
@@ -3,39 +3,119 @@
  */
 
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "cmd.h"
 #include "line.h"
+#include "piece.h"
 
-static void _shift_down(CommandStack *cmds);
+static void _grow(CommandStack *cmds);
+static void _trim(CommandStack *cmds);
+static void _drop_oldest(CommandStack *cmds);
+
+static Command *_get(CommandStack *cmds, size_t i);
+static Command *_get_open(CommandStack *cmds, CommandType ch, CommandType str);
+static void _extend(
+	CommandStack *cmds, Command *cmd, CommandType type, char ch, bool front);
+
+static size_t _get_text_length(Command *cmd);
 
 /* Initializes the stack of commands */
 void cmd_init(CommandStack *cmds) {
-	memset(cmds->cmds, 0, sizeof(*cmds->cmds) * MAX_COMMANDS);
+	cmds->cmds = NULL;
+	cmds->head = 0;
 	cmds->length = 0;
+	cmds->capacity = 0;
+
+	cmds->bytes = 0;
+	cmds->budget = CMD_DEFAULT_BUDGET;
+
+	cmds->sealed = true;
+}
+
+/* Frees the stack and every command in it */
+void cmd_free(CommandStack *cmds) {
+	while( cmds->length > 0 ) {
+		_drop_oldest(cmds);
+	}
+
+	free(cmds->cmds);
+
+	const size_t budget = cmds->budget;
+	cmd_init(cmds);
+	cmds->budget = budget;
+}
+
+/* Sets how many bytes of commands the stack may hold, 0 meaning no limit
+ * The oldest commands are dropped right away if they no longer fit
+ */
+void cmd_set_budget(CommandStack *cmds, size_t budget) {
+	cmds->budget = budget;
+	_trim(cmds);
 }
 
 /* Pushes a command into the stack */
 void cmd_push(CommandStack *cmds, Command cmd) {
-	if( cmds->length == MAX_COMMANDS - 1 ) {
-		_shift_down(cmds);
+	if( cmds->length == cmds->capacity ) {
+		_grow(cmds);
 	}
 
-	cmds->cmds[cmds->length++] = cmd;
+	*_get(cmds, cmds->length++) = cmd;
+	cmds->bytes += cmd_get_size(&cmd);
+	cmds->sealed = false;
+
+	_trim(cmds);
 }
 
-/* Pops a command from the stack */
+/* Pops a command from the stack
+ * It stays valid until the next command is pushed
+ */
 Command *cmd_pop(CommandStack *cmds) {
 	if( cmds->length == 0 ) {
 		return NULL;
 	}
 
-	return &cmds->cmds[--cmds->length];
+	Command *cmd = _get(cmds, --cmds->length);
+	cmds->bytes -= cmd_get_size(cmd);
+	cmds->sealed = true;
+
+	return cmd;
+}
+
+/* Takes the oldest command out of the stack
+ * It stays valid until the next command is pushed
+ */
+Command *cmd_shift(CommandStack *cmds) {
+	if( cmds->length == 0 ) {
+		return NULL;
+	}
+
+	Command *cmd = _get(cmds, 0);
+	cmds->bytes -= cmd_get_size(cmd);
+
+	cmds->head = (cmds->head + 1) & (cmds->capacity - 1);
+	--cmds->length;
+
+	return cmd;
+}
+
+/* Closes the command on top, so the next one starts a new group */
+void cmd_seal(CommandStack *cmds) {
+	cmds->sealed = true;
 }
 
-/* Pushes a CMD_REP_CH command to the command stack */
+/* Pushes a CMD_REP_CH command to the command stack
+ * Replacing the character right after an open run of replacements extends it
+ */
 void cmd_rep_ch(CommandStack *cmds, size_t line, size_t idx, char ch) {
+	Command *top = _get_open(cmds, CMD_REP_CH, CMD_REP_STR);
+	if( top && top->line == line && idx == top->idx + _get_text_length(top) ) {
+		_extend(cmds, top, CMD_REP_STR, ch, false);
+		return;
+	}
+
 	Command cmd = {
 		.type = CMD_REP_CH,
 		.line = line,
@@ -46,8 +126,23 @@ void cmd_rep_ch(CommandStack *cmds, size_t line, size_t idx, char ch) {
 	cmd_push(cmds, cmd);
 }
 
-/* Pushes a CMD_ADD_CH command to the command stack */
+/* Pushes a CMD_ADD_CH command to the command stack
+ * Erasing the character right before an open run of erasures extends it, line
+ * breaks included
+ */
 void cmd_add_ch(CommandStack *cmds, size_t line, size_t idx, char ch) {
+	Command *top = _get_open(cmds, CMD_ADD_CH, CMD_ADD_STR);
+	const bool precedes = ch == '\n'
+		? top && line + 1 == top->line && top->idx == 0
+		: top && line == top->line && idx + 1 == top->idx;
+
+	if( precedes ) {
+		_extend(cmds, top, CMD_ADD_STR, ch, true);
+		top->line = line;
+		top->idx = idx;
+		return;
+	}
+
 	Command cmd = {
 		.type = CMD_ADD_CH,
 		.line = line,
@@ -58,8 +153,23 @@ void cmd_add_ch(CommandStack *cmds, size_t line, size_t idx, char ch) {
 	cmd_push(cmds, cmd);
 }
 
-/* Pushes a CMD_DEL_CH command into the command stack */
+/* Pushes a CMD_DEL_CH command into the command stack
+ * Typing right where an open run of typing ends extends it, line breaks
+ * included
+ */
 void cmd_del_ch(CommandStack *cmds, size_t line, size_t idx, char ch) {
+	Command *top = _get_open(cmds, CMD_DEL_CH, CMD_DEL_STR);
+	const bool follows = ch == '\n'
+		? top && line == top->line + 1 && idx == 0
+		: top && line == top->line && idx == top->idx + 1;
+
+	if( follows ) {
+		_extend(cmds, top, CMD_DEL_STR, ch, false);
+		top->line = line;
+		top->idx = idx;
+		return;
+	}
+
 	Command cmd = {
 		.type = CMD_DEL_CH,
 		.line = line,
@@ -82,25 +192,73 @@ void cmd_new_line(CommandStack *cmds, size_t line, size_t idx) {
 	cmd_push(cmds, cmd);
 }
 
-/* Pushes a CMD_ADD_LINE command to the command stack */
-void cmd_add_line(CommandStack *cmds, size_t line, size_t idx, Line l) {
+/* Pushes a CMD_ADD_LINE command to the command stack
+ * The command takes ownership of @pieces, cut out of @table from @line on,
+ * leaving an empty line behind if @placeholder is set
+ */
+void cmd_add_line(CommandStack *cmds, size_t line, PieceTable *table,
+	Piece *pieces, bool placeholder) {
 	Command cmd = {
 		.type = CMD_ADD_LINE,
 		.line = line,
-		.idx = idx,
-		.data.line = l,
+		.idx = 0,
+		.data.block = { table, pieces, placeholder },
 	};
 
 	cmd_push(cmds, cmd);
 }
 
-/* Pushes a CMD_DEL_LINE command into the command stack */
-void cmd_del_line(CommandStack *cmds, size_t line, size_t idx, Line l) {
+/* Pushes a CMD_DEL_LINE command into the command stack, cutting out @count
+ * lines from @line on
+ */
+void cmd_del_line(CommandStack *cmds, size_t line, size_t count) {
 	Command cmd = {
 		.type = CMD_DEL_LINE,
 		.line = line,
+		.idx = 0,
+		.length = count,
+	};
+
+	cmd_push(cmds, cmd);
+}
+
+/* Pushes a CMD_REP_STR command to the command stack
+ * The command takes ownership of @text
+ */
+void cmd_rep_str(CommandStack *cmds, size_t line, size_t idx, Line text) {
+	Command cmd = {
+		.type = CMD_REP_STR,
+		.line = line,
 		.idx = idx,
-		.data.line = l,
+		.data.line = text,
+	};
+
+	cmd_push(cmds, cmd);
+}
+
+/* Pushes a CMD_ADD_STR command to the command stack
+ * The command takes ownership of @text
+ */
+void cmd_add_str(CommandStack *cmds, size_t line, size_t idx, Line text) {
+	Command cmd = {
+		.type = CMD_ADD_STR,
+		.line = line,
+		.idx = idx,
+		.data.line = text,
+	};
+
+	cmd_push(cmds, cmd);
+}
+
+/* Pushes a CMD_DEL_STR command into the command stack
+ * The command takes ownership of @text, which ends at (@line, @idx)
+ */
+void cmd_del_str(CommandStack *cmds, size_t line, size_t idx, Line text) {
+	Command cmd = {
+		.type = CMD_DEL_STR,
+		.line = line,
+		.idx = idx,
+		.data.line = text,
 	};
 
 	cmd_push(cmds, cmd);
@@ -108,17 +266,123 @@ void cmd_del_line(CommandStack *cmds, size_t line, size_t idx, Line l) {
 
 /* Frees a command from memory */
 void cmd_free_cmd(Command *cmd) {
-	if( cmd->type == CMD_ADD_LINE || cmd->type == CMD_DEL_LINE ) {
+	if( cmd_has_text(cmd) ) {
 		line_free(&cmd->data.line);
+	} else if( cmd->type == CMD_ADD_LINE ) {
+		piece_free_lines(cmd->data.block.table, cmd->data.block.pieces);
 	}
 }
 
-/* Shifts a command stack down, overwriting the first command */
-static void _shift_down(CommandStack *cmds) {
-	cmd_free_cmd(&cmds->cmds[0]);
-	for( size_t i = 1; i < cmds->length; ++i ) {
-		cmds->cmds[i - 1] = cmds->cmds[i];
+/* Returns if a command keeps text in @data.line */
+bool cmd_has_text(Command *cmd) {
+	switch( cmd->type ) {
+	case CMD_REP_STR:
+	case CMD_ADD_STR:
+	case CMD_DEL_STR:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Returns how much memory a command takes up, along with its text
+ * A block of lines is counted by the lines it holds on to, not their text
+ */
+size_t cmd_get_size(Command *cmd) {
+	size_t size = sizeof(*cmd);
+	if( cmd_has_text(cmd) ) {
+		size += cmd->data.line.length;
+	} else if( cmd->type == CMD_ADD_LINE && cmd->data.block.pieces ) {
+		size += cmd->data.block.pieces->lines * sizeof(Line);
+	}
+
+	return size;
+}
+
+/* Doubles the size of the ring, unwrapping it so the oldest command is first */
+static void _grow(CommandStack *cmds) {
+	const size_t capacity
+		= cmds->capacity ? cmds->capacity * 2 : CMD_INITIAL_CAPACITY;
+
+	Command *new_cmds = malloc(sizeof(*new_cmds) * capacity);
+	if( !new_cmds ) {
+		fprintf(stderr, "Failed to allocate %zu commands!\n", capacity);
+		exit(1);
+	}
+
+	/* The commands may wrap around the end of the old ring */
+	const size_t first = cmds->length ? cmds->capacity - cmds->head : 0;
+	const size_t count = first < cmds->length ? first : cmds->length;
+	if( count > 0 ) {
+		memcpy(new_cmds, cmds->cmds + cmds->head, sizeof(*new_cmds) * count);
+		memcpy(new_cmds + count, cmds->cmds,
+			sizeof(*new_cmds) * (cmds->length - count));
 	}
 
+	free(cmds->cmds);
+
+	cmds->cmds = new_cmds;
+	cmds->head = 0;
+	cmds->capacity = capacity;
+}
+
+/* Drops the oldest commands until the stack fits in its budget
+ * The newest command is always kept
+ */
+static void _trim(CommandStack *cmds) {
+	while( cmds->budget && cmds->bytes > cmds->budget && cmds->length > 1 ) {
+		_drop_oldest(cmds);
+	}
+}
+
+/* Frees the oldest command, and drops it from the stack */
+static void _drop_oldest(CommandStack *cmds) {
+	Command *cmd = _get(cmds, 0);
+	cmds->bytes -= cmd_get_size(cmd);
+	cmd_free_cmd(cmd);
+
+	cmds->head = (cmds->head + 1) & (cmds->capacity - 1);
 	--cmds->length;
 }
+
+/* Returns the @i-th oldest command */
+static Command *_get(CommandStack *cmds, size_t i) {
+	return &cmds->cmds[(cmds->head + i) & (cmds->capacity - 1)];
+}
+
+/* Returns the command on top if it is of type @ch or @str, and still open */
+static Command *_get_open(CommandStack *cmds, CommandType ch, CommandType str) {
+	if( cmds->sealed || cmds->length == 0 ) {
+		return NULL;
+	}
+
+	Command *top = _get(cmds, cmds->length - 1);
+	return (top->type == ch || top->type == str) ? top : NULL;
+}
+
+/* Adds @ch to the text of @cmd, at the @front or the back
+ * A single character command is turned into a string command of @type first
+ */
+static void _extend(
+	CommandStack *cmds, Command *cmd, CommandType type, char ch, bool front) {
+	cmds->bytes -= cmd_get_size(cmd);
+
+	if( cmd->type != type ) {
+		const char first = cmd->data.ch;
+
+		cmd->type = type;
+		line_init(&cmd->data.line);
+		line_insert_char(&cmd->data.line, 0, first);
+	}
+
+	Line *text = &cmd->data.line;
+	line_insert_char(text, front ? 0 : text->length, ch);
+
+	cmds->bytes += cmd_get_size(cmd);
+	_trim(cmds);
+}
+
+/* Returns how many characters a character or string command covers */
+static size_t _get_text_length(Command *cmd) {
+	return cmd_has_text(cmd) ? cmd->data.line.length : 1;
+}
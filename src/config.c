@@ -14,6 +14,7 @@
 #define FNV_OFFSET_BASIS (0x811c9dc5)
 
 static ConfigOption *_init_option(char *key, uint32_t hash, char *value);
+static void _set_value(ConfigOption *opt, char *value);
 static void _free_option(ConfigOption *opt);
 static void _free_option_recursively(ConfigOption *opt);
 
@@ -63,7 +64,7 @@ bool config_set(Config *config, char *key, char *value) {
 	while( true ) {
 		/* If there's a match, update its value */
 		if( _check_match(opt, key, hash) ) {
-			opt->value = value;
+			_set_value(opt, value);
 			return false;
 		}
 
@@ -80,7 +81,7 @@ bool config_set(Config *config, char *key, char *value) {
 
 /* Alias for @config_set with "true" as the value */
 bool config_set_true(Config *config, char *key) {
-	return config_set(config, key, CONFIG_FALSE);
+	return config_set(config, key, CONFIG_TRUE);
 }
 
 /* Alias for @config_set with "false" as the value */
@@ -212,16 +213,26 @@ static ConfigOption *_init_option(char *key, uint32_t hash, char *value) {
 	memcpy(opt->key, key, sz);
 	opt->key[sz] = '\0';
 
-	sz = strlen(value);
-	opt->value = malloc(sz + 1);
-	memcpy(opt->value, value, sz);
-	opt->value[sz] = '\0';
+	opt->value = NULL;
+	_set_value(opt, value);
 
 	opt->hash = hash;
+	opt->next = NULL;
 
 	return opt;
 }
 
+/* Replaces the value of a config option with a copy of @value */
+static void _set_value(ConfigOption *opt, char *value) {
+	size_t sz = strlen(value);
+	char *copy = malloc(sz + 1);
+	memcpy(copy, value, sz);
+	copy[sz] = '\0';
+
+	free(opt->value);
+	opt->value = copy;
+}
+
 /* Frees a config option from memory */
 static void _free_option(ConfigOption *opt) {
 	free(opt->key);
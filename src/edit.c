@@ -2,12 +2,14 @@
  * The "edit" editor
  */
 
+#include <errno.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #ifdef USE_PDCURSES
 #include <curses.h>
@@ -19,9 +21,14 @@
 
 #include "file.h"
 #include "line.h"
+#include "slab.h"
 #include "cmd.h"
+#include "screen.h"
+#include "term.h"
 #include "prompt.h"
 #include "config.h"
+#include "stats.h"
+#include "trace.h"
 
 #include "edit.h"
 
@@ -32,7 +39,16 @@
 #define SET_CURSOR_BLINK_BAR "\x1b[5 q"
 #define SET_CURSOR_STEADY_BAR "\x1b[6 q"
 
-static void _write_raw(const char *str);
+#define SAVE_POLL_MS (100) /* How often to check on a save in progress */
+#define TRACE_FILE "edit-trace.json" /* Where :trace start writes by default */
+
+static void _handle_key(Edit *edit, int ch);
+static void _handle_paste(Edit *edit);
+static void _paste_text(Edit *edit, Line *text);
+static int _get_pending(Edit *edit);
+static int _get_key(Edit *edit);
+static void _render_frame(Edit *edit);
+static long long _now(void);
 
 static void _insert_char_pair(Edit *edit, CommandStack *stack, char l, char r);
 
@@ -46,6 +62,7 @@ static void _do_cmd_l(Edit *edit);
 
 static void _do_cmd_g(Edit *edit);
 static void _do_cmd_G(Edit *edit);
+static void _do_cmd_d(Edit *edit);
 
 static void _exit_command_typing(Edit *edit);
 static void _render_command(Edit *edit);
@@ -53,6 +70,7 @@ static void _clear_command(Edit *edit);
 
 static void _handle_command(Edit *edit);
 static void _handle_shell_command(Edit *edit, const char *cmd);
+static void _show_stats(Edit *edit);
 
 static void _handle_complex_command(Edit *edit, const char *cmd);
 static char *_match_command(const char *cmd, const char *match, int len);
@@ -60,20 +78,50 @@ static char *_match_command(const char *cmd, const char *match, int len);
 static void _update_gutter(Edit *edit);
 static void _update_cursor_x(Edit *edit);
 
+static void _damage_lines(Edit *edit, size_t from, size_t to);
+static void _damage_below(Edit *edit, size_t from);
+static void _scroll_to(Edit *edit, size_t vy);
+
 static void _move_to_start_of_line(Edit *edit);
 static void _move_to_end_of_line(Edit *edit);
 static void _move_to_idx(Edit *edit, size_t idx);
 
 static void _move_to_start_of_file(Edit *edit);
 static void _move_to_end_of_file(Edit *edit);
+static bool _step_up(Edit *edit);
 
 static void _newline(Edit *edit);
 
+static void _rep_str(Edit *edit, CommandStack *stack, Command *cmd);
+static void _add_str(Edit *edit, CommandStack *stack, Command *cmd);
+static void _del_str(Edit *edit, CommandStack *stack, Command *cmd);
+static void _add_lines(Edit *edit, CommandStack *stack, Command *cmd);
+static void _move_cursor(Edit *edit, size_t line, size_t idx);
+
+static void _run_cmd(Edit *edit, CommandStack *stack, Command *cmd);
+static void _apply_node(Edit *edit, UndoNode *node);
+static void _goto_state(Edit *edit, size_t target);
+static bool _parse_travel(Edit *edit, const char *args, long sign);
+
+static void _settle_history(Edit *edit);
+static void _open_history(Edit *edit);
+static void _store_history(Edit *edit, SaveState state);
+
+static void _update_undo_budget(Edit *edit);
+static void _update_frame_budget(Edit *edit);
+
+static int _get_timeout(Edit *edit);
+static void _offer_recovery(Edit *edit);
+
 static bool _ask_to_save(Edit *edit);
+static bool _wait_for_save(Edit *edit);
+static void _poll_save(Edit *edit);
+static void _report_save(
+	Edit *edit, SaveState state, size_t written, size_t total);
 
 static char *_get_mode_string(Edit *edit);
 
-/* Initializes the editor */
+/* Initializes the editor, on the terminal in use */
 void edit_init(Edit *edit, const char *filename) {
 	edit->line = 0;
 	edit->idx = 0;
@@ -84,15 +132,23 @@ void edit_init(Edit *edit, const char *filename) {
 	edit->vx = 0;
 	edit->vy = 0;
 
-	getmaxyx(stdscr, edit->h, edit->w);
+	edit->w = term_get()->w;
+	edit->h = term_get()->h;
+
+	screen_init(&edit->screen);
+	screen_resize(&edit->screen, edit->w, edit_get_ui_offset(edit));
+	edit->gutter = 0;
 
 	memset(edit->msg, 0, STATUS_MSG_LEN);
 	edit->msg_len = 0;
 
 	edit->running = true;
+	edit->batching = false;
+	STATS_INIT(&edit->stats);
 
 	config_init(&edit->config);
 	edit_set_config_true(edit, "syn");
+	_update_frame_budget(edit);
 
 	edit_change_to_normal(edit);
 
@@ -105,18 +161,34 @@ void edit_init(Edit *edit, const char *filename) {
 	edit->vis_length = 0;
 
 	cmd_init(&edit->undo);
-	cmd_init(&edit->redo);
+	cmd_init(&edit->inverse);
+	undo_init(&edit->history);
+	sidecar_init(&edit->sidecar);
+
+	file_init(&edit->file, filename, &edit->config);
+	_offer_recovery(edit);
+	_open_history(edit);
 
-	file_init(&edit->file, filename);
 	_update_gutter(edit);
 	_update_cursor_x(edit);
 
 	edit_render(edit);
 	edit_render_status(edit);
+	term_refresh();
+
+	/* The first frame is timed from the first key, whatever was asked */
+	STATS_DROP_FRAME(&edit->stats);
 }
 
 /* Frees the editor from memory */
 void edit_free(Edit *edit) {
+	/* Lines cut out into the history still belong to the file's table */
+	cmd_free(&edit->undo);
+	cmd_free(&edit->inverse);
+	undo_free(&edit->history);
+	sidecar_free(&edit->sidecar);
+	screen_free(&edit->screen);
+
 	file_free(&edit->file);
 }
 
@@ -128,18 +200,31 @@ void edit_reload(Edit *edit) {
 
 /* Loads the given file */
 void edit_load(Edit *edit, const char *filename) {
+	if( !_wait_for_save(edit) ) {
+		return;
+	}
+
 	if( file_is_dirty(&edit->file) && !_ask_to_save(edit) ) {
 		return;
 	}
 
+	/* The history of the old file doesn't apply to this one, and has to go
+	 * before it does */
+	cmd_free(&edit->undo);
+	undo_free(&edit->history);
+	undo_init(&edit->history);
+	sidecar_free(&edit->sidecar);
+
 	file_free(&edit->file);
-	file_init(&edit->file, filename);
+	file_init(&edit->file, filename, &edit->config);
+	_update_undo_budget(edit);
 
 	char *name = file_get_display_name(&edit->file);
-	edit_set_status(edit, "loaded file '%s'", name);
-
-	edit_render(edit);
-	edit_render_status(edit);
+	edit_set_status(edit, "loaded file '%s'%s%s", name,
+		edit->file.table.crlf ? " [crlf]" : "",
+		edit->file.table.nul ? " [has NUL bytes]" : "");
+	_offer_recovery(edit);
+	_open_history(edit);
 
 	edit->vx = 0;
 	edit->vy = 0;
@@ -150,6 +235,11 @@ void edit_load(Edit *edit, const char *filename) {
 	edit->idx = 0;
 	edit->x = 0;
 	_update_cursor_x(edit);
+
+	/* Rows showing the same text as before are still left alone */
+	_damage_below(edit, 0);
+	edit_render(edit);
+	edit_render_status(edit);
 }
 
 /* Saves the current file */
@@ -159,47 +249,74 @@ void edit_save(Edit *edit) {
 
 /* Saves the current file with the name @as */
 void edit_save_as(Edit *edit, const char *as) {
-	file_save(&edit->file, as);
+	_settle_history(edit);
 
-	char *name = file_get_display_name(&edit->file);
-	edit_set_status(edit, "saved file as '%s'", name);
+	/* An unnamed file is named through a prompt */
+	if( !as && edit->file.unnamed ) {
+		STATS_SKIP_FRAME(&edit->stats);
+	}
+
+	if( file_save(&edit->file, as) ) {
+		sidecar_snapshot(&edit->sidecar, &edit->history);
+		_poll_save(edit);
+	} else {
+		_report_save(edit, SAVE_FAILED, 0, 0);
+	}
 }
 
-/* Updates the editor */
+/* Updates the editor
+ *
+ * Every key already waiting is applied before anything is drawn, so a burst
+ * of input costs a single frame. A frame stops taking keys once it has run
+ * for its budget, so the screen still keeps up with a long burst
+ */
 void edit_update(Edit *edit) {
-	int ch = getch();
-	if( ch == KEY_RESIZE || ch == ERR ) {
-		edit_refresh(edit);
+	/* Wake up now and then to show how a save is going, or to write the
+	 * journal */
+	int ch = term_get_key(_get_timeout(edit));
+
+	_poll_save(edit);
+	file_tick_journal(&edit->file);
+
+	/* Interrupted by a signal, so don't leave any edits unjournaled */
+	if( !edit->running ) {
+		file_flush_journal(&edit->file);
 		return;
 	}
 
-	switch( edit->mode ) {
-	case EDIT_MODE_NORMAL:
-		edit_mode_normal(edit, ch);
-		break;
-	case EDIT_MODE_INSERT:
-		edit_mode_insert(edit, ch);
-		break;
-	case EDIT_MODE_REPLACE:
-		edit_mode_replace(edit, ch);
-		break;
-	case EDIT_MODE_VISUAL:
-		edit_mode_visual(edit, ch);
-		break;
-	case EDIT_MODE_COMMAND:
-		edit_mode_command(edit, ch);
+	if( ch == ERR ) {
+		_render_frame(edit);
+		STATS_DROP_FRAME(&edit->stats);
+		return;
 	}
 
-	edit_render_status(edit);
+	const long long start = _now();
+	size_t keys = 0;
+
+	TRACE_BEGIN(span, "keys");
+	edit->batching = true;
+	do {
+		STATS_START(&edit->stats, apply);
+		_handle_key(edit, ch);
+		STATS_STOP(&edit->stats, apply, STATS_APPLY);
+		++keys;
+	} while( edit->running && _now() - start < edit->frame_budget
+		&& (ch = _get_pending(edit)) != ERR );
+	edit->batching = false;
+	TRACE_END_ARG(span, "keys", keys);
+
+	/* Quitting frees everything there was to draw */
+	if( edit->running ) {
+		_render_frame(edit);
+		STATS_END_FRAME(&edit->stats);
+	}
 }
 
 /* Refreshes the window after a resize */
 void edit_refresh(Edit *edit) {
-	endwin();
-	refresh();
-
-	edit->w = COLS;
-	edit->h = LINES;
+	edit->w = term_get()->w;
+	edit->h = term_get()->h;
+	screen_resize(&edit->screen, edit->w, edit_get_ui_offset(edit));
 
 	_update_gutter(edit);
 	_update_cursor_x(edit);
@@ -207,34 +324,39 @@ void edit_refresh(Edit *edit) {
 	edit_render(edit);
 	edit_render_status(edit);
 
-	refresh();
+	term_refresh();
 }
 
 /* Change to NORMAL mode */
 void edit_change_to_normal(Edit *edit) {
-	_write_raw(SET_CURSOR_STEADY_BLOCK);
+	term_write_raw(SET_CURSOR_STEADY_BLOCK);
+	cmd_seal(&edit->undo);
 	edit->mode = EDIT_MODE_NORMAL;
 }
 
 /* Change to INSERT mode */
 void edit_change_to_insert(Edit *edit) {
-	_write_raw(SET_CURSOR_STEADY_BAR);
+	term_write_raw(SET_CURSOR_STEADY_BAR);
+	cmd_seal(&edit->undo);
 	edit->mode = EDIT_MODE_INSERT;
 }
 
 /* Change to REPLACE mode */
 void edit_change_to_replace(Edit *edit) {
-	_write_raw(SET_CURSOR_STEADY_UNDERLINE);
+	term_write_raw(SET_CURSOR_STEADY_UNDERLINE);
+	cmd_seal(&edit->undo);
 	edit->mode = EDIT_MODE_REPLACE;
 }
 
 /* Change to VISUAL mode */
 void edit_change_to_visual(Edit *edit) {
+	cmd_seal(&edit->undo);
 	edit->mode = EDIT_MODE_VISUAL;
 }
 
 /* Change to COMMAND mode */
 void edit_change_to_command(Edit *edit) {
+	cmd_seal(&edit->undo);
 	edit->mode = EDIT_MODE_COMMAND;
 	_render_command(edit);
 }
@@ -272,6 +394,9 @@ void edit_mode_normal(Edit *edit, int ch) {
 	case 'G': /* Handle the 'G' command */
 		_do_cmd_G(edit);
 		break;
+	case 'd': /* Handle the 'd' command */
+		_do_cmd_d(edit);
+		break;
 	case 'o': /* Enter INSERT mode on a new line */
 		_move_to_end_of_line(edit);
 		edit_insert_char(edit, &edit->undo, '\n');
@@ -501,57 +626,87 @@ void edit_new_line(Edit *edit, CommandStack *stack) {
 	cmd_new_line(stack, edit->line, edit->idx);
 }
 
+/* Creates a CMD_ADD_LINE command */
+void edit_add_line(
+	Edit *edit, CommandStack *stack, Piece *pieces, bool placeholder) {
+	cmd_add_line(stack, edit->line, &edit->file.table, pieces, placeholder);
+}
+
+/* Creates a CMD_DEL_LINE command */
+void edit_del_line(Edit *edit, CommandStack *stack, size_t count) {
+	cmd_del_line(stack, edit->line, count);
+}
+
 /* Undoes the previous action */
 void edit_undo(Edit *edit) {
-	Command *cmd = cmd_pop(&edit->undo);
-	if( cmd == NULL ) {
+	_settle_history(edit);
+
+	UndoNode *node = undo_back(&edit->history);
+	if( node == NULL ) {
 		edit_set_status(edit, "nothing to undo!");
 		return;
 	}
 
-	edit_perform_cmd(edit, &edit->redo, cmd);
+	_apply_node(edit, node);
+	edit_render(edit);
 }
 
 /* Redoes the previous action */
 void edit_redo(Edit *edit) {
-	Command *cmd = cmd_pop(&edit->redo);
-	if( cmd == NULL ) {
+	_settle_history(edit);
+
+	UndoNode *node = undo_forward(&edit->history, UNDO_NONE);
+	if( node == NULL ) {
 		edit_set_status(edit, "nothing to redo!");
 		return;
 	}
 
-	edit_perform_cmd(edit, &edit->undo, cmd);
+	_apply_node(edit, node);
+	edit_render(edit);
 }
 
-/* Runs an edit command */
-void edit_perform_cmd(Edit *edit, CommandStack *stack, Command *cmd) {
-	edit->idx = cmd->idx;
-	_update_cursor_x(edit);
+/* Goes @steps states forward or back in the order they were made, across
+ * branches of the history
+ */
+void edit_travel(Edit *edit, long steps) {
+	_settle_history(edit);
+
+	const size_t seq = undo_get(&edit->history, edit->history.current)->seq;
+	size_t target;
+	if( steps < 0 ) {
+		const size_t back = (size_t)-steps;
+		target = back > seq ? 0 : seq - back;
+	} else {
+		target = MIN(seq + (size_t)steps, edit->history.seq);
+	}
 
-	edit_goto(edit, cmd->line);
+	_goto_state(edit, undo_find_seq(&edit->history, target));
+}
 
-	switch( cmd->type ) {
-	case CMD_REP_CH:
-		edit_replace_char(edit, stack, cmd->data.ch);
-		break;
-	case CMD_ADD_CH:
-		edit_insert_char(edit, stack, cmd->data.ch);
-		break;
-	case CMD_DEL_CH:
-		edit_delete_char(edit, stack);
-		break;
-	case CMD_NEW_LINE:
-		edit_insert_char(edit, stack, '\n');
-		break;
-	default:
-		edit_set_status(edit, "not yet implemented!");
-	}
+/* Goes to the state numbered @seq */
+void edit_travel_to(Edit *edit, size_t seq) {
+	_settle_history(edit);
+	_goto_state(edit, undo_find_seq(&edit->history, seq));
+}
+
+/* Goes to the state the file was in @seconds away from the current one */
+void edit_travel_time(Edit *edit, long seconds) {
+	_settle_history(edit);
 
+	const time_t now = undo_get(&edit->history, edit->history.current)->time;
+	_goto_state(edit, undo_find_time(&edit->history, now + seconds));
+}
+
+/* Runs an edit command */
+void edit_perform_cmd(Edit *edit, CommandStack *stack, Command *cmd) {
+	_run_cmd(edit, stack, cmd);
 	edit_render(edit);
 }
 
 /* Jumps to a line */
 void edit_goto(Edit *edit, size_t idx) {
+	cmd_seal(&edit->undo);
+
 	if( idx >= edit->file.length ) {
 		idx = edit->file.length - 1;
 	}
@@ -566,7 +721,7 @@ void edit_goto(Edit *edit, size_t idx) {
 	if( idx < offset ) {
 		if( edit->vy > idx ) {
 			edit->y = 0;
-			edit->vy = idx;
+			_scroll_to(edit, idx);
 			edit_render(edit);
 		} else {
 			edit->y = idx;
@@ -574,8 +729,8 @@ void edit_goto(Edit *edit, size_t idx) {
 	} else {
 		size_t ui_offset = edit_get_ui_offset(edit);
 		if( idx - edit->vy >= ui_offset ) {
-			edit->vy = idx - ui_offset + 1;
 			edit->y = ui_offset - 1;
+			_scroll_to(edit, idx - ui_offset + 1);
 			edit_render(edit);
 		} else {
 			edit->y = idx;
@@ -623,12 +778,17 @@ void edit_delete_char(Edit *edit, CommandStack *stack) {
 	 * lines below one row up
 	 */
 	if( edit->idx == 0 ) {
+		if( edit->line == 0 ) {
+			return;
+		}
+
 		edit->idx = file_move_line_up(&edit->file, edit->line);
 		_update_gutter(edit);
-		edit_move_up(edit);
+		_step_up(edit);
+		_damage_below(edit, edit->line);
 		edit_render(edit);
 
-		edit_new_line(edit, stack);
+		edit_add_ch(edit, stack, '\n');
 	} else {
 		char prev = file_delete_char(&edit->file, edit->line, edit->idx);
 
@@ -644,31 +804,36 @@ void edit_delete_char(Edit *edit, CommandStack *stack) {
 	edit->last_ins_idx = edit->idx;
 }
 
-/* If possible, moves the cursor up one row */
-bool edit_move_up(Edit *edit) {
-	if( edit->line <= 0 ) {
-		edit->line = 0;
-		return false;
+/* Deletes @count lines from the current one on
+ * The lines aren't copied, but handed over to the command undoing it
+ */
+void edit_delete_lines(Edit *edit, CommandStack *stack, size_t count) {
+	count = MIN(count, edit->file.length - edit->line);
+	if( count == 0 ) {
+		return;
 	}
 
-	--edit->line;
-	if( edit->y == 0 ) {
-		if( edit->vy > 0 ) {
-			--edit->vy;
-			edit_render(edit);
-		}
-	} else {
-		--edit->y;
-	}
+	const bool placeholder = count == edit->file.length;
+	Piece *pieces = file_cut_lines(&edit->file, edit->line, count);
+	_update_gutter(edit);
+	_damage_below(edit, edit->line);
 
-	_update_cursor_x(edit);
-	refresh();
+	edit_add_line(edit, stack, pieces, placeholder);
 
-	return true;
+	_move_cursor(edit, MIN(edit->line, edit->file.length - 1), 0);
+	edit_render(edit);
+}
+
+/* If possible, moves the cursor up one row */
+bool edit_move_up(Edit *edit) {
+	cmd_seal(&edit->undo);
+	return _step_up(edit);
 }
 
 /* If possible, moves the cursor down one row */
 bool edit_move_down(Edit *edit) {
+	cmd_seal(&edit->undo);
+
 	const size_t lines = edit->file.length;
 	if( edit->line >= lines - 1 ) {
 		edit->line = lines - 1;
@@ -679,19 +844,20 @@ bool edit_move_down(Edit *edit) {
 
 	size_t ui_offset = edit_get_ui_offset(edit);
 	if( ++edit->y >= ui_offset ) {
-		++edit->vy;
 		edit->y = ui_offset - 1;
+		_scroll_to(edit, edit->vy + 1);
 		edit_render(edit);
 	}
 
 	_update_cursor_x(edit);
-	refresh();
 
 	return true;
 }
 
 /* If possible, moves the cursor left one column */
 bool edit_move_left(Edit *edit) {
+	cmd_seal(&edit->undo);
+
 	if( edit->idx <= 0 ) {
 		edit->idx = 0;
 		return false;
@@ -700,13 +866,13 @@ bool edit_move_left(Edit *edit) {
 	--edit->idx;
 	_update_cursor_x(edit);
 
-	refresh();
-
 	return true;
 }
 
 /* If possible, moves the cursor right one column */
 bool edit_move_right(Edit *edit) {
+	cmd_seal(&edit->undo);
+
 	if( edit->x >= edit->w - 1 ) {
 		edit->x = edit->w - 1;
 		return false;
@@ -715,8 +881,6 @@ bool edit_move_right(Edit *edit) {
 	++edit->idx;
 	_update_cursor_x(edit);
 
-	refresh();
-
 	return true;
 }
 
@@ -743,36 +907,44 @@ void edit_set_status(Edit *edit, const char *fmt, ...) {
 void edit_render_status(Edit *edit) {
 	const size_t bottom = edit->h - 1;
 
-	move(bottom, 0);
-	clrtoeol();
+	term_move(bottom, 0);
+	term_clear_to_eol();
 
-	printw("%s > ", _get_mode_string(edit));
-	printw("%zu %zu > ", edit->idx + 1, edit->line + 1);
+	term_printf("%s > ", _get_mode_string(edit));
+	term_printf("%zu %zu > ", edit->idx + 1, edit->line + 1);
 
 	const char *name = file_get_display_name(&edit->file);
 	const char asterisk = file_is_dirty(&edit->file) ? '*' : ' ';
-	printw("%s %c", name, asterisk);
+	term_printf("%s %c", name, asterisk);
 
 	if( edit->msg_len ) {
-		move(bottom, edit->w - STATUS_MSG_LEN);
+		term_move(bottom, edit->w - STATUS_MSG_LEN);
 		if( edit->msg_len == STATUS_MSG_LEN ) {
-			printw("%.*s...", edit->msg_len - 3, edit->msg);
+			term_printf("%.*s...", edit->msg_len - 3, edit->msg);
 		} else {
-			printw("%*s", edit->msg_len, edit->msg);
+			term_printf("%*s", edit->msg_len, edit->msg);
 		}
 	}
 
-	move(edit->y, edit->x);
-	refresh();
+	term_move(edit->y, edit->x);
 }
 
-/* Renders the current file */
+/* Renders the rows of the current file that may have changed
+ * While keys are being applied, the rows are left for the end of the frame
+ */
 void edit_render(Edit *edit) {
-	erase();
+	if( edit->batching ) {
+		return;
+	}
+
+	TRACE_BEGIN(span, "render");
+
 	_update_gutter(edit);
-	file_render(&edit->file, edit->vy, edit->gutter);
+	file_render(&edit->file, &edit->screen, edit->vy, edit->gutter);
 
-	move(edit->y, edit->x);
+	term_move(edit->y, edit->x);
+
+	TRACE_END(span);
 }
 
 /* Renders the current line */
@@ -782,13 +954,19 @@ void edit_render_current_line(Edit *edit) {
 
 /* Renders a line in the file */
 void edit_render_line(Edit *edit, size_t idx) {
-	_update_gutter(edit);
-	file_render_line(&edit->file, idx, edit->vy, edit->gutter);
+	_damage_lines(edit, idx, idx + 1);
+	edit_render(edit);
 }
 
 /* Sets a config option */
 void edit_set_config(Edit *edit, char *key, char *value) {
 	config_set(&edit->config, key, value);
+
+	if( strcmp(key, "undo_budget") == 0 ) {
+		_update_undo_budget(edit);
+	} else if( strcmp(key, "frame_budget") == 0 ) {
+		_update_frame_budget(edit);
+	}
 }
 
 /* Sets a config option to true */
@@ -808,6 +986,10 @@ char *edit_get_config(Edit *edit, char *key) {
 
 /* Quits the editor */
 void edit_quit(Edit *edit) {
+	if( !_wait_for_save(edit) ) {
+		return;
+	}
+
 	if( file_is_dirty(&edit->file) && !_ask_to_save(edit) ) {
 		return;
 	}
@@ -841,10 +1023,162 @@ size_t edit_get_ui_offset(Edit *edit) {
 	return edit->h - 3;
 }
 
-/* Writes a raw string to standard output */
-static void _write_raw(const char *str) {
-	fputs(str, stdout);
-	fflush(stdout);
+/* Applies a single key */
+static void _handle_key(Edit *edit, int ch) {
+	if( ch == KEY_RESIZE ) {
+		edit_refresh(edit);
+		return;
+	}
+
+	if( ch == KEY_PASTE_BEGIN ) {
+		_handle_paste(edit);
+		undo_absorb(&edit->history, &edit->undo, false);
+		return;
+	}
+
+	switch( edit->mode ) {
+	case EDIT_MODE_NORMAL:
+		edit_mode_normal(edit, ch);
+		break;
+	case EDIT_MODE_INSERT:
+		edit_mode_insert(edit, ch);
+		break;
+	case EDIT_MODE_REPLACE:
+		edit_mode_replace(edit, ch);
+		break;
+	case EDIT_MODE_VISUAL:
+		edit_mode_visual(edit, ch);
+		break;
+	case EDIT_MODE_COMMAND:
+		edit_mode_command(edit, ch);
+	}
+
+	/* Hand finished groups of edits over to the history */
+	undo_absorb(&edit->history, &edit->undo, false);
+}
+
+/* Reads a paste up to its end marker
+ *
+ * In INSERT mode it goes in as a whole, without pairing brackets, as a single
+ * undoable edit. The command line takes its printable characters, and any
+ * other mode gets it as if typed
+ */
+static void _handle_paste(Edit *edit) {
+	Line text;
+	line_init(&text);
+
+	STATS_START(&edit->stats, input);
+	term_read_paste(&text);
+	STATS_STOP(&edit->stats, input, STATS_INPUT);
+
+	const char *str = line_get_c_str(&text, false);
+	switch( edit->mode ) {
+	case EDIT_MODE_INSERT:
+		_paste_text(edit, &text);
+		return;
+	case EDIT_MODE_COMMAND:
+		for( size_t i = 0; i < text.length; ++i ) {
+			if( str[i] >= 32 && str[i] <= 126 ) {
+				line_insert_char_at_end(&edit->cmd, str[i]);
+			}
+		}
+
+		_render_command(edit);
+		break;
+	default:
+		/* Commands read keys of their own, so the text goes back to be read
+		 * as if it had been typed
+		 */
+		term_push_keys(str, text.length);
+	}
+
+	line_free(&text);
+}
+
+/* Inserts @text under the cursor as a single edit, which takes it over
+ * The cursor ends up after it
+ */
+static void _paste_text(Edit *edit, Line *text) {
+	if( text->length == 0 ) {
+		line_free(text);
+		return;
+	}
+
+	const char *str = line_get_c_str(text, false);
+
+	size_t idx;
+	const size_t line = file_insert_text(
+		&edit->file, edit->line, edit->idx, str, text->length, &idx);
+
+	if( line == edit->line ) {
+		_damage_lines(edit, line, line + 1);
+	} else {
+		_damage_below(edit, edit->line);
+		_update_gutter(edit);
+	}
+
+	cmd_seal(&edit->undo);
+	cmd_del_str(&edit->undo, line, idx, *text);
+	cmd_seal(&edit->undo);
+
+	_move_cursor(edit, line, idx);
+}
+
+/* Returns a key that is already waiting, or ERR if there is none */
+static int _get_pending(Edit *edit) {
+	STATS_START(&edit->stats, input);
+	const int ch = term_get_key(0);
+	STATS_STOP(&edit->stats, input, STATS_INPUT);
+
+	UNUSED(edit);
+	return ch;
+}
+
+/* Waits for a key, first drawing the frame so far if there is none yet
+ * The wait itself isn't part of the frame
+ */
+static int _get_key(Edit *edit) {
+	const int ch = _get_pending(edit);
+	if( ch != ERR ) {
+		return ch;
+	}
+
+	_render_frame(edit);
+
+	STATS_START(&edit->stats, idle);
+	const int key = term_get_key(-1);
+	STATS_STOP(&edit->stats, idle, STATS_IDLE);
+
+	return key;
+}
+
+/* Draws everything the keys applied so far changed */
+static void _render_frame(Edit *edit) {
+	const bool batching = edit->batching;
+	edit->batching = false;
+
+	STATS_START(&edit->stats, layout);
+	edit_render(edit);
+	edit_render_status(edit);
+	STATS_STOP(&edit->stats, layout, STATS_LAYOUT);
+
+	STATS_START(&edit->stats, render);
+	term_refresh();
+	STATS_STOP(&edit->stats, render, STATS_RENDER);
+
+	edit->batching = batching;
+}
+
+/* Returns a monotonic clock reading, in milliseconds */
+static long long _now(void) {
+#if defined(__linux__) || defined(__APPLE__)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+	return (long long)clock() * 1000 / CLOCKS_PER_SEC;
+#endif
 }
 
 /* Inserts a matching pair of characters, placing the cursor between them */
@@ -856,11 +1190,11 @@ static void _insert_char_pair(Edit *edit, CommandStack *stack, char l, char r) {
 
 /* Gets a number argument from the user */
 static char _get_number_arg(Edit *edit, size_t initial) {
-	int ch = getch();
+	int ch = _get_key(edit);
 	while( ch >= '0' && ch <= '9' ) {
 		initial *= 10;
 		initial += ch - '0';
-		ch = getch();
+		ch = _get_key(edit);
 	}
 
 	edit->cmd_num = initial;
@@ -869,7 +1203,7 @@ static char _get_number_arg(Edit *edit, size_t initial) {
 
 /* Gets a character from the user */
 static void _get_char_arg(Edit *edit) {
-	edit->cmd_char = getch();
+	edit->cmd_char = _get_key(edit);
 }
 
 /* Handles the "move left" command */
@@ -913,6 +1247,12 @@ static void _do_cmd_g(Edit *edit) {
 	case 'g': /* Go to the start of the file */
 		_move_to_start_of_file(edit);
 		break;
+	case '-': /* Go to an older state, across branches of the history */
+		edit_travel(edit, -(long)(edit->cmd_num ? edit->cmd_num : 1));
+		break;
+	case '+': /* Go to a newer state, across branches of the history */
+		edit_travel(edit, (long)(edit->cmd_num ? edit->cmd_num : 1));
+		break;
 	}
 }
 
@@ -925,6 +1265,19 @@ static void _do_cmd_G(Edit *edit) {
 	}
 }
 
+/* Handles the 'd' command */
+static void _do_cmd_d(Edit *edit) {
+	_get_char_arg(edit);
+
+	switch( edit->cmd_char ) {
+	case 'd': /* Delete whole lines */
+		edit_delete_lines(
+			edit, &edit->undo, edit->cmd_num ? edit->cmd_num : 1);
+		cmd_seal(&edit->undo);
+		break;
+	}
+}
+
 /* Exits the command typing mode */
 static void _exit_command_typing(Edit *edit) {
 	line_erase(&edit->cmd);
@@ -939,24 +1292,24 @@ static void _exit_command_typing(Edit *edit) {
 static void _render_command(Edit *edit) {
 	const size_t y = edit->h - 2;
 
-	move(y, 0);
-	clrtoeol();
+	term_move(y, 0);
+	term_clear_to_eol();
 
-	printw("cmd> %.*s ", (int)edit->cmd.length, edit->cmd.text);
+	term_printf("cmd> ");
+	line_render(&edit->cmd);
+	term_put(" ", 1);
 
-	move(edit->y, edit->x);
-	refresh();
+	term_move(edit->y, edit->x);
 }
 
 /* Clears the command line */
 static void _clear_command(Edit *edit) {
 	const size_t y = edit->h - 2;
 
-	move(y, 0);
-	clrtoeol();
+	term_move(y, 0);
+	term_clear_to_eol();
 
-	move(edit->y, edit->x);
-	refresh();
+	term_move(edit->y, edit->x);
 }
 
 #define MATCH_SIMPLE_CMD(C) (strncmp(cmd, (C), len) == 0)
@@ -964,12 +1317,12 @@ static void _clear_command(Edit *edit) {
 /* Handles an entered command */
 static void _handle_command(Edit *edit) {
 	char *cmd = line_get_c_str(&edit->cmd, false);
-	const int len = strlen(cmd);
-
-	if( len == 0 ) {
+	if( cmd == NULL ) {
 		return;
 	}
 
+	const int len = strlen(cmd);
+
 	if( *cmd >= '0' && *cmd <= '9' ) {
 		size_t n = 0;
 		do {
@@ -1019,6 +1372,20 @@ static void _handle_command(Edit *edit) {
 		return;
 	}
 
+	/* Show the memory used by the file's lines */
+	if MATCH_SIMPLE_CMD( "mem" ) {
+		Slab *slab = &edit->file.slab;
+		edit_set_status(edit, "lines: %zu KiB reserved, %zu KiB slack",
+			slab->reserved >> 10, slab_get_slack(slab) >> 10);
+		return;
+	}
+
+	/* Show how long recent frames took */
+	if MATCH_SIMPLE_CMD( "stats" ) {
+		_show_stats(edit);
+		return;
+	}
+
 	if( *cmd == '!' ) {
 		_handle_shell_command(edit, cmd + 1);
 		return;
@@ -1037,6 +1404,44 @@ static void _handle_shell_command(Edit *edit, const char *cmd) {
 	edit_set_status(edit, "system call returned %d", err);
 }
 
+/* Shows the 50th, 95th and 99th percentile time of each phase of a frame,
+ * over the last STATS_WINDOW frames that applied keys, less those that waited
+ * on a prompt
+ */
+static void _show_stats(Edit *edit) {
+#ifdef EDIT_STATS
+	enum { ROW_LEN = 80, ROWS = STATS_FRAME + 3 };
+
+	char rows[ROWS][ROW_LEN];
+	const char *lines[ROWS];
+
+	snprintf(rows[0], ROW_LEN, "%-8s %9s %9s %9s",
+		"phase", "p50 us", "p95 us", "p99 us");
+	for( size_t phase = 0; phase <= STATS_FRAME; ++phase ) {
+		long long p50, p95, p99;
+		stats_get_percentiles(&edit->stats, phase, &p50, &p95, &p99);
+
+		snprintf(rows[phase + 1], ROW_LEN, "%-8s %9lld %9lld %9lld",
+			stats_get_phase_name(phase), p50 / 1000, p95 / 1000, p99 / 1000);
+	}
+	snprintf(rows[ROWS - 1], ROW_LEN, "%zu of %zu frames",
+		edit->stats.count, edit->stats.frames);
+
+	for( size_t i = 0; i < ROWS; ++i ) {
+		lines[i] = rows[i];
+	}
+
+	STATS_SKIP_FRAME(&edit->stats);
+
+	Prompt prompt;
+	prompt_init_info(&prompt, "Frame times", lines, ROWS);
+	prompt_wait(&prompt);
+	prompt_free(&prompt);
+#else
+	edit_set_status(edit, "built without EDIT_STATS");
+#endif
+}
+
 #define MATCH_CMD(C) ((args = _match_command(cmd, (C), strlen((C)))))
 
 /* Handles more complex commands */
@@ -1076,6 +1481,55 @@ static void _handle_complex_command(Edit *edit, const char *cmd) {
 		return;
 	}
 
+	/* Goes to a numbered state of the history */
+	if MATCH_CMD( "undo " ) {
+		char *end;
+		const unsigned long long seq = strtoull(args, &end, 10);
+		if( end == args || *end != '\0' ) {
+			edit_set_status(edit, "usage: undo <state>");
+			return;
+		}
+
+		edit_travel_to(edit, (size_t)seq);
+		return;
+	}
+
+	/* Goes back or forward in the history, by states or by time */
+	if( MATCH_CMD("earlier ") || MATCH_CMD("later ") ) {
+		const long sign = cmd[0] == 'e' ? -1 : 1;
+		if( !_parse_travel(edit, args, sign) ) {
+			edit_set_status(edit, "usage: %s <count>[s|m|h]",
+				sign < 0 ? "earlier" : "later");
+		}
+		return;
+	}
+
+	/* Starts or stops writing a trace of where the time goes */
+	if MATCH_CMD( "trace " ) {
+		if( strncmp(args, "start", 5) == 0
+			&& (args[5] == '\0' || args[5] == ' ') ) {
+			const char *path = args[5] ? args + 6 : TRACE_FILE;
+			if( trace_start(path) ) {
+				edit_set_status(edit, "tracing to '%s'", path);
+			} else {
+				edit_set_status(edit, "couldn't trace to '%s': %s", path,
+					strerror(errno));
+			}
+		} else if( strcmp(args, "stop") == 0 ) {
+			if( !trace_is_running() ) {
+				edit_set_status(edit, "not tracing");
+			} else if( trace_stop() ) {
+				edit_set_status(edit, "trace written");
+			} else {
+				edit_set_status(edit, "couldn't write trace: %s",
+					strerror(errno));
+			}
+		} else {
+			edit_set_status(edit, "usage: trace start [file] | trace stop");
+		}
+		return;
+	}
+
 	/* Gets (prints) a config option */
 	if( MATCH_CMD("getc ") || MATCH_CMD("getconfig ") ) {
 		char *value = edit_get_config(edit, args);
@@ -1099,15 +1553,22 @@ static char *_match_command(const char *cmd, const char *match, int len) {
 	return (char *)cmd;
 }
 
-/* Updates the gutter size */
+/* Updates the gutter size
+ * Every row moves over when it changes
+ */
 static void _update_gutter(Edit *edit) {
 	size_t line_count = edit->file.length;
 
-	edit->gutter = 1;
+	size_t gutter = 1;
 	do {
-		++edit->gutter;
+		++gutter;
 		line_count /= 10;
 	} while( line_count != 0 );
+
+	if( gutter != edit->gutter ) {
+		edit->gutter = gutter;
+		_damage_below(edit, edit->vy);
+	}
 }
 
 /* Validates the cursor position */
@@ -1126,8 +1587,39 @@ static void _update_cursor_x(Edit *edit) {
 	}
 
 	edit->x = edit->idx + edit->gutter;
-	move(edit->y, edit->x);
-	refresh();
+	term_move(edit->y, edit->x);
+}
+
+/* Marks the rows showing lines @from up to (but not including) @to as
+ * needing to be drawn
+ */
+static void _damage_lines(Edit *edit, size_t from, size_t to) {
+	from = MAX(from, edit->vy);
+	if( to <= from ) {
+		return;
+	}
+
+	screen_damage(&edit->screen, from - edit->vy, to - edit->vy);
+}
+
+/* Marks the rows showing line @from and every line after it as needing to be
+ * drawn, as happens when lines are added or taken out
+ */
+static void _damage_below(Edit *edit, size_t from) {
+	_damage_lines(edit, from, edit->vy + edit->screen.h);
+}
+
+/* Scrolls the viewport so it starts at line @vy
+ * The rows still in view are moved on the terminal rather than drawn again
+ */
+static void _scroll_to(Edit *edit, size_t vy) {
+	if( vy == edit->vy ) {
+		return;
+	}
+
+	const long by = (long)vy - (long)edit->vy;
+	edit->vy = vy;
+	screen_scroll(&edit->screen, by);
 }
 
 /* Moves the cursor to the start of the line */
@@ -1137,8 +1629,7 @@ static void _move_to_start_of_line(Edit *edit) {
 
 /* Moves the cursor to the end of the line */
 static void _move_to_end_of_line(Edit *edit) {
-	Line *line = edit_get_current_line(edit);
-	_move_to_idx(edit, line->length);
+	_move_to_idx(edit, edit_get_current_line_length(edit));
 }
 
 /* Moves the cursor to a given index in the line */
@@ -1159,8 +1650,104 @@ static void _move_to_end_of_file(Edit *edit) {
 	_move_to_start_of_line(edit);
 }
 
+/* Moves the cursor up one row, leaving the group of edits being made open */
+static bool _step_up(Edit *edit) {
+	if( edit->line <= 0 ) {
+		edit->line = 0;
+		return false;
+	}
+
+	--edit->line;
+	if( edit->y == 0 ) {
+		if( edit->vy > 0 ) {
+			_scroll_to(edit, edit->vy - 1);
+			edit_render(edit);
+		}
+	} else {
+		--edit->y;
+	}
+
+	_update_cursor_x(edit);
+
+	return true;
+}
+
+/* Limits how much memory the undo history may take up
+ * Set with the "undo_budget" option, in bytes, where 0 means no limit
+ */
+static void _update_undo_budget(Edit *edit) {
+	size_t budget = CMD_DEFAULT_BUDGET;
+
+	char *value = edit_get_config(edit, "undo_budget");
+	if( value && *value ) {
+		char *end;
+		const unsigned long long bytes = strtoull(value, &end, 10);
+		if( *end == '\0' ) {
+			budget = (size_t)bytes;
+		}
+	}
+
+	cmd_set_budget(&edit->undo, budget);
+	cmd_set_budget(&edit->inverse, budget);
+	undo_set_budget(&edit->history, budget);
+}
+
+/* Limits how long a frame may spend applying keys before drawing them
+ * Set with the "frame_budget" option, in milliseconds
+ */
+static void _update_frame_budget(Edit *edit) {
+	edit->frame_budget = FRAME_BUDGET_MS;
+
+	char *value = edit_get_config(edit, "frame_budget");
+	if( value && *value ) {
+		char *end;
+		const long ms = strtol(value, &end, 10);
+		if( *end == '\0' && ms >= 0 ) {
+			edit->frame_budget = ms;
+		}
+	}
+}
+
+/* Returns how long to wait for a key, in milliseconds, before there is
+ * something else to do
+ */
+static int _get_timeout(Edit *edit) {
+	int ms = file_get_journal_timeout(&edit->file);
+	if( file_is_saving(&edit->file) ) {
+		ms = ms < 0 ? SAVE_POLL_MS : MIN(ms, SAVE_POLL_MS);
+	}
+
+	return ms;
+}
+
+/* Offers to replay the edits to the file that were never saved */
+static void _offer_recovery(Edit *edit) {
+	if( !file_has_recovery(&edit->file) ) {
+		return;
+	}
+
+	STATS_SKIP_FRAME(&edit->stats);
+
+	Prompt prompt;
+	char *file = file_get_display_name(&edit->file);
+	prompt_init(
+		&prompt, PROMPT_YES_NO, "Recover unsaved changes to '%s'?", file);
+
+	if( prompt_opt_get(&prompt) == PROMPT_YES ) {
+		const size_t count = file_recover(&edit->file);
+		edit_set_status(
+			edit, "recovered %zu unsaved edits to '%s'", count, file);
+	} else {
+		file_discard_recovery(&edit->file);
+	}
+
+	prompt_free(&prompt);
+}
+
 /* Prompts the user to save the file */
 static bool _ask_to_save(Edit *edit) {
+	STATS_SKIP_FRAME(&edit->stats);
+
 	Prompt prompt;
 	char *file = file_get_display_name(&edit->file);
 	prompt_init(&prompt, PROMPT_YES_NO_CANCEL, "Save changes to '%s'?", file);
@@ -1168,6 +1755,11 @@ static bool _ask_to_save(Edit *edit) {
 	switch( prompt_opt_get(&prompt) ) {
 	case PROMPT_YES:
 		edit_save(edit);
+		if( !_wait_for_save(edit) ) {
+			prompt_free(&prompt);
+			return false;
+		}
+
 		break;
 	case PROMPT_NO:
 		break;
@@ -1180,8 +1772,57 @@ static bool _ask_to_save(Edit *edit) {
 	return true;
 }
 
+/* Waits for a save in progress to finish
+ * Returns false if it failed
+ */
+static bool _wait_for_save(Edit *edit) {
+	if( !file_is_saving(&edit->file) ) {
+		return true;
+	}
+
+	const SaveState state = file_wait_save(&edit->file);
+	_store_history(edit, state);
+	_report_save(edit, state, 0, 0);
+
+	return state != SAVE_FAILED;
+}
+
+/* Checks on a save in progress, if there is one */
+static void _poll_save(Edit *edit) {
+	if( !file_is_saving(&edit->file) ) {
+		return;
+	}
+
+	size_t written, total;
+	const SaveState state = file_poll_save(&edit->file, &written, &total);
+	_store_history(edit, state);
+	_report_save(edit, state, written, total);
+}
+
+/* Shows how a save is going in the status bar */
+static void _report_save(
+	Edit *edit, SaveState state, size_t written, size_t total) {
+	char *name = file_get_display_name(&edit->file);
+
+	switch( state ) {
+	case SAVE_IDLE:
+		break;
+	case SAVE_RUNNING:
+		edit_set_status(edit, "saving '%s' (%zu%%)", name,
+			total ? written * 100 / total : 0);
+		break;
+	case SAVE_DONE:
+		edit_set_status(edit, "saved file as '%s'", name);
+		break;
+	case SAVE_FAILED:
+		edit_set_status(edit, "couldn't save '%s': %s", name, strerror(errno));
+		break;
+	}
+}
+
 /* Adds a newline in the text */
 static void _newline(Edit *edit) {
+	_damage_below(edit, edit->line);
 	file_break_line(&edit->file, edit->line++, edit->idx);
 	++edit->y;
 
@@ -1193,6 +1834,268 @@ static void _newline(Edit *edit) {
 	edit_render(edit);
 }
 
+/* Runs a CMD_REP_STR command
+ * The replaced characters are swapped into its text, which then moves on to
+ * the command undoing it
+ */
+static void _rep_str(Edit *edit, CommandStack *stack, Command *cmd) {
+	Line *text = &cmd->data.line;
+	const char *str = line_get_c_str(text, false);
+
+	size_t idx = cmd->idx;
+	for( size_t i = 0; i < text->length; ++i, ++idx ) {
+		char prev = file_replace_char(&edit->file, cmd->line, idx, str[i]);
+		line_replace_char(text, i, prev);
+	}
+
+	_damage_lines(edit, cmd->line, cmd->line + 1);
+
+	_move_cursor(edit, cmd->line, idx);
+	cmd_rep_str(stack, cmd->line, cmd->idx, *text);
+}
+
+/* Runs a CMD_ADD_STR command, inserting its text at its position */
+static void _add_str(Edit *edit, CommandStack *stack, Command *cmd) {
+	Line *text = &cmd->data.line;
+	const char *str = line_get_c_str(text, false);
+
+	size_t line = cmd->line, idx = cmd->idx;
+	if( text->length > 0 ) {
+		line = file_insert_text(
+			&edit->file, line, idx, str, text->length, &idx);
+	}
+
+	_damage_below(edit, cmd->line);
+	_update_gutter(edit);
+	_move_cursor(edit, line, idx);
+
+	cmd_del_str(stack, line, idx, *text);
+}
+
+/* Runs a CMD_DEL_STR command, erasing its text back from its position */
+static void _del_str(Edit *edit, CommandStack *stack, Command *cmd) {
+	Line *text = &cmd->data.line;
+	const char *str = line_get_c_str(text, false);
+
+	/* Work out where the text starts from where it ends */
+	size_t line = cmd->line, idx = cmd->idx;
+	size_t first = text->length;
+	for( size_t i = text->length; i-- > 0; ) {
+		if( str[i] == '\n' ) {
+			--line;
+			first = i;
+		}
+	}
+
+	if( line == cmd->line ) {
+		idx -= text->length;
+	} else {
+		idx = (size_t)edit_get_line_length(edit, line) - first;
+	}
+
+	if( text->length > 0 ) {
+		file_delete_text(&edit->file, line, idx, cmd->line, cmd->idx);
+	}
+
+	_damage_below(edit, line);
+	_update_gutter(edit);
+	_move_cursor(edit, line, idx);
+
+	cmd_add_str(stack, line, idx, *text);
+}
+
+/* Runs a CMD_ADD_LINE command, pasting its lines back in where they were cut
+ * out, which may be past the last line
+ */
+static void _add_lines(Edit *edit, CommandStack *stack, Command *cmd) {
+	Piece *pieces = cmd->data.block.pieces;
+	const size_t count = pieces ? pieces->lines : 0;
+
+	file_paste_lines(
+		&edit->file, cmd->line, pieces, cmd->data.block.placeholder);
+
+	_damage_below(edit, cmd->line);
+	_update_gutter(edit);
+	_move_cursor(edit, cmd->line, 0);
+
+	edit_del_line(edit, stack, count);
+}
+
+/* Puts the cursor at column @idx of @line, scrolling to it if needed */
+static void _move_cursor(Edit *edit, size_t line, size_t idx) {
+	edit->idx = idx;
+	edit_goto(edit, line);
+	_update_cursor_x(edit);
+
+	edit->last_ins_line = edit->line;
+	edit->last_ins_idx = edit->idx;
+}
+
+/* Runs an edit command, pushing its inverse into @stack */
+static void _run_cmd(Edit *edit, CommandStack *stack, Command *cmd) {
+	edit->idx = cmd->idx;
+	_update_cursor_x(edit);
+
+	edit_goto(edit, cmd->line);
+
+	switch( cmd->type ) {
+	case CMD_REP_CH:
+		edit_replace_char(edit, stack, cmd->data.ch);
+		break;
+	case CMD_ADD_CH:
+		edit_insert_char(edit, stack, cmd->data.ch);
+		break;
+	case CMD_DEL_CH:
+		edit_delete_char(edit, stack);
+		break;
+	case CMD_NEW_LINE:
+		edit_insert_char(edit, stack, '\n');
+		break;
+	case CMD_ADD_LINE:
+		_add_lines(edit, stack, cmd);
+		break;
+	case CMD_DEL_LINE:
+		edit_delete_lines(edit, stack, cmd->length);
+		break;
+	case CMD_REP_STR:
+		_rep_str(edit, stack, cmd);
+		break;
+	case CMD_ADD_STR:
+		_add_str(edit, stack, cmd);
+		break;
+	case CMD_DEL_STR:
+		_del_str(edit, stack, cmd);
+		break;
+	}
+
+	/* Whatever is pushed next belongs to another group */
+	cmd_seal(stack);
+}
+
+/* Runs the command of a node just undone or redone, and stores its inverse
+ * in the node so it can be run the other way next time
+ */
+static void _apply_node(Edit *edit, UndoNode *node) {
+	TRACE_BEGIN(span, "undo replay");
+
+	_run_cmd(edit, &edit->inverse, &node->cmd);
+
+	Command *inverse = cmd_pop(&edit->inverse);
+	undo_store(&edit->history, node, inverse ? *inverse : node->cmd);
+
+	TRACE_END(span);
+}
+
+/* Takes the file to state @target, undoing back to where its branch meets
+ * the current one, then redoing down to it
+ */
+static void _goto_state(Edit *edit, size_t target) {
+	UndoTree *history = &edit->history;
+
+	TRACE_BEGIN(span, "undo travel");
+
+	const size_t common = undo_get_common(history, history->current, target);
+	size_t steps = 0;
+	while( history->current != common ) {
+		_apply_node(edit, undo_back(history));
+		++steps;
+	}
+
+	const size_t depth = undo_get(history, target)->depth
+		- undo_get(history, common)->depth;
+	if( depth > 0 ) {
+		size_t *path = malloc(sizeof(*path) * depth);
+		if( !path ) {
+			fprintf(stderr, "Failed to allocate path of %zu states!\n", depth);
+			exit(1);
+		}
+
+		undo_get_path(history, common, target, path);
+		for( size_t i = 0; i < depth; ++i ) {
+			_apply_node(edit, undo_forward(history, path[i]));
+		}
+
+		free(path);
+		steps += depth;
+	}
+
+	TRACE_END_ARG(span, "states", steps);
+
+	edit_render(edit);
+	edit_set_status(edit, "state %zu of %zu",
+		undo_get(history, history->current)->seq, history->seq);
+}
+
+/* Handles the arguments to :earlier and :later, which are either a number of
+ * states or an amount of time, like "30s", "5m" or "1h"
+ * Returns if they made sense
+ */
+static bool _parse_travel(Edit *edit, const char *args, long sign) {
+	char *end;
+	const long n = strtol(args, &end, 10);
+	if( end == args || n < 0 ) {
+		return false;
+	}
+
+	if( *end == '\0' ) {
+		edit_travel(edit, sign * n);
+		return true;
+	}
+
+	if( end[1] != '\0' ) {
+		return false;
+	}
+
+	switch( *end ) {
+	case 's':
+		edit_travel_time(edit, sign * n);
+		return true;
+	case 'm':
+		edit_travel_time(edit, sign * n * 60);
+		return true;
+	case 'h':
+		edit_travel_time(edit, sign * n * 60 * 60);
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Hands every edit over to the history, and grafts on what is left of the
+ * history of earlier sessions, so all of it can be moved through
+ */
+static void _settle_history(Edit *edit) {
+	undo_absorb(&edit->history, &edit->undo, true);
+
+	if( sidecar_is_pending(&edit->sidecar) ) {
+		sidecar_import(&edit->sidecar, &edit->history, &edit->file.table,
+			file_get_loaded_hash(&edit->file));
+	}
+}
+
+/* Picks up the history of earlier sessions, unless edits were recovered, as
+ * it only applies to the file as it is on disk
+ * The file is only hashed to check the history against if there is some
+ */
+static void _open_history(Edit *edit) {
+	if( edit->file.unnamed || file_is_dirty(&edit->file) ) {
+		return;
+	}
+
+	sidecar_open(&edit->sidecar, file_get_name(&edit->file), &edit->history);
+	if( sidecar_is_pending(&edit->sidecar) ) {
+		file_start_hash(&edit->file);
+	}
+}
+
+/* Keeps the history next to the file, once a save of it is done */
+static void _store_history(Edit *edit, SaveState state) {
+	if( state == SAVE_DONE ) {
+		sidecar_write(&edit->sidecar, file_get_name(&edit->file),
+			file_get_saved_hash(&edit->file));
+	}
+}
+
 /* Returns a string representing the current mode */
 static char *_get_mode_string(Edit *edit) {
 	switch( edit->mode ) {
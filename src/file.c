@@ -2,46 +2,82 @@
  * File handling utilities
  */
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #ifdef USE_PDCURSES
 #include <curses.h>
 #else
 #include <ncurses.h>
 #endif
 
+#include "global.h"
+
 #include "line.h"
+#include "slab.h"
+#include "screen.h"
 #include "prompt.h"
 #include "config.h"
+#include "save.h"
+#include "journal.h"
+#include "trace.h"
 
 #include "file.h"
 
 #define DEFAULT_FILE_NAME "unnamed"
 
 static void _create_default_file(File *file);
-
-static void _render(File *file, size_t from, int gutter, void (*fn)(Line *));
-static void _render_line(
-	File *file, size_t idx, size_t from, int gutter, void (*fn)(Line *));
-
-static void _grow_line_array(File *file);
-static void _grow_line_array_to(File *file, size_t new_capacity);
-
-static bool _is_line_array_full(File *file);
+static bool _load_mapped(File *file, const char *filename);
+static void *_hash_loaded(void *arg);
+static void _join_hash(File *file);
+static size_t _get_load_threads(File *file);
+static SyncPolicy _get_sync_policy(File *file);
+static SaveState _check_save(File *file, SaveState state);
+
+static bool _apply_record(void *ctx, JournalRecord *record);
+static void _insert_string(
+	File *file, size_t idx, const char *text, size_t length);
+static void _insert_line(File *file, size_t idx, Line *line);
+static void _record_line(File *file, size_t idx, bool replace);
+static void _delete_line(File *file, size_t idx);
+static Piece *_cut_lines(File *file, size_t idx, size_t count);
+
+static void _render_row(
+	Screen *screen, size_t y, size_t offset, int gutter, PieceIter *iter);
+
+static void _get_line_spans(File *file, size_t idx, const char **first,
+	size_t *first_len, const char **second, size_t *second_len);
 
 static char *_ask_to_name(void);
 
-/* Creates a new file */
-bool file_init(File *file, const char *filename) {
+/* Creates a new file
+ * Options it doesn't set itself are looked up in @parent, if there is one
+ */
+bool file_init(File *file, const char *filename, Config *parent) {
+	slab_init(&file->slab);
+	piece_init(&file->table, &file->slab);
 	file->length = 0;
-	file->capacity = 4;
-	file->lines = malloc(sizeof(Line) * file->capacity);
 
 	config_init(&file->config);
+	file->parent = parent;
+
+	save_init(&file->save);
+	journal_init(&file->journal);
+
+	file->loaded_hash = SAVE_FNV_OFFSET_BASIS;
+	file->hashing = false;
 
 	return file_load(file, filename);
 }
@@ -50,15 +86,14 @@ bool file_init(File *file, const char *filename) {
 void file_free(File *file) {
 	memset(file->name, 0, MAX_FILE_NAME_SIZE);
 
-	for( size_t i = 0; i < file->length; ++i ) {
-		line_free(&file->lines[i]);
-	}
-
-	free(file->lines);
-	file->lines = NULL;
+	/* A save or the hasher may still be reading the original buffer */
+	save_free(&file->save);
+	journal_free(&file->journal);
+	_join_hash(file);
 
+	piece_free(&file->table);
+	slab_free(&file->slab);
 	file->length = 0;
-	file->capacity = 0;
 
 	file->dirty = false;
 	file->unnamed = false;
@@ -80,6 +115,8 @@ bool file_load(File *file, const char *filename) {
 
 	file->unnamed = false;
 
+	TRACE_BEGIN(span, "load");
+
 	strncpy(file->name, filename, MAX_FILE_NAME_SIZE - 1);
 
 	/* Get file extension */
@@ -88,62 +125,82 @@ bool file_load(File *file, const char *filename) {
 		file_set_extension(file, dot + 1);
 	}
 
-	FILE *fp = fopen(filename, "r");
-	if( fp ) {
-		bool ok = file_load_from_fp(file, fp);
-		fclose(fp);
-		return ok;
+	bool ok = true;
+
+	if( !_load_mapped(file, filename) ) {
+		FILE *fp = fopen(filename, "r");
+		if( fp ) {
+			ok = file_load_from_fp(file, fp);
+			fclose(fp);
+		}
 	}
 
-	file_insert_empty_line(file, 0);
-	file->dirty = false;
+	/* Even an empty file has a line to type in */
+	if( file->length == 0 ) {
+		file_insert_empty_line(file, 0);
+	}
 
-	return true;
-}
+	file->dirty = false;
 
-/* Loads a file incrementally from a file pointer */
-bool file_load_from_fp(File *file, FILE *fp) {
-	char buf[BUFSIZ];
-	size_t line_idx = 0, char_idx = 0;
-	Line line;
+	journal_open(&file->journal, filename);
 
-	/* Watchdog to check if the entire buffer was read */
-	memset(buf, 0, BUFSIZ);
-	buf[BUFSIZ - 1] = 0x55;
+	TRACE_END_ARG(span, "lines", file->length);
 
-	line_init(&line);
+	return ok;
+}
 
-	while( fgets(buf, BUFSIZ, fp) ) {
-		line_insert_str(&line, char_idx, buf);
+/* Loads a file from a file pointer
+ * Its contents are read whole, becoming the original buffer of the piece table
+ */
+bool file_load_from_fp(File *file, FILE *fp) {
+	size_t size = 0, capacity = BUFSIZ;
+	char *data = malloc(capacity);
+	if( !data ) {
+		fprintf(stderr, "Failed to allocate %zu bytes for file!\n", capacity);
+		exit(1);
+	}
 
-		if( feof(fp) ) {
-			file_insert_line(file, line_idx++, &line);
-			break;
+	size_t read;
+	while( (read = fread(data + size, 1, capacity - size, fp)) > 0 ) {
+		size += read;
+		if( size < capacity ) {
+			continue;
 		}
 
-		/* If true, we reached a newline, and can finish this line
-		 * Otherwise, the entire buffer was filled, and there's more to read
-		 */
-		if( buf[BUFSIZ - 1] == 0x55 ) {
-			char_idx = 0;
-
-			file_insert_line(file, line_idx++, &line);
-			line_init(&line);
-		} else {
-			buf[BUFSIZ - 1] = 0x55;
-			char_idx += BUFSIZ - 1;
+		capacity *= 2;
+		char *new_data = realloc(data, capacity);
+		if( !new_data ) {
+			fprintf(
+				stderr, "Failed to reallocate %zu bytes for file!\n", capacity);
+			exit(1);
 		}
+
+		data = new_data;
 	}
 
-	if( !feof(fp) ) {
+	if( ferror(fp) ) {
+		free(data);
 		return false;
 	}
 
+	piece_load(&file->table, data, size, false, _get_load_threads(file));
+	file->length = file->table.length;
+
 	return true;
 }
 
-/* Saves the file */
+/* Starts saving the file in the background
+ *
+ * What gets written is a snapshot of the file as it is now, so it can keep
+ * being edited in the meantime
+ * Returns false, with errno set, if another save is still running
+ */
 bool file_save(File *file, const char *as) {
+	if( file_poll_save(file, NULL, NULL) == SAVE_RUNNING ) {
+		errno = EBUSY;
+		return false;
+	}
+
 	if( as ) {
 		strncpy(file->name, as, MAX_FILE_NAME_SIZE - 1);
 	} else if( file->unnamed ) {
@@ -157,43 +214,127 @@ bool file_save(File *file, const char *as) {
 		strncpy(file->name, new_name, strlen(new_name));
 	}
 
-	FILE *fp = fopen(file->name, "w");
-	if( fp == NULL ) {
-		return false;
-	}
-
-	/* Saves the lines to a file */
-	for( size_t i = 0; i < file->length; ++i ) {
-		Line *line = file_get_line(file, i);
-		fwrite(line->text, sizeof(*line->text), line->length, fp);
-		fputc('\n', fp);
-	}
+	/* Edits recorded from here on aren't part of the save */
+	journal_mark(&file->journal);
 
-	fclose(fp);
+	TRACE_BEGIN(span, "save snapshot");
+	save_snapshot(
+		&file->save, &file->table, file->name, _get_sync_policy(file));
+	save_start(&file->save);
+	TRACE_END(span);
 
+	/* Edits made while saving make the file dirty again */
 	file->dirty = false;
 
 	return true;
 }
 
-/* Renders the file's contents */
-void file_render(File *file, size_t from, int gutter) {
-	_render(file, from, gutter, line_render);
+/* Returns how the save is going, setting @written and @total if given
+ * A failed save marks the file dirty again
+ */
+SaveState file_poll_save(File *file, size_t *written, size_t *total) {
+	return _check_save(file, save_poll(&file->save, written, total));
+}
+
+/* Waits for the save to finish, and reports on it like file_poll_save() */
+SaveState file_wait_save(File *file) {
+	return _check_save(file, save_wait(&file->save));
 }
 
-/* Renders a single line from the file */
-void file_render_line(File *file, size_t idx, size_t from, int gutter) {
-	_render_line(file, idx, from, gutter, line_render);
+/* Returns if the file is being saved, or has a save left to report */
+bool file_is_saving(File *file) {
+	return save_is_pending(&file->save);
 }
 
-/* Renders the file's contents, with color */
-void file_render_color(File *file, size_t from, int gutter) {
-	_render(file, from, gutter, line_render_color);
+/* Returns the hash of what the last finished save wrote */
+uint64_t file_get_saved_hash(File *file) {
+	return file->save.hash;
 }
 
-/* Renders a single line from the file, with color */
-void file_render_line_color(File *file, size_t idx, size_t from, int gutter) {
-	_render_line(file, idx, from, gutter, line_render_color);
+/* Starts working out the hash of the file as it was loaded, for
+ * file_get_loaded_hash()
+ * Large files are hashed on a thread of their own, so nothing waits on it
+ * until the hash is asked for
+ */
+void file_start_hash(File *file) {
+	_join_hash(file);
+
+#if defined(__linux__) || defined(__APPLE__)
+	if( file->table.orig_size >= FILE_HASH_THREAD_MIN
+		&& pthread_create(&file->hasher, NULL, _hash_loaded, file) == 0 ) {
+		file->hashing = true;
+		return;
+	}
+#endif
+
+	_hash_loaded(file);
+}
+
+/* Returns the hash of the file as it was loaded, matching what a save of it
+ * would have written
+ * Only waits on the hash if file_start_hash() started it a moment ago
+ */
+uint64_t file_get_loaded_hash(File *file) {
+	_join_hash(file);
+	return file->loaded_hash;
+}
+
+/* Returns if edits that were never saved were found for the file */
+bool file_has_recovery(File *file) {
+	return file->journal.recoverable;
+}
+
+/* Replays the edits that were never saved, returning how many there were */
+size_t file_recover(File *file) {
+	TRACE_BEGIN(span, "journal replay");
+	const size_t count = journal_replay(&file->journal, _apply_record, file);
+	TRACE_END_ARG(span, "records", count);
+	if( count > 0 ) {
+		file_mark_dirty(file);
+	}
+
+	return count;
+}
+
+/* Drops the edits that were never saved */
+void file_discard_recovery(File *file) {
+	journal_discard(&file->journal);
+}
+
+/* Returns how many milliseconds until recorded edits are due to be written
+ * to the journal, or -1 if there are none
+ */
+int file_get_journal_timeout(File *file) {
+	return journal_get_timeout(&file->journal);
+}
+
+/* Writes recorded edits to the journal, if they have waited long enough */
+void file_tick_journal(File *file) {
+	journal_tick(&file->journal);
+}
+
+/* Writes recorded edits to the journal right away */
+void file_flush_journal(File *file) {
+	journal_flush(&file->journal);
+}
+
+/* Renders the rows of @screen that need drawing, from line @from on
+ * Runs of damaged rows are walked with a single iterator
+ */
+void file_render(File *file, Screen *screen, size_t from, int gutter) {
+	const size_t maxy = screen->h;
+
+	size_t y = screen_get_damaged(screen, 0, maxy);
+	while( y < maxy ) {
+		PieceIter iter;
+		piece_iter_init(&iter, &file->table, from + y);
+
+		for( ; y < maxy && screen_is_damaged(screen, y); ++y ) {
+			_render_row(screen, y, from + y, gutter, &iter);
+		}
+
+		y = screen_get_damaged(screen, y, maxy);
+	}
 }
 
 /* Marks a file as "dirty" (modified) */
@@ -208,20 +349,29 @@ bool file_is_dirty(File *file) {
 
 /* Replaces a character in the file by @ch directly */
 char file_replace_char(File *file, size_t line, size_t idx, char ch) {
+	journal_record(&file->journal,
+		&(JournalRecord) { JOURNAL_REPLACE_CHAR, line, idx, ch, NULL, 0 });
+
 	file_mark_dirty(file);
-	return line_replace_char(&file->lines[line], idx, ch);
+	return line_replace_char(file_get_line(file, line), idx, ch);
 }
 
 /* Inserts a character into a line in the file */
 void file_insert_char(File *file, size_t line, size_t idx, char ch) {
+	journal_record(&file->journal,
+		&(JournalRecord) { JOURNAL_INSERT_CHAR, line, idx, ch, NULL, 0 });
+
 	file_mark_dirty(file);
-	line_insert_char(&file->lines[line], idx, ch);
+	line_insert_char(file_get_line(file, line), idx, ch);
 }
 
 /* Deletes a character from a line in the file */
 char file_delete_char(File *file, size_t line, size_t idx) {
+	journal_record(&file->journal,
+		&(JournalRecord) { JOURNAL_DELETE_CHAR, line, idx, '\0', NULL, 0 });
+
 	file_mark_dirty(file);
-	return line_delete_char(&file->lines[line], idx);
+	return line_delete_char(file_get_line(file, line), idx);
 }
 
 /* Inserts a string
@@ -229,7 +379,7 @@ char file_delete_char(File *file, size_t line, size_t idx) {
  */
 void file_insert_string(File *file, size_t idx, char *str) {
 	Line line;
-	line_init(&line);
+	line_init_slab(&line, &file->slab);
 
 	line_insert_str(&line, 0, str);
 	file_insert_line(file, idx, &line);
@@ -238,13 +388,16 @@ void file_insert_string(File *file, size_t idx, char *str) {
 /* Inserts a line break into the file */
 void file_break_line(File *file, size_t line, size_t idx) {
 	Line new_line;
-	line_init(&new_line);
+	line_init_slab(&new_line, &file->slab);
+
+	journal_record(&file->journal,
+		&(JournalRecord) { JOURNAL_BREAK_LINE, line, idx, '\0', NULL, 0 });
 
 	file_mark_dirty(file);
 
 	/* If we're at the beginning of the line, insert the empty line here */
 	if( idx == 0 ) {
-		file_insert_line(file, line, &new_line);
+		_insert_line(file, line, &new_line);
 		return;
 	}
 
@@ -261,15 +414,119 @@ void file_break_line(File *file, size_t line, size_t idx) {
 
 	/* If we're at the end of the line, insert the empty line on the next row */
 	if( idx == curr_line->length ) {
-		file_insert_line(file, line + 1, &new_line);
+		_insert_line(file, line + 1, &new_line);
 		return;
 	}
 
+	const size_t length = curr_line->length - idx;
 	char *buf = line_copy(curr_line, idx, -1, true);
-	line_insert_str(&new_line, 0, buf);
+	line_insert_strn(&new_line, 0, buf, length);
 	free(buf);
 
-	file_insert_line(file, line + 1, &new_line);
+	_insert_line(file, line + 1, &new_line);
+}
+
+/* Inserts @length characters of @text, which may span several lines, at
+ * column @idx of @line
+ *
+ * Every line the text brings in is put into the table at once, rather than
+ * broken off one at a time. Returns the line the text ends on, and sets @end
+ * to the column it ends at
+ */
+size_t file_insert_text(File *file, size_t line, size_t idx, const char *text,
+	size_t length, size_t *end) {
+	Line *curr_line = file_get_line(file, line);
+	file_mark_dirty(file);
+
+	const char *nl = memchr(text, '\n', length);
+	if( nl == NULL ) {
+		line_insert_strn(curr_line, idx, text, length);
+		_record_line(file, line, true);
+
+		*end = idx + length;
+		return line;
+	}
+
+	size_t count = 0;
+	for( const char *c = nl; c; ++count ) {
+		c = memchr(c + 1, '\n', text + length - c - 1);
+	}
+
+	Line *lines = malloc(sizeof(*lines) * count);
+	if( !lines ) {
+		fprintf(stderr, "Failed to allocate %zu lines!\n", count);
+		exit(1);
+	}
+
+	/* The text after the cursor ends up after the last of the new lines */
+	const size_t tail_length = curr_line->length - idx;
+	char *tail = line_copy(curr_line, idx, (long)tail_length, true);
+	line_insert_strn(curr_line, idx, text, nl - text);
+
+	const char *from = nl + 1;
+	for( size_t i = 0; i < count; ++i ) {
+		const char *to = memchr(from, '\n', text + length - from);
+		if( to == NULL ) {
+			to = text + length;
+		}
+
+		line_init_slab(&lines[i], &file->slab);
+		line_insert_strn(&lines[i], 0, from, to - from);
+		from = to + 1;
+	}
+
+	*end = lines[count - 1].length;
+	line_insert_strn(&lines[count - 1], *end, tail, tail_length);
+	free(tail);
+
+	piece_paste_lines(
+		&file->table, line + 1, piece_make_lines(&file->table, lines, count));
+	file->length = file->table.length;
+	free(lines);
+
+	_record_line(file, line, true);
+	for( size_t i = 1; i <= count; ++i ) {
+		_record_line(file, line + i, false);
+	}
+
+	return line + count;
+}
+
+/* Deletes the text from column @idx of @line up to column @end_idx of
+ * @end_line, joining the two lines
+ * The lines in between are cut out of the table at once
+ */
+void file_delete_text(
+	File *file, size_t line, size_t idx, size_t end_line, size_t end_idx) {
+	Line *curr_line = file_get_line(file, line);
+	file_mark_dirty(file);
+
+	if( end_line == line ) {
+		line_delete_str(curr_line, idx, end_idx - idx);
+		_record_line(file, line, true);
+		return;
+	}
+
+	line_delete_str(curr_line, idx, curr_line->length - idx);
+
+	const char *text, *rest;
+	size_t length, rest_length;
+	_get_line_spans(file, end_line, &text, &length, &rest, &rest_length);
+	if( end_idx < length ) {
+		line_insert_strn(curr_line, idx, text + end_idx, length - end_idx);
+		line_insert_strn(curr_line, curr_line->length, rest, rest_length);
+	} else {
+		const size_t skip = end_idx - length;
+		line_insert_strn(curr_line, idx, rest + skip, rest_length - skip);
+	}
+
+	const size_t count = end_line - line;
+	piece_free_lines(&file->table, _cut_lines(file, line + 1, count));
+
+	journal_record(&file->journal,
+		&(JournalRecord) { JOURNAL_DELETE_LINES, line + 1, count, '\0', NULL,
+			0 });
+	_record_line(file, line, true);
 }
 
 /* Adds a new empty line to the file
@@ -277,19 +534,83 @@ void file_break_line(File *file, size_t line, size_t idx) {
  */
 void file_insert_empty_line(File *file, size_t idx) {
 	Line line;
-	line_init(&line);
+	line_init_slab(&line, &file->slab);
 
 	file_insert_line(file, idx, &line);
 }
 
-/* Adds a new line to the file */
+/* Adds a new line to the file
+ * The file takes ownership of the line's text
+ */
 void file_insert_line(File *file, size_t idx, Line *line) {
-	file_shift_lines_down(file, idx);
-	line_clone(line, &file->lines[idx], false);
+	journal_record(&file->journal,
+		&(JournalRecord) { JOURNAL_INSERT_LINE, idx, 0, '\0',
+			line_get_c_str(line, false), line->length });
+
+	_insert_line(file, idx, line);
+}
+
+/* Deletes a line from the file */
+void file_delete_line(File *file, size_t idx) {
+	journal_record(&file->journal,
+		&(JournalRecord) { JOURNAL_DELETE_LINE, idx, 0, '\0', NULL, 0 });
+
+	_delete_line(file, idx);
+}
+
+/* Cuts @count lines out of the file, from line @idx on, without copying them
+ * If that leaves the file empty, an empty line is put in their place
+ * Returns the pieces holding them, to be pasted back or freed
+ */
+Piece *file_cut_lines(File *file, size_t idx, size_t count) {
+	journal_record(&file->journal,
+		&(JournalRecord) { JOURNAL_DELETE_LINES, idx, count, '\0', NULL, 0 });
+
+	Piece *pieces = _cut_lines(file, idx, count);
+	if( file->length == 0 ) {
+		file_insert_empty_line(file, 0);
+	}
+
+	return pieces;
+}
+
+/* Pastes lines cut with file_cut_lines() back in before line @idx, dropping
+ * the empty line left in their place first if @placeholder is set
+ * The file takes ownership of the pieces
+ */
+void file_paste_lines(File *file, size_t idx, Piece *pieces, bool placeholder) {
+	if( placeholder ) {
+		file_delete_line(file, 0);
+	}
 
+	piece_paste_lines(&file->table, idx, pieces);
 	file_mark_dirty(file);
 
-	++file->length;
+	const size_t count = file->table.length - file->length;
+	file->length = file->table.length;
+
+	if( !journal_is_recording(&file->journal) ) {
+		return;
+	}
+
+	/* The journal can't point at the pieces, so it gets their text */
+	PieceIter iter;
+	piece_iter_init(&iter, &file->table, idx);
+
+	Line *line;
+	const char *text;
+	size_t length;
+	for( size_t i = 0;
+		i < count && piece_iter_next(&iter, &line, &text, &length); ++i ) {
+		if( line ) {
+			text = line_get_c_str(line, false);
+			length = line->length;
+		}
+
+		journal_record(&file->journal,
+			&(JournalRecord) { JOURNAL_INSERT_LINE, idx + i, 0, '\0', text,
+				length });
+	}
 }
 
 /* Moves a line up, appending to the previous one if necessary */
@@ -298,61 +619,40 @@ size_t file_move_line_up(File *file, size_t idx) {
 		return 0;
 	}
 
-	Line *prev = file_get_line(file, idx - 1);
-	const size_t prev_length = prev->length;
+	journal_record(&file->journal,
+		&(JournalRecord) { JOURNAL_JOIN_LINE, idx, 0, '\0', NULL, 0 });
+
+	const size_t prev_length = piece_get_line_length(&file->table, idx - 1);
 
 	if( prev_length > 0 ) {
-		Line *line = file_get_line(file, idx);
-		char *text = line_get_c_str(line, false);
+		Line *prev = file_get_line(file, idx - 1);
 
-		line_insert_str(prev, prev->length, text);
-		line_free(line);
+		const char *text, *rest;
+		size_t length, rest_length;
+		_get_line_spans(file, idx, &text, &length, &rest, &rest_length);
 
-		file_shift_lines_up(file, idx + 1);
+		line_insert_strn(prev, prev->length, text, length);
+		line_insert_strn(prev, prev->length, rest, rest_length);
+		_delete_line(file, idx);
 	} else {
-		line_free(prev);
-		file_shift_lines_up(file, idx);
+		_delete_line(file, idx - 1);
 	}
 
 	return prev_length;
 }
 
-/* Shifts lines starting at @idx one row up */
+/* Shifts lines starting at @idx one row up, overwriting the line above */
 void file_shift_lines_up(File *file, size_t idx) {
-	if( file->length == 0 ) {
+	if( file->length == 0 || idx == 0 ) {
 		return;
 	}
 
-	file_mark_dirty(file);
-
-	size_t i;
-	for( i = idx; i < file->length; ++i ) {
-		file->lines[i - 1] = file->lines[i];
-	}
-
-	/* The previous line has a pointer to text so this isn't a leak */
-	line_zero(&file->lines[--file->length]);
+	file_delete_line(file, idx - 1);
 }
 
-/* Shifts lines starting at @idx one row down */
+/* Shifts lines starting at @idx one row down, leaving an empty line behind */
 void file_shift_lines_down(File *file, size_t idx) {
-	if( file->length == 0 ) {
-		return;
-	}
-
-	file_mark_dirty(file);
-
-	if( _is_line_array_full(file) ) {
-		_grow_line_array(file);
-	}
-
-	long i;
-	long s_idx = (long)idx;
-	for( i = (long)file->length - 1; i >= s_idx; --i ) {
-		file->lines[i + 1] = file->lines[i];
-	}
-
-	line_init(&file->lines[idx]);
+	file_insert_empty_line(file, idx);
 }
 
 /* Sets the extension of the file */
@@ -365,9 +665,14 @@ void file_set_config(File *file, char *key, char *value) {
 	config_set(&file->config, key, value);
 }
 
-/* Gets a config option */
+/* Gets a config option, falling back on the parent configuration */
 char *file_get_config(File *file, char *key) {
-	return config_get(&file->config, key);
+	char *value = config_get(&file->config, key);
+	if( value == NULL && file->parent ) {
+		value = config_get(file->parent, key);
+	}
+
+	return value;
 }
 
 /* Returns the line at @idx */
@@ -376,17 +681,16 @@ Line *file_get_line(File *file, size_t idx) {
 		return NULL;
 	}
 
-	return &file->lines[idx];
+	return piece_get_line(&file->table, idx);
 }
 
 /* Returns the length of line @idx */
 long file_get_line_length(File *file, size_t idx) {
-	Line *line = file_get_line(file, idx);
-	if( line ) {
-		return line->length;
+	if( idx >= file->length ) {
+		return -1;
 	}
 
-	return -1;
+	return piece_get_line_length(&file->table, idx);
 }
 
 /* Returns the name of the file */
@@ -428,51 +732,284 @@ static void _create_default_file(File *file) {
 	}
 }
 
-/* Renders the file's contents, calling @fn on each line */
-static void _render(File *file, size_t from, int gutter, void (*fn)(Line *)) {
-	const size_t maxy = getmaxy(stdscr) - 3;
+/* Maps a regular file into memory, and loads it as the original buffer
+ * Returns false if the file couldn't be mapped, so it can be read instead
+ */
+static bool _load_mapped(File *file, const char *filename) {
+#if defined(__linux__) || defined(__APPLE__)
+	int fd = open(filename, O_RDONLY);
+	if( fd < 0 ) {
+		return false;
+	}
 
-	for( size_t y = 0; y < maxy && y < file->length - from; ++y ) {
-		move(y, 0);
+	struct stat st;
+	if( fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ) {
+		close(fd);
+		return false;
+	}
 
-		const size_t offset = y + from;
-		printw("%-*zu", gutter, offset + 1);
-		fn(&file->lines[offset]);
+	const size_t size = (size_t)st.st_size;
+	char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if( data == MAP_FAILED ) {
+		return false;
 	}
+
+	/* Indexing reads the whole file front to back, editing jumps around */
+	madvise(data, size, MADV_SEQUENTIAL);
+	piece_load(&file->table, data, size, true, _get_load_threads(file));
+	madvise(data, size, MADV_NORMAL);
+
+	file->length = file->table.length;
+
+	return true;
+#else
+	(void)file;
+	(void)filename;
+
+	return false;
+#endif
 }
 
-/* Renders a single line in the file using @fn */
-static void _render_line(
-	File *file, size_t idx, size_t from, int gutter, void (*fn)(Line *)) {
-	const size_t offset = idx + from;
+/* Hashes the original buffer */
+static void *_hash_loaded(void *arg) {
+	File *file = arg;
+
+	TRACE_BEGIN(span, "hash");
+	file->loaded_hash = save_hash(
+		SAVE_FNV_OFFSET_BASIS, file->table.orig, file->table.orig_size);
+	TRACE_END_ARG(span, "bytes", file->table.orig_size);
 
-	move(idx, 0);
-	printw("%-*zu", gutter, offset + 1);
-	fn(&file->lines[offset]);
+	return NULL;
 }
 
-/* Grows the array of lines */
-static void _grow_line_array(File *file) {
-	const size_t new_capacity = (file->capacity < 4 ? 4 : file->capacity * 2);
-	_grow_line_array_to(file, new_capacity);
+/* Waits for the hasher, if there is one */
+static void _join_hash(File *file) {
+#if defined(__linux__) || defined(__APPLE__)
+	if( file->hashing ) {
+		pthread_join(file->hasher, NULL);
+		file->hashing = false;
+	}
+#else
+	UNUSED(file);
+#endif
 }
 
-/* Grows the array of lines to the given size */
-static void _grow_line_array_to(File *file, size_t new_capacity) {
-	size_t size = sizeof(*file->lines) * new_capacity;
-	Line *new_lines = realloc(file->lines, size);
-	if( !new_lines ) {
-		fprintf(stderr, "Failed to reallocate %zu bytes for file!\n", size);
-		exit(1);
+/* Returns how many threads loading may use
+ * Set with the "load_threads" option, defaulting to one per processor
+ */
+static size_t _get_load_threads(File *file) {
+	char *value = file_get_config(file, "load_threads");
+	if( value && *value ) {
+		long threads = strtol(value, NULL, 10);
+		if( threads > 0 ) {
+			return (size_t)threads;
+		}
+	}
+
+#if defined(__linux__) || defined(__APPLE__)
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? (size_t)cpus : 1;
+#else
+	return 1;
+#endif
+}
+
+/* Returns when saving should flush to disk
+ * Set with the "fsync" option to "never", "file" or "always" (the default)
+ */
+static SyncPolicy _get_sync_policy(File *file) {
+	char *value = file_get_config(file, "fsync");
+	if( value && strcmp(value, "never") == 0 ) {
+		return SYNC_NEVER;
+	}
+
+	if( value && strcmp(value, "file") == 0 ) {
+		return SYNC_FILE;
+	}
+
+	return SYNC_ALWAYS;
+}
+
+/* Marks the file dirty again if @state is a failed save
+ * Once a save is done, the journal only needs the edits made since it started
+ */
+static SaveState _check_save(File *file, SaveState state) {
+	if( state == SAVE_FAILED ) {
+		file->dirty = true;
+	} else if( state == SAVE_DONE ) {
+		journal_rebase(&file->journal, file->name);
+	}
+
+	return state;
+}
+
+/* Applies an edit replayed from the journal
+ * Returns false if it doesn't fit the file, as a corrupt record wouldn't
+ */
+static bool _apply_record(void *ctx, JournalRecord *record) {
+	File *file = ctx;
+
+	const bool in_file = record->line < file->length;
+	const long length = in_file ? file_get_line_length(file, record->line) : 0;
+	const bool in_line = in_file && record->idx <= (size_t)length;
+
+	switch( record->op ) {
+	case JOURNAL_REPLACE_CHAR:
+		if( in_line ) {
+			file_replace_char(file, record->line, record->idx, record->ch);
+		}
+
+		return in_line;
+	case JOURNAL_INSERT_CHAR:
+		if( in_line ) {
+			file_insert_char(file, record->line, record->idx, record->ch);
+		}
+
+		return in_line;
+	case JOURNAL_DELETE_CHAR:
+		if( in_line ) {
+			file_delete_char(file, record->line, record->idx);
+		}
+
+		return in_line;
+	case JOURNAL_BREAK_LINE:
+		if( in_line ) {
+			file_break_line(file, record->line, record->idx);
+		}
+
+		return in_line;
+	case JOURNAL_JOIN_LINE:
+		if( in_file ) {
+			file_move_line_up(file, record->line);
+		}
+
+		return in_file;
+	case JOURNAL_INSERT_LINE:
+		if( record->line > file->length ) {
+			return false;
+		}
+
+		_insert_string(file, record->line, record->text, record->length);
+		return true;
+	case JOURNAL_DELETE_LINE:
+		if( in_file ) {
+			file_delete_line(file, record->line);
+		}
+
+		return in_file;
+	case JOURNAL_DELETE_LINES:
+		if( !in_file || record->idx > file->length - record->line ) {
+			return false;
+		}
+
+		piece_free_lines(
+			&file->table, _cut_lines(file, record->line, record->idx));
+		return true;
 	}
 
-	file->lines = new_lines;
-	file->capacity = new_capacity;
+	return false;
+}
+
+/* Inserts a line holding @length characters of @text */
+static void _insert_string(
+	File *file, size_t idx, const char *text, size_t length) {
+	Line line;
+	line_init_slab(&line, &file->slab);
+
+	line_insert_strn(&line, 0, text, length);
+	file_insert_line(file, idx, &line);
 }
 
-/* Checks if the array of lines is full */
-static bool _is_line_array_full(File *file) {
-	return file->length >= file->capacity;
+/* Records line @idx as it is now, as a new line, or in place of what the
+ * journal has for it if @replace is set
+ */
+static void _record_line(File *file, size_t idx, bool replace) {
+	if( !journal_is_recording(&file->journal) ) {
+		return;
+	}
+
+	if( replace ) {
+		journal_record(&file->journal,
+			&(JournalRecord) { JOURNAL_DELETE_LINE, idx, 0, '\0', NULL, 0 });
+	}
+
+	Line *line = file_get_line(file, idx);
+	journal_record(&file->journal,
+		&(JournalRecord) { JOURNAL_INSERT_LINE, idx, 0, '\0',
+			line_get_c_str(line, false), line->length });
+}
+
+/* Inserts a line into the file, without recording it */
+static void _insert_line(File *file, size_t idx, Line *line) {
+	piece_insert_line(&file->table, idx, line);
+
+	file_mark_dirty(file);
+
+	file->length = file->table.length;
+}
+
+/* Deletes a line from the file, without recording it */
+static void _delete_line(File *file, size_t idx) {
+	piece_delete_line(&file->table, idx);
+
+	file_mark_dirty(file);
+
+	file->length = file->table.length;
+}
+
+/* Cuts lines out of the file, without recording it */
+static Piece *_cut_lines(File *file, size_t idx, size_t count) {
+	Piece *pieces = piece_cut_lines(&file->table, idx, count);
+
+	file_mark_dirty(file);
+
+	file->length = file->table.length;
+
+	return pieces;
+}
+
+/* Puts together row @y of the screen, showing line @offset as read from
+ * @iter, or nothing past the end of the file
+ */
+static void _render_row(
+	Screen *screen, size_t y, size_t offset, int gutter, PieceIter *iter) {
+	screen_begin_row(screen, y);
+
+	Line *line;
+	const char *text;
+	size_t length;
+	if( piece_iter_next(iter, &line, &text, &length) ) {
+		char number[32];
+		const int n = snprintf(number, sizeof(number), "%-*zu", gutter,
+			offset + 1);
+		screen_add(screen, number, MIN((size_t)n, sizeof(number) - 1));
+
+		const char *second = NULL;
+		size_t second_len = 0;
+		if( line ) {
+			line_get_spans(line, &text, &length, &second, &second_len);
+		}
+
+		screen_add(screen, text, length);
+		screen_add(screen, second, second_len);
+	}
+
+	screen_end_row(screen);
+}
+
+/* Gets the text of line @idx in two spans, without copying it */
+static void _get_line_spans(File *file, size_t idx, const char **first,
+	size_t *first_len, const char **second, size_t *second_len) {
+	Line *line = piece_peek_line(&file->table, idx, first, first_len);
+	if( line ) {
+		line_get_spans(line, first, first_len, second, second_len);
+		return;
+	}
+
+	*second = NULL;
+	*second_len = 0;
 }
 
 /* Asks the user to give a file name */
@@ -0,0 +1,505 @@
+/* edit
+ * Crash-recovery journal
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#define JOURNAL_POSIX
+#endif
+
+#include "global.h"
+
+#include "journal.h"
+
+#define JOURNAL_SUFFIX ".edit-journal"
+#define JOURNAL_RECORD_SIZE (24) /* Op, character, length, line and index */
+
+static void _append(Journal *journal, const void *data, size_t length);
+static void _encode_header(Journal *journal, char *header);
+static bool _decode_record(
+	const char *data, size_t size, JournalRecord *record, size_t *consumed);
+
+#ifdef JOURNAL_POSIX
+static char *_get_path(const char *filename);
+static void _get_base(
+	const char *filename, uint64_t *size, int64_t *mtime, uint64_t *inode);
+
+static char *_read_all(const char *path, size_t *size);
+static bool _write_all(int fd, const char *data, size_t length);
+static long long _now(void);
+#endif
+
+/* Initializes a journal that records nothing */
+void journal_init(Journal *journal) {
+	journal->path = NULL;
+	journal->fd = -1;
+
+	journal->buf = NULL;
+	journal->length = 0;
+	journal->capacity = 0;
+
+	journal->written = 0;
+	journal->mark = 0;
+	journal->pending_since = 0;
+
+	journal->base_size = 0;
+	journal->base_mtime = 0;
+	journal->base_inode = 0;
+
+	journal->recoverable = false;
+	journal->paused = false;
+}
+
+/* Frees a journal from memory
+ * Its file is deleted, since whatever it recorded was either saved or dropped
+ */
+void journal_free(Journal *journal) {
+#ifdef JOURNAL_POSIX
+	if( journal->fd >= 0 ) {
+		close(journal->fd);
+		unlink(journal->path);
+	}
+#endif
+
+	free(journal->path);
+	free(journal->buf);
+
+	journal_init(journal);
+}
+
+/* Starts journaling edits made to @filename
+ *
+ * The journal file itself is only created once there is an edit to record
+ * If one was left behind for the file as it is on disk, it is marked as
+ * recoverable
+ */
+void journal_open(Journal *journal, const char *filename) {
+#ifdef JOURNAL_POSIX
+	journal->path = _get_path(filename);
+	_get_base(filename, &journal->base_size, &journal->base_mtime,
+		&journal->base_inode);
+
+	int fd = open(journal->path, O_RDONLY);
+	if( fd < 0 ) {
+		return;
+	}
+
+	char found[JOURNAL_HEADER_SIZE + JOURNAL_RECORD_SIZE];
+	const ssize_t got = read(fd, found, sizeof(found));
+	close(fd);
+
+	/* Journals of an older version of the file don't apply to it anymore */
+	char expected[JOURNAL_HEADER_SIZE];
+	_encode_header(journal, expected);
+
+	journal->recoverable = got >= (ssize_t)sizeof(found)
+		&& memcmp(found, expected, JOURNAL_HEADER_SIZE) == 0;
+#else
+	UNUSED(journal);
+	UNUSED(filename);
+#endif
+}
+
+/* Replays the records of a recoverable journal, calling @apply on each
+ *
+ * Replaying stops at the first record that is cut short, or that @apply
+ * rejects, and the journal is trimmed to the records before it
+ * Recording then picks up where the journal left off
+ * Returns the number of records replayed
+ */
+size_t journal_replay(Journal *journal,
+	bool (*apply)(void *ctx, JournalRecord *record), void *ctx) {
+#ifdef JOURNAL_POSIX
+	if( !journal->recoverable ) {
+		return 0;
+	}
+
+	journal->recoverable = false;
+
+	size_t size;
+	char *data = _read_all(journal->path, &size);
+	if( !data ) {
+		return 0;
+	}
+
+	size_t count = 0, offset = JOURNAL_HEADER_SIZE, consumed;
+
+	JournalRecord record;
+	journal->paused = true;
+	while( _decode_record(data + offset, size - offset, &record, &consumed)
+		&& apply(ctx, &record) ) {
+		offset += consumed;
+		++count;
+	}
+	journal->paused = false;
+
+	free(data);
+
+	journal->fd = open(journal->path, O_WRONLY | O_APPEND);
+	if( journal->fd < 0 || ftruncate(journal->fd, offset) < 0 ) {
+		journal_discard(journal);
+		return count;
+	}
+
+	journal->written = offset - JOURNAL_HEADER_SIZE;
+
+	return count;
+#else
+	UNUSED(journal);
+	UNUSED(apply);
+	UNUSED(ctx);
+
+	return 0;
+#endif
+}
+
+/* Drops the journal file, along with anything it recorded */
+void journal_discard(Journal *journal) {
+#ifdef JOURNAL_POSIX
+	if( journal->fd >= 0 ) {
+		close(journal->fd);
+		journal->fd = -1;
+	}
+
+	if( journal->path ) {
+		unlink(journal->path);
+	}
+#endif
+
+	journal->recoverable = false;
+	journal->length = 0;
+	journal->written = 0;
+	journal->mark = 0;
+}
+
+/* Returns if edits are being recorded, so the text of large ones is only
+ * gathered when it will be kept
+ */
+bool journal_is_recording(Journal *journal) {
+	return journal->path && !journal->paused;
+}
+
+/* Records an edit
+ * It is only buffered, to be written out by journal_tick() or journal_flush()
+ */
+void journal_record(Journal *journal, JournalRecord *record) {
+	if( !journal_is_recording(journal) ) {
+		return;
+	}
+
+	const size_t length = record->text ? record->length : 0;
+
+	unsigned char encoded[JOURNAL_RECORD_SIZE] = { 0 };
+	const uint32_t text_length = (uint32_t)length;
+	const uint64_t line = record->line, idx = record->idx;
+
+	encoded[0] = (unsigned char)record->op;
+	encoded[1] = (unsigned char)record->ch;
+	memcpy(encoded + 4, &text_length, sizeof(text_length));
+	memcpy(encoded + 8, &line, sizeof(line));
+	memcpy(encoded + 16, &idx, sizeof(idx));
+
+#ifdef JOURNAL_POSIX
+	if( journal->length == 0 ) {
+		journal->pending_since = _now();
+	}
+#endif
+
+	_append(journal, encoded, sizeof(encoded));
+	_append(journal, record->text, length);
+
+	if( journal->length >= JOURNAL_BUFFER ) {
+		journal_flush(journal);
+	}
+}
+
+/* Returns how many milliseconds until waiting records are due to be written,
+ * or -1 if there are none
+ */
+int journal_get_timeout(Journal *journal) {
+#ifdef JOURNAL_POSIX
+	if( journal->length == 0 ) {
+		return -1;
+	}
+
+	const long long waited = _now() - journal->pending_since;
+	return waited >= JOURNAL_FLUSH_MS ? 0 : (int)(JOURNAL_FLUSH_MS - waited);
+#else
+	UNUSED(journal);
+
+	return -1;
+#endif
+}
+
+/* Writes out waiting records, if they have waited long enough */
+void journal_tick(Journal *journal) {
+	if( journal_get_timeout(journal) == 0 ) {
+		journal_flush(journal);
+	}
+}
+
+/* Writes out waiting records
+ * Records that can't be written are dropped, rather than piling up
+ */
+void journal_flush(Journal *journal) {
+#ifdef JOURNAL_POSIX
+	if( journal->length == 0 || !journal->path ) {
+		return;
+	}
+
+	if( journal->fd < 0 ) {
+		const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_APPEND;
+		journal->fd = open(journal->path, flags, 0600);
+
+		char header[JOURNAL_HEADER_SIZE];
+		_encode_header(journal, header);
+
+		if( journal->fd >= 0
+			&& !_write_all(journal->fd, header, sizeof(header)) ) {
+			close(journal->fd);
+			journal->fd = -1;
+		}
+
+		journal->written = 0;
+	}
+
+	if( journal->fd >= 0
+		&& _write_all(journal->fd, journal->buf, journal->length) ) {
+		journal->written += journal->length;
+	}
+#endif
+
+	journal->length = 0;
+}
+
+/* Marks everything recorded so far as taken into a save */
+void journal_mark(Journal *journal) {
+	journal_flush(journal);
+	journal->mark = journal->written;
+}
+
+/* Moves the journal on to @filename, as just saved
+ *
+ * Records taken into the save are dropped, while those made since it started
+ * are kept, now applying to the saved file
+ */
+void journal_rebase(Journal *journal, const char *filename) {
+#ifdef JOURNAL_POSIX
+	journal_flush(journal);
+
+	/* Keep the records made after the mark, by rewriting them */
+	size_t size = 0;
+	char *data = NULL;
+	if( journal->fd >= 0 && journal->written > journal->mark ) {
+		data = _read_all(journal->path, &size);
+	}
+
+	const size_t from = JOURNAL_HEADER_SIZE + journal->mark;
+
+	journal_discard(journal);
+	free(journal->path);
+
+	journal->path = _get_path(filename);
+	_get_base(filename, &journal->base_size, &journal->base_mtime,
+		&journal->base_inode);
+
+	if( data && size > from ) {
+		_append(journal, data + from, size - from);
+		journal_flush(journal);
+	}
+
+	free(data);
+#else
+	UNUSED(journal);
+	UNUSED(filename);
+#endif
+}
+
+/* Adds @length bytes to the records waiting to be written */
+static void _append(Journal *journal, const void *data, size_t length) {
+	if( length == 0 ) {
+		return;
+	}
+
+	if( journal->length + length > journal->capacity ) {
+		size_t capacity = MAX(journal->capacity * 2, JOURNAL_BUFFER);
+		while( capacity < journal->length + length ) {
+			capacity *= 2;
+		}
+
+		char *new_buf = realloc(journal->buf, capacity);
+		if( !new_buf ) {
+			fprintf(stderr, "Failed to reallocate %zu bytes for journal!\n",
+				capacity);
+			exit(1);
+		}
+
+		journal->buf = new_buf;
+		journal->capacity = capacity;
+	}
+
+	memcpy(journal->buf + journal->length, data, length);
+	journal->length += length;
+}
+
+/* Writes the header identifying the file the journal's records apply to */
+static void _encode_header(Journal *journal, char *header) {
+	memset(header, 0, JOURNAL_HEADER_SIZE);
+	memcpy(header, JOURNAL_MAGIC, 4);
+	memcpy(header + 8, &journal->base_size, sizeof(journal->base_size));
+	memcpy(header + 16, &journal->base_mtime, sizeof(journal->base_mtime));
+	memcpy(header + 24, &journal->base_inode, sizeof(journal->base_inode));
+}
+
+/* Reads the record at the start of @data, setting @consumed to its size
+ * Returns false if there isn't a whole, valid record there
+ */
+static bool _decode_record(
+	const char *data, size_t size, JournalRecord *record, size_t *consumed) {
+	if( size < JOURNAL_RECORD_SIZE ) {
+		return false;
+	}
+
+	uint32_t length;
+	uint64_t line, idx;
+	memcpy(&length, data + 4, sizeof(length));
+	memcpy(&line, data + 8, sizeof(line));
+	memcpy(&idx, data + 16, sizeof(idx));
+
+	if( (unsigned char)data[0] > JOURNAL_DELETE_LINES
+		|| length > size - JOURNAL_RECORD_SIZE ) {
+		return false;
+	}
+
+	record->op = (JournalOp)(unsigned char)data[0];
+	record->ch = data[1];
+	record->line = (size_t)line;
+	record->idx = (size_t)idx;
+	record->text = data + JOURNAL_RECORD_SIZE;
+	record->length = length;
+
+	*consumed = JOURNAL_RECORD_SIZE + length;
+
+	return true;
+}
+
+#ifdef JOURNAL_POSIX
+/* Returns the path to the journal of @filename, a hidden file next to it */
+static char *_get_path(const char *filename) {
+	const char *slash = strrchr(filename, '/');
+	const int dir_length = slash ? (int)(slash - filename + 1) : 0;
+
+	const size_t size = strlen(filename) + sizeof("." JOURNAL_SUFFIX);
+	char *path = malloc(size);
+	if( !path ) {
+		fprintf(
+			stderr, "Failed to allocate %zu bytes for journal path!\n", size);
+		exit(1);
+	}
+
+	snprintf(path, size, "%.*s.%s" JOURNAL_SUFFIX, dir_length, filename,
+		filename + dir_length);
+
+	return path;
+}
+
+/* Gets the size, modification time (in nanoseconds) and inode of @filename,
+ * or zeros if it's missing
+ */
+static void _get_base(
+	const char *filename, uint64_t *size, int64_t *mtime, uint64_t *inode) {
+	*size = 0;
+	*mtime = 0;
+	*inode = 0;
+
+	struct stat st;
+	if( stat(filename, &st) == 0 ) {
+#ifdef __APPLE__
+		const struct timespec *ts = &st.st_mtimespec;
+#else
+		const struct timespec *ts = &st.st_mtim;
+#endif
+		*size = (uint64_t)st.st_size;
+		*mtime = (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+		*inode = (uint64_t)st.st_ino;
+	}
+}
+
+/* Reads the whole of @path into memory, setting @size to its size */
+static char *_read_all(const char *path, size_t *size) {
+	int fd = open(path, O_RDONLY);
+	if( fd < 0 ) {
+		return NULL;
+	}
+
+	struct stat st;
+	if( fstat(fd, &st) < 0 ) {
+		close(fd);
+		return NULL;
+	}
+
+	*size = (size_t)st.st_size;
+	char *data = malloc(MAX(*size, 1));
+	if( !data ) {
+		fprintf(stderr, "Failed to allocate %zu bytes for journal!\n", *size);
+		exit(1);
+	}
+
+	size_t got = 0;
+	while( got < *size ) {
+		const ssize_t n = read(fd, data + got, *size - got);
+		if( n < 0 && errno == EINTR ) {
+			continue;
+		}
+
+		if( n <= 0 ) {
+			break;
+		}
+
+		got += (size_t)n;
+	}
+
+	close(fd);
+	*size = got;
+
+	return data;
+}
+
+/* Writes @length bytes to @fd, picking up after short writes */
+static bool _write_all(int fd, const char *data, size_t length) {
+	while( length > 0 ) {
+		const ssize_t n = write(fd, data, length);
+		if( n < 0 ) {
+			if( errno == EINTR ) {
+				continue;
+			}
+
+			return false;
+		}
+
+		data += n;
+		length -= (size_t)n;
+	}
+
+	return true;
+}
+
+/* Returns a monotonic clock reading, in milliseconds */
+static long long _now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+#endif
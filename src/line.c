@@ -6,82 +6,102 @@
 #include <stdlib.h>
 #include <string.h>
 
-#ifdef USE_PDCURSES
-#include <curses.h>
-#else
-#include <ncurses.h>
-#endif
-
 #include "global.h"
 
+#include "slab.h"
 #include "line.h"
+#include "term.h"
+
+static char *_open(Line *line, size_t idx, size_t by);
+static void _close(Line *line, size_t idx, size_t by);
+
+static void _make_big(Line *line, size_t capacity);
+static void _make_small(Line *line);
 
-static void _grow_string(Line *line);
+static void _move_gap(Line *line, size_t idx);
+static void _grow_gap(Line *line, size_t by);
 static void _grow_string_to(Line *line, size_t new_capacity);
+static size_t _capacity(Line *line);
+static void _set_capacity(Line *line, size_t capacity);
 
-static bool _is_string_full(Line *line);
+static char *_alloc_text(Slab *slab, size_t size);
+static void _release_text(Line *line);
+
+static size_t _gap_length(Line *line);
+static char *_after_gap(Line *line);
 
 static size_t _next_power_of_two(size_t n);
 
 /* Creates a new empty line */
 void line_init(Line *line) {
-	size_t size = sizeof(*line->text) * 8;
-	line->text = malloc(size);
-	if( !line->text ) {
-		fprintf(
-			stderr, "Failed to allocate %zu bytes for text buffer!\n", size);
-		exit(1);
-	}
+	line_init_slab(line, NULL);
+}
 
-	line->capacity = 8;
+/* Creates a new empty line, with its text allocated from @slab once it's too
+ * long to be stored inline
+ * If @slab is NULL, the text is allocated on the heap instead
+ */
+void line_init_slab(Line *line, Slab *slab) {
+	memset(line->as.small, '\0', LINE_SMALL_SIZE);
 	line->length = 0;
-	memset(line->text, '\0', sizeof(*line->text) * line->capacity);
 
-	line->color.data = NULL;
-	line->color.capacity = 0;
-	line->color.size = 0;
+	line->slab = slab;
+	line->color = NULL;
 }
 
 /* Frees the line from memory */
 void line_free(Line *line) {
-	free(line->text);
-	line->text = NULL;
-	line->length = 0;
-	line->capacity = 0;
+	if( !line_is_small(line) ) {
+		_release_text(line);
+	}
+
+	free(line->color);
+	line->color = NULL;
+
+	line_zero(line);
 }
 
-/* Zeroes out the line's contents */
+/* Zeroes out the line's contents
+ * Leaves whatever text it pointed to alone
+ */
 void line_zero(Line *line) {
-	line->text = NULL;
 	line->length = 0;
-	line->capacity = 0;
+	line->as.small[0] = '\0';
+	line->as.small[LINE_SMALL_SIZE - 1] = '\0';
 }
 
 /* Erases a line's contents
- * Will resize its buffer
+ * Will free its buffer, if it had one
  */
 void line_erase(Line *line) {
-	memset(line->text, 0, line->capacity);
-
-	line->capacity = 8;
-	line->length = 0;
-	line->text = realloc(line->text, line->capacity);
-	if( line->text == NULL ) {
-		fprintf(stderr, "Failed to reallocate %zu bytes text buffer!\n",
-			line->capacity);
-		exit(1);
+	if( !line_is_small(line) ) {
+		_release_text(line);
 	}
+
+	line_zero(line);
 }
 
-/* Renders the line's contents */
+/* Renders the line's contents
+ * Long lines are drawn in two spans, around the gap
+ */
 void line_render(Line *line) {
-	clrtoeol();
-	addnstr(line->text, line->length);
+	const char *first, *second;
+	size_t first_len, second_len;
+	line_get_spans(line, &first, &first_len, &second, &second_len);
+
+	line_render_str(first, first_len);
+	term_put(second, second_len);
+}
+
+/* Renders @length characters of @text as a line */
+void line_render_str(const char *text, size_t length) {
+	term_clear_to_eol();
+	term_put(text, length);
 }
 
 /* Renders the line's contents with color */
 void line_render_color(Line *line) {
-	clrtoeol();
+	term_clear_to_eol();
 	UNUSED(line);
 }
 
@@ -97,8 +117,16 @@ char line_replace_char(Line *line, size_t idx, char ch) {
 		return '\0';
 	}
 
-	char prev = line->text[idx];
-	line->text[idx] = ch;
+	char *c = line->as.small;
+	if( !line_is_small(line) ) {
+		c = line->as.big.text;
+		if( idx >= line->as.big.gap ) {
+			c += _gap_length(line);
+		}
+	}
+
+	char prev = c[idx];
+	c[idx] = ch;
 	return prev;
 }
 
@@ -114,16 +142,7 @@ char line_delete_char_at_end(Line *line) {
 
 /* Inserts the character @ch into column @idx */
 void line_insert_char(Line *line, size_t idx, char ch) {
-	if( idx < line->length ) {
-		line_shift_chars_forwards(line, idx, 1);
-	} else if( _is_string_full(line) ) {
-		_grow_string(line);
-		++line->length;
-	} else {
-		++line->length;
-	}
-
-	line->text[idx] = ch;
+	*_open(line, idx, 1) = ch;
 }
 
 /* Deletes the character at column @idx */
@@ -132,8 +151,15 @@ char line_delete_char(Line *line, size_t idx) {
 		return '\0';
 	}
 
-	char prev = line->text[idx - 1];
-	line_shift_chars_backwards(line, idx, 1);
+	char prev;
+	if( line_is_small(line) ) {
+		prev = line->as.small[idx - 1];
+	} else {
+		_move_gap(line, idx);
+		prev = line->as.big.text[idx - 1];
+	}
+
+	_close(line, idx - 1, 1);
 	return prev;
 }
 
@@ -144,8 +170,21 @@ void line_insert_str(Line *line, size_t idx, char *str) {
 		str[--len] = '\0';
 	}
 
-	line_shift_chars_forwards(line, idx, len);
-	memcpy(line->text + idx, str, len);
+	line_insert_strn(line, idx, str, len);
+}
+
+/* Inserts the first @len characters of @str into the line at index @idx */
+void line_insert_strn(Line *line, size_t idx, const char *str, size_t len) {
+	if( len == 0 ) {
+		return;
+	}
+
+	memcpy(_open(line, idx, len), str, len);
+}
+
+/* Deletes @len characters starting at column @idx inclusive */
+void line_delete_str(Line *line, size_t idx, size_t len) {
+	_close(line, idx, len);
 }
 
 /* Copies @len characters starting at column @idx inclusive into a new buffer
@@ -160,84 +199,87 @@ char *line_copy(Line *line, size_t idx, long len, bool kill) {
 		u_len = (size_t)len;
 	}
 
+	const char *from = line->as.small + idx;
+	if( !line_is_small(line) ) {
+		/* With the gap right before it, the range is contiguous */
+		_move_gap(line, idx);
+		from = _after_gap(line);
+	}
+
 	char *buf = malloc(u_len + 1);
-	memcpy(buf, line->text + idx, u_len);
+	memcpy(buf, from, u_len);
 	buf[u_len] = '\0';
 
 	if( kill ) {
-		line_shift_chars_backwards(line, idx + u_len, u_len);
+		line_delete_str(line, idx, u_len);
 	}
 
 	return buf;
 }
 
-/* Moves characters forwards by a given amount @by
- * Grows the lines array as needed
+/* Opens @by spaces at column @idx, moving the characters after it forwards
+ * Grows the text buffer as needed
  */
 void line_shift_chars_forwards(Line *line, size_t idx, size_t by) {
-	size_t total = line->length + by;
-	if( total >= line->capacity ) {
-		total = total < 8 ? 8 : _next_power_of_two(total);
-		_grow_string_to(line, total);
-	}
-
-	long s_idx = (long)idx;
-	for( long i = (long)line->length; i >= s_idx; --i ) {
-		line->text[i + by] = line->text[i];
-		line->text[i] = ' ';
-	}
-
-	line->length += by;
+	memset(_open(line, idx, by), ' ', by);
 }
 
-/* Moves characters back by a given amount @by
+/* Moves characters starting at @idx back by a given amount @by, overwriting
+ * the characters before them
  * Assumes that the text will not underrun the buffer
  */
 void line_shift_chars_backwards(Line *line, size_t idx, size_t by) {
-	size_t i = idx;
-	do {
-		line->text[i - by] = line->text[i];
-		line->text[i] = '\0';
-	} while( ++i < line->length );
-
-	line->length -= by;
-	if( line->length < (line->capacity >> 2) ) {
-		_grow_string_to(line, line->capacity >> 2);
-	}
+	_close(line, idx - by, by);
 }
 
 /* Copies the contents of line @from into @to
  * If @deep is false, the two lines will share a text pointer
  * Otherwise, the text will be copied into a new buffer
+ * Short lines are always copied, since they have no buffer to share
  */
 void line_clone(Line *from, Line *to, bool deep) {
-	to->length = from->length;
-	to->capacity = from->capacity;
+	*to = *from;
+	to->color = NULL;
 
-	if( !deep ) {
-		to->text = from->text;
-	} else {
-		to->text = malloc(to->capacity);
-		if( !to->text ) {
-			fprintf(stderr,
-				"Failed to allocate %zu byte buffer for line clone!\n",
-				to->capacity);
-			exit(1);
-		}
+	if( deep && !line_is_small(from) ) {
+		const size_t capacity = _capacity(from);
+		to->as.big.text = _alloc_text(to->slab, capacity);
+		memcpy(to->as.big.text, from->as.big.text, capacity);
+	}
+}
+
+/* Moves the line's text into @slab, if it isn't there already */
+void line_set_slab(Line *line, Slab *slab) {
+	if( line->slab == slab ) {
+		return;
+	}
 
-		strncpy(to->text, from->text, to->capacity);
+	if( !line_is_small(line) ) {
+		const size_t capacity = _capacity(line);
+
+		char *text = _alloc_text(slab, capacity);
+		memcpy(text, line->as.big.text, capacity);
+
+		_release_text(line);
+		line->as.big.text = text;
 	}
+
+	line->slab = slab;
 }
 
 /* Adds a NUL character after the last character
- * May cause a reallocation
+ * Moves the gap to the end of the line, and may cause a reallocation
  */
 void line_null_terminate(Line *line) {
-	if( _is_string_full(line) ) {
-		_grow_string(line);
+	if( line_is_small(line) ) {
+		line->as.small[line->length] = '\0';
+		return;
 	}
 
-	line->text[line->length + 1] = '\0';
+	_move_gap(line, line->length);
+	_grow_gap(line, 1);
+
+	line->as.big.text[line->length] = '\0';
 }
 
 /* Returns the line text, ensuring it is NUL-terminated */
@@ -247,8 +289,13 @@ char *line_get_c_str(Line *line, bool clone) {
 	}
 
 	if( clone ) {
+		const char *first, *second;
+		size_t first_len, second_len;
+		line_get_spans(line, &first, &first_len, &second, &second_len);
+
 		char *c_str = malloc(line->length + 1);
-		strncpy(c_str, line->text, line->length);
+		memcpy(c_str, first, first_len);
+		memcpy(c_str + first_len, second, second_len);
 
 		c_str[line->length] = '\0';
 
@@ -256,31 +303,219 @@ char *line_get_c_str(Line *line, bool clone) {
 	}
 
 	line_null_terminate(line);
-	return line->text;
+	return line_is_small(line) ? line->as.small : line->as.big.text;
+}
+
+/* Returns whether the line's text is stored inline */
+bool line_is_small(Line *line) {
+	return line->as.big.order == 0;
+}
+
+/* Returns the text before (@first) and after (@second) the gap, without
+ * moving it
+ * Short lines have no gap, and are returned whole in @first
+ */
+void line_get_spans(Line *line, const char **first, size_t *first_len,
+	const char **second, size_t *second_len) {
+	if( line_is_small(line) ) {
+		*first = line->as.small;
+		*first_len = line->length;
+
+		*second = line->as.small + line->length;
+		*second_len = 0;
+		return;
+	}
+
+	*first = line->as.big.text;
+	*first_len = line->as.big.gap;
+
+	*second = _after_gap(line);
+	*second_len = line->length - line->as.big.gap;
 }
 
-/* Grows the string size */
-static void _grow_string(Line *line) {
-	const size_t new_capacity = (line->capacity < 8 ? 8 : line->capacity * 2);
-	_grow_string_to(line, new_capacity);
+/* Makes room for @by characters at column @idx, returning a pointer to it
+ * The line moves out of its inline buffer if it grows too long for it
+ */
+static char *_open(Line *line, size_t idx, size_t by) {
+	const size_t new_length = line->length + by;
+
+	if( line_is_small(line) ) {
+		if( new_length < LINE_SMALL_SIZE - 1 ) {
+			char *small = line->as.small;
+			memmove(small + idx + by, small + idx, line->length - idx);
+
+			line->length = new_length;
+			return small + idx;
+		}
+
+		_make_big(line, _next_power_of_two(new_length + 1));
+	}
+
+	_move_gap(line, idx);
+	_grow_gap(line, by);
+
+	char *at = line->as.big.text + line->as.big.gap;
+	line->as.big.gap += by;
+	line->length = new_length;
+
+	return at;
+}
+
+/* Removes @by characters starting at column @idx
+ * The line moves back into its inline buffer once shorter than
+ * LINE_SHRINK_SIZE
+ */
+static void _close(Line *line, size_t idx, size_t by) {
+	if( line_is_small(line) ) {
+		char *small = line->as.small;
+		memmove(small + idx, small + idx + by, line->length - idx - by);
+
+		line->length -= by;
+		return;
+	}
+
+	_move_gap(line, idx);
+	line->length -= by;
+
+	if( line->length < LINE_SHRINK_SIZE ) {
+		_make_small(line);
+	}
+}
+
+/* Moves a short line's text into a buffer of @capacity characters */
+static void _make_big(Line *line, size_t capacity) {
+	char small[LINE_SMALL_SIZE];
+	memcpy(small, line->as.small, line->length);
+
+	char *text = _alloc_text(line->slab, capacity);
+	memcpy(text, small, line->length);
+
+	line->as.big.text = text;
+	line->as.big.gap = line->length;
+	_set_capacity(line, capacity);
+}
+
+/* Moves a line's text back into its inline buffer, freeing its buffer
+ * Lines too long to fit are left where they are
+ */
+static void _make_small(Line *line) {
+	if( line->length >= LINE_SMALL_SIZE - 1 ) {
+		return;
+	}
+
+	char small[LINE_SMALL_SIZE];
+
+	const size_t first_len = line->as.big.gap;
+	memcpy(small, line->as.big.text, first_len);
+	memcpy(small + first_len, _after_gap(line), line->length - first_len);
+
+	_release_text(line);
+	memcpy(line->as.small, small, line->length);
+	line->as.small[LINE_SMALL_SIZE - 1] = '\0';
+}
+
+/* Moves the gap so that it starts at column @idx
+ * Only the characters between the old and new positions are moved
+ */
+static void _move_gap(Line *line, size_t idx) {
+	char *text = line->as.big.text;
+	const size_t gap = line->as.big.gap;
+	const size_t gap_length = _gap_length(line);
+
+	if( idx < gap ) {
+		memmove(text + idx + gap_length, text + idx, gap - idx);
+	} else if( idx > gap ) {
+		memmove(text + gap, text + gap + gap_length, idx - gap);
+	}
+
+	line->as.big.gap = idx;
+}
+
+/* Ensures the gap has room for at least @by characters
+ * The buffer grows to the next power of two, and the text after the gap is
+ * moved to the end of it
+ */
+static void _grow_gap(Line *line, size_t by) {
+	if( _gap_length(line) >= by ) {
+		return;
+	}
+
+	const size_t old_capacity = _capacity(line);
+	const size_t after = line->length - line->as.big.gap;
+
+	_grow_string_to(line, _next_power_of_two(line->length + by + 1));
+
+	char *text = line->as.big.text;
+	memmove(text + _capacity(line) - after, text + old_capacity - after,
+		after);
 }
 
 /* Grows the string size to the given size */
 static void _grow_string_to(Line *line, size_t new_capacity) {
-	size_t size = sizeof(*line->text) * new_capacity;
-	line->text = realloc(line->text, size);
-	if( !line->text ) {
+	size_t size = sizeof(*line->as.big.text) * new_capacity;
+	char *text = line->as.big.text;
+	if( line->slab ) {
+		text = slab_realloc(line->slab, text, _capacity(line), size);
+	} else {
+		text = realloc(text, size);
+	}
+
+	if( !text ) {
 		fprintf(
 			stderr, "Failed to reallocate %zu bytes for text buffer!\n", size);
 		exit(1);
 	}
 
-	line->capacity = new_capacity;
+	line->as.big.text = text;
+	_set_capacity(line, new_capacity);
+}
+
+/* Allocates a text buffer from @slab, or from the heap if it's NULL */
+static char *_alloc_text(Slab *slab, size_t size) {
+	char *text = (slab ? slab_alloc(slab, size) : malloc(size));
+	if( !text ) {
+		fprintf(
+			stderr, "Failed to allocate %zu bytes for text buffer!\n", size);
+		exit(1);
+	}
+
+	return text;
+}
+
+/* Frees the buffer of a long line */
+static void _release_text(Line *line) {
+	if( line->slab ) {
+		slab_release(line->slab, line->as.big.text, _capacity(line));
+	} else {
+		free(line->as.big.text);
+	}
+}
+
+/* Returns the capacity of a long line's buffer */
+static size_t _capacity(Line *line) {
+	return (size_t)1 << line->as.big.order;
+}
+
+/* Sets the capacity of a long line's buffer, which is a power of two
+ * This also marks the line as long, as the order is never zero
+ */
+static void _set_capacity(Line *line, size_t capacity) {
+	unsigned char order = 0;
+	while( ((size_t)1 << order) < capacity ) {
+		++order;
+	}
+
+	line->as.big.order = order;
+}
+
+/* Returns the size of the gap */
+static size_t _gap_length(Line *line) {
+	return _capacity(line) - line->length;
 }
 
-/* Checks if the string is at capacity */
-static bool _is_string_full(Line *line) {
-	return line->length >= line->capacity - 1;
+/* Returns a pointer to the first character after the gap */
+static char *_after_gap(Line *line) {
+	return line->as.big.text + line->as.big.gap + _gap_length(line);
 }
 
 /* Returns the next power of two after @n
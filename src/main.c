@@ -9,35 +9,48 @@
 #include <stdio.h>
 #endif
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
-#ifdef USE_PDCURSES
-#include <curses.h>
-#else
-#include <ncurses.h>
-#endif
-
 #include "global.h"
 
+#include "term.h"
+#include "trace.h"
 #include "edit.h"
 
 static Edit edit;
+static Term term;
 
 static bool _register_signal_handlers(void);
 
-static void _init_ncurses(void);
 static void _cleanup(void);
 
 int main(int argc, char *argv[]) {
 	char *initial = NULL;
-	if( argc > 1 ) {
-		initial = argv[1];
+	char *trace = NULL;
+	for( int i = 1; i < argc; ++i ) {
+		if( strcmp(argv[i], "--trace") == 0 && i + 1 < argc ) {
+			trace = argv[++i];
+		} else {
+			initial = argv[i];
+		}
 	}
 
-	_init_ncurses();
+	/* Before the terminal is taken over, so a failure can be seen */
+	if( trace && !trace_start(trace) ) {
+		fprintf(stderr, "Failed to trace to '%s': %s\n", trace,
+			strerror(errno));
+		return 1;
+	}
+
+	srand(time(NULL));
+
+	term_init_curses(&term);
+	term_use(&term);
 
 	if( !_register_signal_handlers() ) {
 		return 1;
@@ -92,40 +105,9 @@ static bool _register_signal_handlers(void) {
 #endif
 }
 
-/* Initializes ncurses */
-static void _init_ncurses(void) {
-	srand(time(NULL));
-
-	initscr();
-
-	/* Set up ncurses to:
-	 * 1. Immediately return characters without waiting for a newline
-	 * 2. Not echo characters to the screen
-	 * 3. Read keypad input
-	 */
-	cbreak();
-	noecho();
-	keypad(stdscr, true);
-
-	curs_set(1);
-
-	/* Initializes color pairs */
-	if( has_colors() ) {
-		start_color();
-		init_pair(COLP_RED, COLOR_RED, COLOR_BLACK);
-		init_pair(COLP_GREEN, COLOR_GREEN, COLOR_BLACK);
-		init_pair(COLP_YELLOW, COLOR_YELLOW, COLOR_BLACK);
-		init_pair(COLP_BLUE, COLOR_BLUE, COLOR_BLACK);
-		init_pair(COLP_MAGENTA, COLOR_MAGENTA, COLOR_BLACK);
-		init_pair(COLP_CYAN, COLOR_CYAN, COLOR_BLACK);
-		init_pair(COLP_BLACK, COLOR_BLACK, COLOR_WHITE);
-	}
-
-	refresh();
-}
-
 /* Cleans up the program */
 static void _cleanup(void) {
 	edit_quit(&edit);
-	endwin();
+	trace_stop();
+	term_free(&term);
 }
@@ -0,0 +1,603 @@
+/* edit
+ * Piece table of lines
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif
+
+#include "line.h"
+#include "scan.h"
+
+#include "piece.h"
+
+static Piece *_new_piece(
+	PieceTable *table, PieceBuffer buf, size_t start, size_t length);
+static void _free_piece(PieceTable *table, Piece *piece);
+static void _free_pieces(PieceTable *table, Piece *piece);
+static void _free_added(PieceTable *table, Piece *piece);
+
+static Piece *_find_piece(Piece *piece, size_t idx, size_t *offset);
+
+static void _split(
+	PieceTable *table, Piece *piece, size_t at, Piece **l, Piece **r);
+static Piece *_merge(Piece *l, Piece *r);
+
+static bool _extend_last(Piece *piece, size_t add_idx);
+
+static size_t _count_lines(Piece *piece);
+static void _update(Piece *piece);
+
+static void _free_orig(PieceTable *table);
+static const char *_get_orig_line(PieceTable *table, size_t idx, size_t *len);
+
+static void _advance(PieceIter *iter, size_t count);
+
+static Line *_get_add_line(PieceTable *table, size_t idx);
+static size_t _append_line(PieceTable *table, Line *line);
+
+/* Initializes an empty piece table, with added lines allocated from @slab */
+void piece_init(PieceTable *table, Slab *slab) {
+	table->slab = slab;
+
+	table->orig = NULL;
+	table->orig_mapped = false;
+	table->orig_size = 0;
+	table->orig_lines = NULL;
+	table->orig_length = 0;
+
+	table->crlf = false;
+	table->nul = false;
+
+	table->add = NULL;
+	table->add_length = 0;
+	table->add_chunks = 0;
+
+	table->root = NULL;
+	table->piece_count = 0;
+
+	table->length = 0;
+}
+
+/* Frees a piece table and both of its buffers from memory
+ * The text of added lines belongs to the slab, and is released along with it
+ */
+void piece_free(PieceTable *table) {
+	_free_orig(table);
+	free(table->orig_lines);
+
+	for( size_t i = 0; i < table->add_chunks; ++i ) {
+		free(table->add[i]);
+	}
+
+	free(table->add);
+	_free_pieces(table, table->root);
+
+	piece_init(table, table->slab);
+}
+
+/* Loads @data as the original buffer of an empty table, indexing it with up to
+ * @threads threads
+ *
+ * The table takes ownership of @data, which is unmapped rather than freed if
+ * @mapped is set
+ */
+void piece_load(
+	PieceTable *table, char *data, size_t size, bool mapped, size_t threads) {
+	ScanIndex index;
+	scan_index_parallel(&index, data, size, threads);
+
+	const size_t count = index.length;
+
+	table->orig = data;
+	table->orig_mapped = mapped;
+	table->orig_size = size;
+	table->orig_lines = index.lines;
+	table->orig_length = count;
+
+	table->crlf = index.crlf;
+	table->nul = index.nul;
+
+	if( count > 0 ) {
+		table->root = _new_piece(table, PIECE_ORIG, 0, count);
+	}
+
+	table->length = count;
+}
+
+/* Returns the line at @idx, ready for editing
+ * Lines from the original buffer are first copied into the add buffer
+ */
+Line *piece_get_line(PieceTable *table, size_t idx) {
+	if( idx >= table->length ) {
+		return NULL;
+	}
+
+	size_t offset;
+	Piece *piece = _find_piece(table->root, idx, &offset);
+
+	if( piece->buf == PIECE_ADD ) {
+		return _get_add_line(table, piece->start + offset);
+	}
+
+	size_t len;
+	const char *text = _get_orig_line(table, piece->start + offset, &len);
+
+	Line line;
+	line_init_slab(&line, table->slab);
+	line_insert_strn(&line, 0, text, len);
+
+	/* Isolate the line into its own piece and point it to the add buffer */
+	Piece *l, *m, *r;
+	_split(table, table->root, idx, &l, &r);
+	_split(table, r, 1, &m, &r);
+
+	m->buf = PIECE_ADD;
+	m->start = _append_line(table, &line);
+
+	if( _extend_last(l, m->start) ) {
+		_free_piece(table, m);
+		m = NULL;
+	}
+
+	table->root = _merge(_merge(l, m), r);
+
+	return _get_add_line(table, table->add_length - 1);
+}
+
+/* Returns the length of line @idx without copying it */
+size_t piece_get_line_length(PieceTable *table, size_t idx) {
+	const char *text;
+	size_t length;
+
+	Line *line = piece_peek_line(table, idx, &text, &length);
+	return line ? line->length : length;
+}
+
+/* Looks at line @idx without copying it
+ *
+ * If the line is in the add buffer, returns it
+ * Otherwise, returns NULL and points @text and @length to the original buffer
+ */
+Line *piece_peek_line(
+	PieceTable *table, size_t idx, const char **text, size_t *length) {
+	size_t offset;
+	Piece *piece = _find_piece(table->root, idx, &offset);
+
+	if( piece->buf == PIECE_ADD ) {
+		return _get_add_line(table, piece->start + offset);
+	}
+
+	*text = _get_orig_line(table, piece->start + offset, length);
+	return NULL;
+}
+
+/* Inserts @line before line @idx
+ * The table takes ownership of the line's text
+ */
+void piece_insert_line(PieceTable *table, size_t idx, Line *line) {
+	size_t at = _append_line(table, line);
+
+	Piece *l, *r;
+	_split(table, table->root, idx, &l, &r);
+
+	if( !_extend_last(l, at) ) {
+		l = _merge(l, _new_piece(table, PIECE_ADD, at, 1));
+	}
+
+	table->root = _merge(l, r);
+	++table->length;
+}
+
+/* Deletes line @idx, freeing it if it lives in the add buffer */
+void piece_delete_line(PieceTable *table, size_t idx) {
+	if( idx >= table->length ) {
+		return;
+	}
+
+	Piece *l, *m, *r;
+	_split(table, table->root, idx, &l, &r);
+	_split(table, r, 1, &m, &r);
+
+	if( m->buf == PIECE_ADD ) {
+		line_free(_get_add_line(table, m->start));
+	}
+
+	_free_piece(table, m);
+
+	table->root = _merge(l, r);
+	--table->length;
+}
+
+/* Cuts @count lines out of the table, from line @idx on, without copying
+ * them
+ *
+ * Returns the pieces holding them, which keep owning any added lines, and must
+ * either be pasted back or freed with piece_free_lines()
+ */
+Piece *piece_cut_lines(PieceTable *table, size_t idx, size_t count) {
+	if( idx >= table->length || count == 0 ) {
+		return NULL;
+	}
+
+	if( count > table->length - idx ) {
+		count = table->length - idx;
+	}
+
+	Piece *l, *m, *r;
+	_split(table, table->root, idx, &l, &r);
+	_split(table, r, count, &m, &r);
+
+	table->root = _merge(l, r);
+	table->length -= count;
+
+	return m;
+}
+
+/* Pastes pieces cut with piece_cut_lines() back in before line @idx
+ * The table takes them over again
+ */
+void piece_paste_lines(PieceTable *table, size_t idx, Piece *pieces) {
+	if( pieces == NULL ) {
+		return;
+	}
+
+	/* Merging changes the line counts, so take it beforehand */
+	const size_t count = pieces->lines;
+
+	Piece *l, *r;
+	_split(table, table->root, idx, &l, &r);
+
+	table->root = _merge(_merge(l, pieces), r);
+	table->length += count;
+}
+
+/* Frees pieces cut with piece_cut_lines(), along with the added lines they
+ * own
+ */
+void piece_free_lines(PieceTable *table, Piece *pieces) {
+	_free_added(table, pieces);
+	_free_pieces(table, pieces);
+}
+
+/* Moves @count lines into the add buffer, outside of the document
+ * Returns them as pieces to be pasted with piece_paste_lines(), or NULL if
+ * there are none
+ */
+Piece *piece_make_lines(PieceTable *table, Line *lines, size_t count) {
+	if( count == 0 ) {
+		return NULL;
+	}
+
+	const size_t start = _append_line(table, &lines[0]);
+	for( size_t i = 1; i < count; ++i ) {
+		_append_line(table, &lines[i]);
+	}
+
+	return _new_piece(table, PIECE_ADD, start, count);
+}
+
+/* Starts iterating over the lines of @table from line @from */
+void piece_iter_init(PieceIter *iter, PieceTable *table, size_t from) {
+	iter->table = table;
+	iter->root = table->root;
+	iter->line = from;
+	iter->offset = 0;
+	iter->piece = NULL;
+
+	if( from < table->length ) {
+		iter->piece = _find_piece(table->root, from, &iter->offset);
+	}
+}
+
+/* Starts iterating over the lines of @pieces, as cut out of @table */
+void piece_iter_init_cut(PieceIter *iter, PieceTable *table, Piece *pieces) {
+	iter->table = table;
+	iter->root = pieces;
+	iter->line = 0;
+	iter->offset = 0;
+	iter->piece = NULL;
+
+	if( pieces ) {
+		iter->piece = _find_piece(pieces, 0, &iter->offset);
+	}
+}
+
+/* Advances the iterator
+ *
+ * Sets @line if the line is in the add buffer, or @text and @length otherwise
+ * Returns false after the last line
+ */
+bool piece_iter_next(
+	PieceIter *iter, Line **line, const char **text, size_t *length) {
+	PieceTable *table = iter->table;
+	Piece *piece = iter->piece;
+	if( piece == NULL ) {
+		return false;
+	}
+
+	size_t idx = piece->start + iter->offset;
+	if( piece->buf == PIECE_ADD ) {
+		*line = _get_add_line(table, idx);
+	} else {
+		*line = NULL;
+		*text = _get_orig_line(table, idx, length);
+	}
+
+	_advance(iter, 1);
+	return true;
+}
+
+/* Advances the iterator, taking the rest of a piece at once if it's original
+ *
+ * Original lines come out as a single span of @text, with their line endings
+ * still in between (but not after the last one). Added lines come out one at
+ * a time, as with piece_iter_next()
+ * Returns the number of lines advanced over, or 0 after the last line
+ */
+size_t piece_iter_next_run(
+	PieceIter *iter, Line **line, const char **text, size_t *length) {
+	PieceTable *table = iter->table;
+	Piece *piece = iter->piece;
+	if( piece == NULL ) {
+		return 0;
+	}
+
+	if( piece->buf == PIECE_ADD ) {
+		return piece_iter_next(iter, line, text, length);
+	}
+
+	const size_t first = piece->start + iter->offset;
+	const size_t count = piece->length - iter->offset;
+	const size_t start = table->orig_lines[first];
+
+	*line = NULL;
+	*text = table->orig + start;
+	*length = table->orig_lines[first + count] - start - (table->crlf ? 2 : 1);
+
+	_advance(iter, count);
+	return count;
+}
+
+/* Creates a new piece */
+static Piece *_new_piece(
+	PieceTable *table, PieceBuffer buf, size_t start, size_t length) {
+	Piece *piece = malloc(sizeof(*piece));
+	if( !piece ) {
+		fprintf(stderr, "Failed to allocate piece!\n");
+		exit(1);
+	}
+
+	piece->left = NULL;
+	piece->right = NULL;
+	piece->priority = (unsigned)rand();
+	piece->lines = length;
+
+	piece->buf = buf;
+	piece->start = start;
+	piece->length = length;
+
+	++table->piece_count;
+
+	return piece;
+}
+
+/* Frees a single piece */
+static void _free_piece(PieceTable *table, Piece *piece) {
+	free(piece);
+	--table->piece_count;
+}
+
+/* Frees a piece and all of its children */
+static void _free_pieces(PieceTable *table, Piece *piece) {
+	if( piece == NULL ) {
+		return;
+	}
+
+	_free_pieces(table, piece->left);
+	_free_pieces(table, piece->right);
+	_free_piece(table, piece);
+}
+
+/* Frees the added lines that a piece and all of its children point to */
+static void _free_added(PieceTable *table, Piece *piece) {
+	if( piece == NULL ) {
+		return;
+	}
+
+	_free_added(table, piece->left);
+	_free_added(table, piece->right);
+
+	if( piece->buf == PIECE_ADD ) {
+		for( size_t i = 0; i < piece->length; ++i ) {
+			line_free(_get_add_line(table, piece->start + i));
+		}
+	}
+}
+
+/* Returns the piece holding line @idx, setting @offset to the line within it */
+static Piece *_find_piece(Piece *piece, size_t idx, size_t *offset) {
+	while( piece ) {
+		const size_t left = _count_lines(piece->left);
+		if( idx < left ) {
+			piece = piece->left;
+		} else if( idx < left + piece->length ) {
+			*offset = idx - left;
+			return piece;
+		} else {
+			idx -= left + piece->length;
+			piece = piece->right;
+		}
+	}
+
+	return NULL;
+}
+
+/* Splits the tree at @piece into the first @at lines (@l) and the rest (@r)
+ * A piece straddling the split point is cut in two
+ */
+static void _split(
+	PieceTable *table, Piece *piece, size_t at, Piece **l, Piece **r) {
+	if( piece == NULL ) {
+		*l = NULL;
+		*r = NULL;
+		return;
+	}
+
+	const size_t left = _count_lines(piece->left);
+	if( at <= left ) {
+		_split(table, piece->left, at, l, &piece->left);
+		_update(piece);
+		*r = piece;
+		return;
+	}
+
+	if( at >= left + piece->length ) {
+		_split(table, piece->right, at - left - piece->length, &piece->right, r);
+		_update(piece);
+		*l = piece;
+		return;
+	}
+
+	/* The tail gets a priority of its own, and is merged in with the rest, so
+	 * pieces cut from the same run don't pile up into a list
+	 */
+	const size_t offset = at - left;
+	Piece *tail = _new_piece(table, piece->buf, piece->start + offset,
+		piece->length - offset);
+	Piece *right = piece->right;
+
+	piece->length = offset;
+	piece->right = NULL;
+	_update(piece);
+
+	*l = piece;
+	*r = _merge(tail, right);
+}
+
+/* Merges two trees, with every line of @l coming before @r */
+static Piece *_merge(Piece *l, Piece *r) {
+	if( l == NULL ) {
+		return r;
+	}
+
+	if( r == NULL ) {
+		return l;
+	}
+
+	if( l->priority >= r->priority ) {
+		l->right = _merge(l->right, r);
+		_update(l);
+		return l;
+	}
+
+	r->left = _merge(l, r->left);
+	_update(r);
+	return r;
+}
+
+/* Extends the last piece of the tree by one line, if it ends right before line
+ * @add_idx of the add buffer
+ */
+static bool _extend_last(Piece *piece, size_t add_idx) {
+	Piece *last = piece;
+	while( last && last->right ) {
+		last = last->right;
+	}
+
+	if( !last || last->buf != PIECE_ADD
+		|| last->start + last->length != add_idx ) {
+		return false;
+	}
+
+	++last->length;
+	for( ; piece; piece = piece->right ) {
+		++piece->lines;
+	}
+
+	return true;
+}
+
+/* Returns the number of lines in a subtree */
+static size_t _count_lines(Piece *piece) {
+	return piece ? piece->lines : 0;
+}
+
+/* Recomputes the cached line count of a piece */
+static void _update(Piece *piece) {
+	piece->lines = _count_lines(piece->left) + piece->length
+		+ _count_lines(piece->right);
+}
+
+/* Releases the original buffer */
+static void _free_orig(PieceTable *table) {
+#if defined(__linux__) || defined(__APPLE__)
+	if( table->orig_mapped ) {
+		munmap(table->orig, table->orig_size);
+		return;
+	}
+#endif
+
+	free(table->orig);
+}
+
+/* Returns line @idx of the original buffer, setting @len to its length */
+static const char *_get_orig_line(PieceTable *table, size_t idx, size_t *len) {
+	const size_t start = table->orig_lines[idx];
+	*len = table->orig_lines[idx + 1] - start - (table->crlf ? 2 : 1);
+
+	return table->orig + start;
+}
+
+/* Moves an iterator @count lines forward, within its current piece */
+static void _advance(PieceIter *iter, size_t count) {
+	iter->line += count;
+	iter->offset += count;
+	if( iter->offset == iter->piece->length ) {
+		iter->piece = NULL;
+		if( iter->line < _count_lines(iter->root) ) {
+			iter->piece = _find_piece(iter->root, iter->line, &iter->offset);
+		}
+	}
+}
+
+/* Returns line @idx of the add buffer */
+static Line *_get_add_line(PieceTable *table, size_t idx) {
+	return &table->add[idx / PIECE_ADD_CHUNK][idx % PIECE_ADD_CHUNK];
+}
+
+/* Appends @line to the add buffer, returning its index
+ * Chunks are never moved, so pointers to added lines stay valid
+ */
+static size_t _append_line(PieceTable *table, Line *line) {
+	line_set_slab(line, table->slab);
+
+	if( table->add_length == table->add_chunks * PIECE_ADD_CHUNK ) {
+		size_t size = sizeof(*table->add) * (table->add_chunks + 1);
+		Line **new_add = realloc(table->add, size);
+		if( !new_add ) {
+			fprintf(stderr, "Failed to reallocate %zu bytes for chunks!\n", size);
+			exit(1);
+		}
+
+		table->add = new_add;
+
+		size = sizeof(**table->add) * PIECE_ADD_CHUNK;
+		table->add[table->add_chunks] = malloc(size);
+		if( !table->add[table->add_chunks] ) {
+			fprintf(stderr, "Failed to allocate %zu bytes for chunk!\n", size);
+			exit(1);
+		}
+
+		++table->add_chunks;
+	}
+
+	*_get_add_line(table, table->add_length) = *line;
+	return table->add_length++;
+}
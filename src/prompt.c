@@ -2,29 +2,27 @@
  * User prompt
  */
 
-#include "line.h"
-#include <stddef.h>
-#ifdef USE_PDCURSES
-#include <curses.h>
-#else
-#include <ncurses.h>
-#endif
-
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "global.h"
 
+#include "line.h"
+#include "term.h"
 #include "prompt.h"
 
 #define MAX_PROMPT_LEN (64)
 
 static void _init_prompt(Prompt *prompt, const char *fmt, va_list args);
+static void _open_prompt(
+	Prompt *prompt, const char *msg, int h, int min_width);
 
 static void _prompt_center_msg(Prompt *prompt, const char *msg);
+static void _prompt_add_line(Prompt *prompt, Line *line);
 
 static PromptOptResult _yes_no(void);
 static PromptOptResult _yes_no_cancel(void);
@@ -40,19 +38,43 @@ void prompt_init(Prompt *prompt, PromptType type, const char *msg, ...) {
 	switch( type ) {
 	case PROMPT_YES_NO:
 		_prompt_center_msg(prompt, "(Y)es / (N)o");
-		curs_set(0);
+		term_show_cursor(false);
 		break;
 	case PROMPT_YES_NO_CANCEL:
 		_prompt_center_msg(prompt, "(Y)es / (N)o / (C)ancel");
-		curs_set(0);
+		term_show_cursor(false);
 		break;
 	case PROMPT_STR:
-		wmove(prompt->win, 3, 1);
-		wrefresh(prompt->win);
+		term_popup_put(3, 1, "", 0);
+		term_refresh();
 		break;
+	case PROMPT_INFO:
+		fprintf(stderr, "Use prompt_init_info instead\n");
+		exit(1);
 	}
 }
 
+/* Initializes a prompt showing @count @lines of text under @title, until
+ * prompt_wait sees a key
+ */
+void prompt_init_info(
+	Prompt *prompt, const char *title, const char *const *lines, size_t count) {
+	int min_width = 0;
+	for( size_t i = 0; i < count; ++i ) {
+		min_width = MAX(min_width, (int)strlen(lines[i]) + 4);
+	}
+
+	_open_prompt(prompt, title, count + 4, min_width);
+
+	prompt->type = PROMPT_INFO;
+	for( size_t i = 0; i < count; ++i ) {
+		term_popup_put(3 + i, 2, lines[i], strlen(lines[i]));
+	}
+
+	term_show_cursor(false);
+	term_refresh();
+}
+
 /* Gets an option prompt */
 PromptOptResult prompt_opt_get(Prompt *prompt) {
 	switch( prompt->type ) {
@@ -63,36 +85,40 @@ PromptOptResult prompt_opt_get(Prompt *prompt) {
 	case PROMPT_STR:
 		fprintf(stderr, "Use prompt_str_get instead\n");
 		exit(1);
+	case PROMPT_INFO:
+		fprintf(stderr, "Use prompt_wait instead\n");
+		exit(1);
 	default:
 		fprintf(stderr, "Unknown prompt type '%d'!\n", prompt->type);
 		exit(1);
 	}
 }
 
-/* Gets a string prompt */
+/* Gets a string prompt
+ * Running out of keys ends it, as if enter was pressed
+ */
 char *prompt_str_get(Prompt *prompt) {
 	Line line;
 	line_init(&line);
 
 	int ch;
-	while( (ch = getch()) != '\n' ) {
+	while( (ch = term_get_key(-1)) != '\n' && ch != ERR ) {
 		if( ch == KEY_BACKSPACE ) {
 			line_delete_char_at_end(&line);
 
-			wmove(prompt->win, 3, 1);
-			wclrtoeol(prompt->win);
-			box(prompt->win, 0, 0);
+			term_popup_clear_to_eol(3, 1);
+			term_popup_border();
 
-			waddnstr(prompt->win, line.text, line.length);
-			wrefresh(prompt->win);
+			_prompt_add_line(prompt, &line);
+			term_refresh();
 			continue;
 		}
 
 		size_t remaining_chars = line.length - (prompt->w - 4);
 		if( remaining_chars > 0 && ch >= 32 && ch <= 126 ) {
 			line_insert_char_at_end(&line, ch);
-			mvwaddnstr(prompt->win, 3, 1, line.text, line.length);
-			wrefresh(prompt->win);
+			_prompt_add_line(prompt, &line);
+			term_refresh();
 		}
 	}
 
@@ -102,16 +128,21 @@ char *prompt_str_get(Prompt *prompt) {
 	return c_str;
 }
 
-/* Deletes a prompt */
-void prompt_free(Prompt *prompt) {
-	wborder(prompt->win, ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ');
-	werase(prompt->win);
-	wrefresh(prompt->win);
-	delwin(prompt->win);
+/* Waits for any key to dismiss an info prompt */
+void prompt_wait(Prompt *prompt) {
+	UNUSED(prompt);
+
+	term_get_key(-1);
+}
 
-	curs_set(1);
+/* Deletes a prompt
+ * The prompt is a popup, so what was under it is just drawn again
+ */
+void prompt_free(Prompt *prompt) {
+	UNUSED(prompt);
 
-	prompt->win = NULL;
+	term_popup_close();
+	term_show_cursor(true);
 }
 
 /* Initializes a prompt */
@@ -119,20 +150,27 @@ static void _init_prompt(Prompt *prompt, const char *fmt, va_list args) {
 	char msg[MAX_PROMPT_LEN];
 	vsnprintf(msg, MAX_PROMPT_LEN, fmt, args);
 
-	int base_width = COLS / 4;
+	_open_prompt(prompt, msg, 5, 0);
+}
+
+/* Opens a prompt @h rows high and at least @min_width columns wide with @msg
+ * at the top, its bottom edge where the usual prompt's is
+ */
+static void _open_prompt(
+	Prompt *prompt, const char *msg, int h, int min_width) {
+	Term *term = term_get();
+	int base_width = term->w / 4;
 	int msg_len = strlen(msg);
-	int min_width = msg_len + 2;
+	min_width = MAX(min_width, msg_len + 2);
 
-	int w = MAX(base_width, min_width);
-	int h = 5;
+	int w = MIN(MAX(base_width, min_width), (int)term->w);
+	int y = MAX((int)term->h - 5 - h, 0);
 
-	WINDOW *win = subwin(stdscr, h, w, LINES - h * 2, COLS - w);
-	werase(win);
-	mvwaddnstr(win, 1, (w - msg_len) / 2, msg, msg_len);
-	box(win, 0, 0);
-	wrefresh(win);
+	term_popup_open(y, term->w - w, h, w);
+	term_popup_put(1, (w - msg_len) / 2, msg, msg_len);
+	term_popup_border();
+	term_refresh();
 
-	prompt->win = win;
 	prompt->w = w;
 	prompt->h = h;
 }
@@ -141,17 +179,32 @@ static void _init_prompt(Prompt *prompt, const char *fmt, va_list args) {
 static void _prompt_center_msg(Prompt *prompt, const char *msg) {
 	int msg_len = strlen(msg);
 
-	mvwaddnstr(prompt->win, 3, (prompt->w - msg_len) / 2, msg, msg_len);
-	wrefresh(prompt->win);
+	term_popup_put(3, (prompt->w - msg_len) / 2, msg, msg_len);
+	term_refresh();
 }
 
-/* Gets a Y/N response */
+/* Writes the contents of @line to the input row of the prompt */
+static void _prompt_add_line(Prompt *prompt, Line *line) {
+	UNUSED(prompt);
+
+	const char *first, *second;
+	size_t first_len, second_len;
+	line_get_spans(line, &first, &first_len, &second, &second_len);
+
+	term_popup_put(3, 1, first, first_len);
+	term_popup_put(3, 1 + first_len, second, second_len);
+}
+
+/* Gets a Y/N response
+ * Running out of keys answers no
+ */
 static PromptOptResult _yes_no(void) {
 	while( true ) {
-		switch( getch() ) {
+		switch( term_get_key(-1) ) {
 		case 'Y':
 		case 'y':
 			return PROMPT_YES;
+		case ERR:
 		case 'N':
 		case 'n':
 			return PROMPT_NO;
@@ -159,16 +212,19 @@ static PromptOptResult _yes_no(void) {
 	}
 }
 
-/* Gets a Y/N/C response */
+/* Gets a Y/N/C response
+ * Running out of keys cancels
+ */
 static PromptOptResult _yes_no_cancel(void) {
 	while( true ) {
-		switch( getch() ) {
+		switch( term_get_key(-1) ) {
 		case 'Y':
 		case 'y':
 			return PROMPT_YES;
 		case 'N':
 		case 'n':
 			return PROMPT_NO;
+		case ERR:
 		case 'C':
 		case 'c':
 			return PROMPT_CANCEL;
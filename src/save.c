@@ -0,0 +1,474 @@
+/* edit
+ * Saving files in the background
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define SAVE_POSIX
+#endif
+
+#include "global.h"
+
+#include "line.h"
+#include "piece.h"
+#include "trace.h"
+
+#include "save.h"
+
+static void _release(Save *save);
+
+static void *_run(void *arg);
+static bool _write(Save *save);
+static void _add_progress(Save *save, size_t written);
+
+#ifdef SAVE_POSIX
+static bool _flush(
+	Save *save, int fd, struct iovec *iov, int *count, size_t *batch);
+static bool _write_spans(int fd, struct iovec *iov, int count);
+static bool _sync_dir(const char *path);
+#endif
+
+static void _join(Save *save);
+static void _lock(Save *save);
+static void _unlock(Save *save);
+
+/* Initializes an idle save */
+void save_init(Save *save) {
+	save->name = NULL;
+	save->policy = SYNC_ALWAYS;
+
+	save->spans = NULL;
+	save->span_count = 0;
+	save->copy = NULL;
+
+	save->eol = "\n";
+	save->total = 0;
+	save->hash = SAVE_FNV_OFFSET_BASIS;
+
+#ifdef SAVE_POSIX
+	pthread_mutex_init(&save->lock, NULL);
+#endif
+	save->threaded = false;
+
+	save->state = SAVE_IDLE;
+	save->written = 0;
+	save->error = 0;
+}
+
+/* Frees a save from memory, waiting for it to finish first */
+void save_free(Save *save) {
+	_join(save);
+	_release(save);
+
+#ifdef SAVE_POSIX
+	pthread_mutex_destroy(&save->lock);
+#endif
+}
+
+/* Takes a snapshot of @table, to be written to @name
+ * Any earlier save must have finished
+ */
+void save_snapshot(
+	Save *save, PieceTable *table, const char *name, SyncPolicy policy) {
+	_release(save);
+
+	/* Count the spans, and how much added text needs copying */
+	size_t count = 0, copied = 0;
+
+	PieceIter iter;
+	piece_iter_init(&iter, table, 0);
+
+	Line *line;
+	const char *text, *rest;
+	size_t length, rest_length;
+	while( piece_iter_next_run(&iter, &line, &text, &length) ) {
+		++count;
+		if( line ) {
+			copied += line->length;
+		}
+	}
+
+	save->spans = malloc(sizeof(*save->spans) * MAX(count, 1));
+	save->copy = malloc(MAX(copied, 1));
+	if( !save->spans || !save->copy ) {
+		fprintf(stderr, "Failed to allocate snapshot of %zu lines!\n", count);
+		exit(1);
+	}
+
+	save->eol = table->crlf ? "\r\n" : "\n";
+	save->total = 0;
+	save->hash = SAVE_FNV_OFFSET_BASIS;
+
+	char *cursor = save->copy;
+	piece_iter_init(&iter, table, 0);
+	for( size_t i = 0; piece_iter_next_run(&iter, &line, &text, &length);
+		++i ) {
+		if( line ) {
+			line_get_spans(line, &text, &length, &rest, &rest_length);
+
+			memcpy(cursor, text, length);
+			memcpy(cursor + length, rest, rest_length);
+
+			text = cursor;
+			length += rest_length;
+			cursor += length;
+		}
+
+		save->spans[i] = (SaveSpan) { text, length };
+		save->total += length + strlen(save->eol);
+	}
+
+	save->span_count = count;
+
+	const size_t name_length = strlen(name);
+	save->name = malloc(name_length + 1);
+	if( !save->name ) {
+		fprintf(stderr, "Failed to allocate %zu bytes for name!\n",
+			name_length + 1);
+		exit(1);
+	}
+
+	memcpy(save->name, name, name_length + 1);
+	save->policy = policy;
+
+	save->state = SAVE_RUNNING;
+	save->written = 0;
+	save->error = 0;
+}
+
+/* Writes the snapshot on a thread of its own
+ * If one can't be made, the snapshot is written right away
+ */
+void save_start(Save *save) {
+#ifdef SAVE_POSIX
+	if( pthread_create(&save->thread, NULL, _run, save) == 0 ) {
+		save->threaded = true;
+		return;
+	}
+#endif
+
+	_run(save);
+}
+
+/* Returns if the save is running, or has finished but not been reported */
+bool save_is_pending(Save *save) {
+	_lock(save);
+	const bool pending = save->state != SAVE_IDLE;
+	_unlock(save);
+
+	return pending;
+}
+
+/* Returns how the save is going, setting @written and @total if given
+ *
+ * A finished save is reported once, after which the save is idle again
+ * If it failed, errno is set to the reason why
+ */
+SaveState save_poll(Save *save, size_t *written, size_t *total) {
+	_lock(save);
+	const SaveState state = save->state;
+	if( written ) {
+		*written = save->written;
+	}
+	_unlock(save);
+
+	if( total ) {
+		*total = save->total;
+	}
+
+	if( state == SAVE_DONE || state == SAVE_FAILED ) {
+		_join(save);
+		_release(save);
+
+		save->state = SAVE_IDLE;
+		if( state == SAVE_FAILED ) {
+			errno = save->error;
+		}
+	}
+
+	return state;
+}
+
+/* Waits for the save to finish, and reports on it like save_poll() */
+SaveState save_wait(Save *save) {
+	_join(save);
+	return save_poll(save, NULL, NULL);
+}
+
+/* Adds @length bytes of @data to @hash (64-bit FNV-1a), starting from
+ * SAVE_FNV_OFFSET_BASIS
+ * Feeding a file through in any number of pieces gives the same result
+ */
+uint64_t save_hash(uint64_t hash, const char *data, size_t length) {
+	for( size_t i = 0; i < length; ++i ) {
+		hash ^= (unsigned char)data[i];
+		hash *= SAVE_FNV_PRIME;
+	}
+
+	return hash;
+}
+
+/* Frees the snapshot */
+static void _release(Save *save) {
+	free(save->name);
+	free(save->spans);
+	free(save->copy);
+
+	save->name = NULL;
+	save->spans = NULL;
+	save->span_count = 0;
+	save->copy = NULL;
+}
+
+/* Writes the snapshot, and records how it went */
+static void *_run(void *arg) {
+	Save *save = arg;
+
+	TRACE_BEGIN(span, "save write");
+	const bool ok = _write(save);
+	const int error = errno;
+	TRACE_END_ARG(span, "bytes", save->total);
+
+	_lock(save);
+	save->state = ok ? SAVE_DONE : SAVE_FAILED;
+	save->error = ok ? 0 : error;
+	_unlock(save);
+
+	return NULL;
+}
+
+#ifdef SAVE_POSIX
+/* Writes the snapshot atomically
+ *
+ * The lines go to a temporary file next to the target, which is then renamed
+ * over it, so a crash mid-save leaves either the old or the new contents
+ */
+static bool _write(Save *save) {
+	/* Write through symbolic links, rather than replacing them */
+	char target[PATH_MAX];
+	if( realpath(save->name, target) == NULL ) {
+		if( errno != ENOENT ) {
+			return false;
+		}
+
+		snprintf(target, sizeof(target), "%s", save->name);
+	}
+
+	const char *slash = strrchr(target, '/');
+	const int dir_length = slash ? (int)(slash - target + 1) : 0;
+
+	char temp[PATH_MAX + 64];
+	int fd = -1;
+	for( unsigned i = 0; fd < 0 && i < SAVE_ATTEMPTS; ++i ) {
+		snprintf(temp, sizeof(temp), "%.*s.%s.%ld.%u.tmp", dir_length, target,
+			target + dir_length, (long)getpid(), i);
+
+		fd = open(temp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+		if( fd < 0 && errno != EEXIST ) {
+			return false;
+		}
+	}
+
+	if( fd < 0 ) {
+		return false;
+	}
+
+	/* Keep the original's permissions, and its owner if we're allowed to */
+	struct stat st;
+	if( stat(target, &st) == 0 ) {
+		fchmod(fd, st.st_mode & 07777);
+		if( fchown(fd, st.st_uid, st.st_gid) < 0 ) {
+			/* Not fatal, we may just not own the file */
+		}
+	}
+
+	const size_t eol_length = strlen(save->eol);
+
+	struct iovec iov[SAVE_IOVECS];
+	int count = 0;
+	size_t batch = 0;
+
+	/* Long spans are cut up, so progress keeps being reported */
+	bool ok = true;
+	for( size_t i = 0; ok && i < save->span_count; ++i ) {
+		SaveSpan *span = &save->spans[i];
+		for( size_t offset = 0; ok && offset < span->length; ) {
+			const size_t part = MIN(span->length - offset, SAVE_BATCH);
+			iov[count++]
+				= (struct iovec) { (void *)(span->text + offset), part };
+
+			offset += part;
+			batch += part;
+			if( count == SAVE_IOVECS || batch >= SAVE_BATCH ) {
+				ok = _flush(save, fd, iov, &count, &batch);
+			}
+		}
+
+		iov[count++] = (struct iovec) { (void *)save->eol, eol_length };
+		batch += eol_length;
+		if( ok && (count == SAVE_IOVECS || batch >= SAVE_BATCH) ) {
+			ok = _flush(save, fd, iov, &count, &batch);
+		}
+	}
+
+	ok = ok && _flush(save, fd, iov, &count, &batch);
+
+	if( ok && save->policy != SYNC_NEVER ) {
+		ok = fsync(fd) == 0;
+	}
+
+	ok = (close(fd) == 0) && ok;
+	ok = ok && rename(temp, target) == 0;
+
+	if( !ok ) {
+		const int err = errno;
+		unlink(temp);
+		errno = err;
+		return false;
+	}
+
+	if( save->policy == SYNC_ALWAYS ) {
+		_sync_dir(target);
+	}
+
+	return true;
+}
+
+/* Writes out a batch of @count spans, @batch bytes in all, and empties it */
+static bool _flush(
+	Save *save, int fd, struct iovec *iov, int *count, size_t *batch) {
+	for( int i = 0; i < *count; ++i ) {
+		save->hash = save_hash(save->hash, iov[i].iov_base, iov[i].iov_len);
+	}
+
+	const bool ok = _write_spans(fd, iov, *count);
+	_add_progress(save, *batch);
+
+	*count = 0;
+	*batch = 0;
+
+	return ok;
+}
+
+/* Writes @count spans to @fd, picking up after short writes */
+static bool _write_spans(int fd, struct iovec *iov, int count) {
+	while( count > 0 ) {
+		ssize_t written = writev(fd, iov, count);
+		if( written < 0 ) {
+			if( errno == EINTR ) {
+				continue;
+			}
+
+			return false;
+		}
+
+		/* Skip the spans written in full, and trim the one cut short */
+		while( count > 0 && (size_t)written >= iov->iov_len ) {
+			written -= iov->iov_len;
+			++iov;
+			--count;
+		}
+
+		if( count > 0 ) {
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+
+	return true;
+}
+
+/* Flushes the directory holding @path, so a rename into it survives a crash */
+static bool _sync_dir(const char *path) {
+	char dir[PATH_MAX];
+	snprintf(dir, sizeof(dir), "%s", path);
+
+	char *slash = strrchr(dir, '/');
+	if( slash ) {
+		slash[slash == dir ? 1 : 0] = '\0';
+	} else {
+		snprintf(dir, sizeof(dir), ".");
+	}
+
+	int fd = open(dir, O_RDONLY);
+	if( fd < 0 ) {
+		return false;
+	}
+
+	bool ok = fsync(fd) == 0;
+	close(fd);
+
+	return ok;
+}
+#else
+/* Writes the snapshot in place */
+static bool _write(Save *save) {
+	FILE *fp = fopen(save->name, "w");
+	if( fp == NULL ) {
+		return false;
+	}
+
+	for( size_t i = 0; i < save->span_count; ++i ) {
+		SaveSpan *span = &save->spans[i];
+		fwrite(span->text, sizeof(*span->text), span->length, fp);
+		fputs(save->eol, fp);
+
+		save->hash = save_hash(save->hash, span->text, span->length);
+		save->hash = save_hash(save->hash, save->eol, strlen(save->eol));
+
+		_add_progress(save, span->length + strlen(save->eol));
+	}
+
+	return fclose(fp) == 0;
+}
+#endif
+
+/* Records that @written more bytes made it out */
+static void _add_progress(Save *save, size_t written) {
+	_lock(save);
+	save->written += written;
+	_unlock(save);
+}
+
+/* Waits for the writing thread, if there is one */
+static void _join(Save *save) {
+#ifdef SAVE_POSIX
+	if( save->threaded ) {
+		pthread_join(save->thread, NULL);
+		save->threaded = false;
+	}
+#else
+	UNUSED(save);
+#endif
+}
+
+/* Locks the fields shared with the writing thread */
+static void _lock(Save *save) {
+#ifdef SAVE_POSIX
+	pthread_mutex_lock(&save->lock);
+#else
+	UNUSED(save);
+#endif
+}
+
+/* Unlocks the fields shared with the writing thread */
+static void _unlock(Save *save) {
+#ifdef SAVE_POSIX
+	pthread_mutex_unlock(&save->lock);
+#else
+	UNUSED(save);
+#endif
+}
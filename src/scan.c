@@ -0,0 +1,362 @@
+/* edit
+ * Newline scanner
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <pthread.h>
+#define SCAN_THREADS
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+#include "global.h"
+
+#include "trace.h"
+#include "scan.h"
+
+#define SCAN_BLOCK (64) /* Bytes covered by one newline mask */
+#define SCAN_INITIAL_LINES (1024)
+
+/* A range of the buffer, indexed on its own by a worker */
+typedef struct _ScanChunk {
+	ScanIndex index; /* Lines ending in this range */
+	const char *data;
+	size_t from; /* Start of the range */
+	size_t to; /* End of the range */
+} ScanChunk;
+
+static void _init(ScanIndex *index, size_t start, size_t capacity);
+static void _finish(ScanIndex *index, size_t size);
+
+#ifdef SCAN_THREADS
+static void *_scan_chunk(void *arg);
+static void _join(ScanIndex *index, ScanChunk *chunks, size_t count);
+#endif
+
+static void _scan_range(
+	ScanIndex *index, const char *data, size_t from, size_t to);
+
+#ifdef SCAN_X86
+static size_t _scan_avx2(
+	ScanIndex *index, const char *data, size_t from, size_t to);
+static size_t _scan_sse2(
+	ScanIndex *index, const char *data, size_t from, size_t to);
+#endif
+
+static void _scan_scalar(
+	ScanIndex *index, const char *data, size_t from, size_t to);
+
+#ifdef SCAN_X86
+static void _push_lines(
+	ScanIndex *index, const char *data, size_t base, uint64_t mask);
+#endif
+static void _push_line(ScanIndex *index, const char *data, size_t nl);
+static void _reserve(ScanIndex *index);
+
+/* Indexes the lines of @data
+ *
+ * The buffer is scanned with the widest vector instructions available, falling
+ * back to plain memchr() for whatever doesn't fill a whole block
+ */
+void scan_index(ScanIndex *index, const char *data, size_t size) {
+	TRACE_BEGIN(span, "scan");
+
+	_init(index, 0, SCAN_INITIAL_LINES);
+	_scan_range(index, data, 0, size);
+	_finish(index, size);
+
+	TRACE_END_ARG(span, "bytes", size);
+}
+
+/* Indexes the lines of @data, splitting the work between up to @threads
+ * threads
+ *
+ * Each thread gets at least SCAN_MIN_CHUNK bytes, so small buffers are still
+ * indexed on the calling thread alone
+ */
+void scan_index_parallel(
+	ScanIndex *index, const char *data, size_t size, size_t threads) {
+	threads = MIN(MIN(threads, SCAN_MAX_THREADS), size / SCAN_MIN_CHUNK);
+	if( threads < 2 ) {
+		scan_index(index, data, size);
+		return;
+	}
+
+#ifdef SCAN_THREADS
+	ScanChunk chunks[SCAN_MAX_THREADS];
+	pthread_t workers[SCAN_MAX_THREADS];
+	bool started[SCAN_MAX_THREADS];
+
+	const size_t step = size / threads;
+	for( size_t i = 0; i < threads; ++i ) {
+		ScanChunk *chunk = &chunks[i];
+		chunk->data = data;
+		chunk->from = i * step;
+		chunk->to = (i == threads - 1) ? size : chunk->from + step;
+
+		_init(&chunk->index, chunk->from, SCAN_INITIAL_LINES);
+	}
+
+	/* The first chunk is ours, as is any chunk a thread couldn't be made for */
+	for( size_t i = 1; i < threads; ++i ) {
+		started[i]
+			= pthread_create(&workers[i], NULL, _scan_chunk, &chunks[i]) == 0;
+	}
+
+	_scan_chunk(&chunks[0]);
+
+	for( size_t i = 1; i < threads; ++i ) {
+		if( started[i] ) {
+			pthread_join(workers[i], NULL);
+		} else {
+			_scan_chunk(&chunks[i]);
+		}
+	}
+
+	_join(index, chunks, threads);
+	_finish(index, size);
+#else
+	scan_index(index, data, size);
+#endif
+}
+
+/* Frees an index from memory */
+void scan_free(ScanIndex *index) {
+	free(index->lines);
+
+	index->lines = NULL;
+	index->length = 0;
+	index->capacity = 0;
+}
+
+/* Returns the length of the line endings in the indexed buffer */
+size_t scan_get_eol_length(ScanIndex *index) {
+	return index->crlf ? 2 : 1;
+}
+
+/* Starts an empty index, with its first line at @start */
+static void _init(ScanIndex *index, size_t start, size_t capacity) {
+	index->capacity = MAX(capacity, 2);
+	index->lines = malloc(sizeof(*index->lines) * index->capacity);
+	if( !index->lines ) {
+		fprintf(stderr, "Failed to allocate index for %zu lines!\n",
+			index->capacity);
+		exit(1);
+	}
+
+	index->lines[0] = start;
+	index->length = 0;
+
+	index->crlfs = 0;
+
+	index->crlf = false;
+	index->nul = false;
+}
+
+#ifdef SCAN_THREADS
+/* Indexes a single chunk */
+static void *_scan_chunk(void *arg) {
+	ScanChunk *chunk = arg;
+
+	TRACE_BEGIN(span, "scan chunk");
+	_scan_range(&chunk->index, chunk->data, chunk->from, chunk->to);
+	TRACE_END_ARG(span, "bytes", chunk->to - chunk->from);
+
+	return NULL;
+}
+
+/* Concatenates the indices of @count consecutive chunks, freeing them
+ * The first chunk's index is grown in place, so its lines are never copied
+ */
+static void _join(ScanIndex *index, ScanChunk *chunks, size_t count) {
+	size_t total = 0;
+	for( size_t i = 0; i < count; ++i ) {
+		total += chunks[i].index.length;
+	}
+
+	*index = chunks[0].index;
+	if( index->capacity < total + 2 ) {
+		index->capacity = total + 2;
+
+		const size_t size = sizeof(*index->lines) * index->capacity;
+		size_t *new_lines = realloc(index->lines, size);
+		if( !new_lines ) {
+			fprintf(stderr, "Failed to reallocate %zu bytes for index!\n", size);
+			exit(1);
+		}
+
+		index->lines = new_lines;
+	}
+
+	for( size_t i = 1; i < count; ++i ) {
+		ScanIndex *chunk = &chunks[i].index;
+		if( chunk->length > 0 ) {
+			memcpy(index->lines + index->length + 1, chunk->lines + 1,
+				sizeof(*chunk->lines) * chunk->length);
+			index->length += chunk->length;
+		}
+
+		index->crlfs += chunk->crlfs;
+		index->nul = index->nul || chunk->nul;
+
+		scan_free(chunk);
+	}
+}
+#endif
+
+/* Scans @data from @from up to @to */
+static void _scan_range(
+	ScanIndex *index, const char *data, size_t from, size_t to) {
+#ifdef SCAN_X86
+	if( __builtin_cpu_supports("avx2") ) {
+		from = _scan_avx2(index, data, from, to);
+	} else if( __builtin_cpu_supports("sse2") ) {
+		from = _scan_sse2(index, data, from, to);
+	}
+#endif
+
+	_scan_scalar(index, data, from, to);
+}
+
+#ifdef SCAN_X86
+/* Scans whole blocks of @data 32 bytes at a time, returning where it stopped */
+__attribute__((target("avx2"))) static size_t _scan_avx2(
+	ScanIndex *index, const char *data, size_t from, size_t to) {
+	const __m256i newline = _mm256_set1_epi8('\n');
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i nuls = zero;
+
+	size_t i = from;
+	for( ; i + SCAN_BLOCK <= to; i += SCAN_BLOCK ) {
+		const __m256i a = _mm256_loadu_si256((const __m256i *)(data + i));
+		const __m256i b = _mm256_loadu_si256((const __m256i *)(data + i + 32));
+
+		/* A zero in either half leaves a zero in their minimum */
+		nuls = _mm256_or_si256(
+			nuls, _mm256_cmpeq_epi8(_mm256_min_epu8(a, b), zero));
+
+		const uint64_t lo = (uint32_t)_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(a, newline));
+		const uint64_t hi = (uint32_t)_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(b, newline));
+
+		_push_lines(index, data, i, lo | hi << 32);
+	}
+
+	if( !_mm256_testz_si256(nuls, nuls) ) {
+		index->nul = true;
+	}
+
+	return i;
+}
+
+/* Scans whole blocks of @data 16 bytes at a time, returning where it stopped */
+__attribute__((target("sse2"))) static size_t _scan_sse2(
+	ScanIndex *index, const char *data, size_t from, size_t to) {
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i zero = _mm_setzero_si128();
+	__m128i nuls = zero;
+
+	size_t i = from;
+	for( ; i + SCAN_BLOCK <= to; i += SCAN_BLOCK ) {
+		uint64_t mask = 0;
+		for( size_t j = 0; j < SCAN_BLOCK; j += 16 ) {
+			const __m128i v = _mm_loadu_si128((const __m128i *)(data + i + j));
+
+			nuls = _mm_or_si128(nuls, _mm_cmpeq_epi8(v, zero));
+			mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+						_mm_cmpeq_epi8(v, newline))
+				<< j;
+		}
+
+		_push_lines(index, data, i, mask);
+	}
+
+	if( _mm_movemask_epi8(nuls) ) {
+		index->nul = true;
+	}
+
+	return i;
+}
+#endif
+
+/* Scans @data from @from up to @to with memchr()
+ * Each line is checked for NUL bytes as it is found, while it is still in
+ * the cache, so the buffer is only read from memory once
+ */
+static void _scan_scalar(
+	ScanIndex *index, const char *data, size_t from, size_t to) {
+	const char *end = data + to;
+	const char *line = data + from;
+	for( const char *nl; (nl = memchr(line, '\n', end - line));
+		line = nl + 1 ) {
+		if( !index->nul && memchr(line, '\0', nl - line) ) {
+			index->nul = true;
+		}
+
+		_push_line(index, data, nl - data);
+	}
+
+	if( !index->nul && memchr(line, '\0', end - line) ) {
+		index->nul = true;
+	}
+}
+
+/* Settles the line endings, and closes off the last line */
+static void _finish(ScanIndex *index, size_t size) {
+	index->crlf = index->crlfs > 0 && index->crlfs == index->length;
+
+	/* The last line may not end in a newline, so pretend it does */
+	const size_t start = index->lines[index->length];
+	if( start < size ) {
+		_reserve(index);
+		index->lines[++index->length] = size + scan_get_eol_length(index);
+	}
+}
+
+#ifdef SCAN_X86
+/* Pushes one line for each bit set in @mask, a block starting at @base */
+static void _push_lines(
+	ScanIndex *index, const char *data, size_t base, uint64_t mask) {
+	while( mask ) {
+		_push_line(index, data, base + (size_t)__builtin_ctzll(mask));
+		mask &= mask - 1;
+	}
+}
+#endif
+
+/* Ends the current line at the newline at @nl */
+static void _push_line(ScanIndex *index, const char *data, size_t nl) {
+	if( nl > 0 && data[nl - 1] == '\r' ) {
+		++index->crlfs;
+	}
+
+	_reserve(index);
+	index->lines[++index->length] = nl + 1;
+}
+
+/* Makes room for one more line */
+static void _reserve(ScanIndex *index) {
+	if( index->length + 2 > index->capacity ) {
+		index->capacity *= 2;
+
+		const size_t size = sizeof(*index->lines) * index->capacity;
+		size_t *new_lines = realloc(index->lines, size);
+		if( !new_lines ) {
+			fprintf(stderr, "Failed to reallocate %zu bytes for index!\n", size);
+			exit(1);
+		}
+
+		index->lines = new_lines;
+	}
+}
@@ -0,0 +1,285 @@
+/* edit
+ * Damage-tracked screen
+ */
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+
+#include "screen.h"
+#include "term.h"
+
+static void _move_rows(Screen *screen, size_t to, size_t from, size_t count);
+static void _set_damage(Screen *screen, size_t row, bool damaged);
+
+static void _draw_row(Screen *screen, size_t start);
+static size_t _get_first_change(Screen *screen, char *cells, size_t length);
+
+static size_t _get_words(size_t rows);
+static void *_grow(void *ptr, size_t size);
+
+/* Initializes an empty screen */
+void screen_init(Screen *screen) {
+	screen->w = 0;
+	screen->h = 0;
+
+	screen->cells = NULL;
+	screen->lengths = NULL;
+	screen->damage = NULL;
+
+	screen->row = NULL;
+	screen->length = 0;
+	screen->current = 0;
+}
+
+/* Frees the screen from memory */
+void screen_free(Screen *screen) {
+	free(screen->cells);
+	free(screen->lengths);
+	free(screen->damage);
+	free(screen->row);
+
+	screen_init(screen);
+}
+
+/* Resizes the screen to @w columns and @h rows
+ * Nothing drawn before is known to be there anymore
+ */
+void screen_resize(Screen *screen, size_t w, size_t h) {
+	screen->cells = _grow(screen->cells, MAX(w * h, 1));
+	screen->lengths = _grow(screen->lengths, sizeof(size_t) * MAX(h, 1));
+	screen->damage = _grow(
+		screen->damage, sizeof(unsigned long) * MAX(_get_words(h), 1));
+	screen->row = _grow(screen->row, MAX(w, 1));
+
+	screen->w = w;
+	screen->h = h;
+
+	screen_invalidate(screen);
+}
+
+/* Forgets what is on the terminal, so every row is drawn again in full */
+void screen_invalidate(Screen *screen) {
+	for( size_t i = 0; i < screen->h; ++i ) {
+		screen->lengths[i] = SCREEN_UNKNOWN;
+	}
+
+	screen_damage(screen, 0, screen->h);
+}
+
+/* Scrolls the contents of the screen up @by rows, or down if @by is negative
+ *
+ * The rows still on the screen are moved on the terminal itself, through its
+ * scroll region, and keep what they showed. Only the rows scrolled in are
+ * left to be drawn
+ */
+void screen_scroll(Screen *screen, long by) {
+	const size_t h = screen->h;
+	const size_t n = by < 0 ? (size_t)-by : (size_t)by;
+	if( n == 0 ) {
+		return;
+	}
+
+	if( n >= h ) {
+		screen_damage(screen, 0, h);
+		return;
+	}
+
+	term_scroll(0, h - 1, by);
+
+	size_t exposed;
+	if( by > 0 ) {
+		_move_rows(screen, 0, n, h - n);
+		exposed = h - n;
+	} else {
+		_move_rows(screen, n, 0, h - n);
+		exposed = 0;
+	}
+
+	/* The terminal blanks the rows it scrolls in */
+	for( size_t row = exposed; row < exposed + n; ++row ) {
+		screen->lengths[row] = 0;
+	}
+
+	screen_damage(screen, exposed, exposed + n);
+}
+
+/* Marks rows @from up to (but not including) @to as needing to be drawn */
+void screen_damage(Screen *screen, size_t from, size_t to) {
+	to = MIN(to, screen->h);
+
+	for( size_t row = from; row < to; ++row ) {
+		_set_damage(screen, row, true);
+	}
+}
+
+/* Returns if @row needs to be drawn */
+bool screen_is_damaged(Screen *screen, size_t row) {
+	if( row >= screen->h ) {
+		return false;
+	}
+
+	return (screen->damage[row / SCREEN_WORD_BITS] >> (row % SCREEN_WORD_BITS))
+		& 1UL;
+}
+
+/* Returns the first row from @from up to @to that needs to be drawn, or @to
+ * if there is none
+ * Whole words of undamaged rows are skipped at once
+ */
+size_t screen_get_damaged(Screen *screen, size_t from, size_t to) {
+	to = MIN(to, screen->h);
+
+	size_t row = from;
+	while( row < to ) {
+		const unsigned long word = screen->damage[row / SCREEN_WORD_BITS]
+			>> (row % SCREEN_WORD_BITS);
+		if( word == 0 ) {
+			row += SCREEN_WORD_BITS - row % SCREEN_WORD_BITS;
+			continue;
+		}
+
+		if( word & 1UL ) {
+			return row;
+		}
+
+		++row;
+	}
+
+	return to;
+}
+
+/* Starts putting together the text of @row */
+void screen_begin_row(Screen *screen, size_t row) {
+	screen->current = row;
+	screen->length = 0;
+}
+
+/* Adds @length characters of @text to the row being put together
+ * Whatever doesn't fit on the screen is cut off
+ */
+void screen_add(Screen *screen, const char *text, size_t length) {
+	length = MIN(length, screen->w - screen->length);
+	if( length == 0 ) {
+		return;
+	}
+
+	memcpy(screen->row + screen->length, text, length);
+	screen->length += length;
+}
+
+/* Finishes putting together the row, drawing whatever changed in it
+ * Returns if anything was drawn
+ */
+bool screen_end_row(Screen *screen) {
+	const size_t row = screen->current;
+	if( row >= screen->h ) {
+		return false;
+	}
+
+	_set_damage(screen, row, false);
+
+	char *cells = screen->cells + row * screen->w;
+	const size_t old_length = screen->lengths[row];
+
+	size_t start = 0;
+	if( old_length != SCREEN_UNKNOWN ) {
+		if( old_length == screen->length
+			&& memcmp(cells, screen->row, screen->length) == 0 ) {
+			return false;
+		}
+
+		start = _get_first_change(screen, cells, old_length);
+	}
+
+	_draw_row(screen, start);
+
+	memcpy(cells, screen->row, screen->length);
+	screen->lengths[row] = screen->length;
+
+	return true;
+}
+
+/* Moves @count rows of text, with their damage, from row @from to row @to */
+static void _move_rows(Screen *screen, size_t to, size_t from, size_t count) {
+	const size_t w = screen->w;
+	memmove(screen->cells + to * w, screen->cells + from * w, count * w);
+	memmove(screen->lengths + to, screen->lengths + from,
+		count * sizeof(*screen->lengths));
+
+	if( to < from ) {
+		for( size_t i = 0; i < count; ++i ) {
+			_set_damage(screen, to + i, screen_is_damaged(screen, from + i));
+		}
+	} else {
+		for( size_t i = count; i-- > 0; ) {
+			_set_damage(screen, to + i, screen_is_damaged(screen, from + i));
+		}
+	}
+}
+
+/* Sets whether @row needs to be drawn */
+static void _set_damage(Screen *screen, size_t row, bool damaged) {
+	const unsigned long bit = 1UL << (row % SCREEN_WORD_BITS);
+	if( damaged ) {
+		screen->damage[row / SCREEN_WORD_BITS] |= bit;
+	} else {
+		screen->damage[row / SCREEN_WORD_BITS] &= ~bit;
+	}
+}
+
+/* Draws the row being put together from column @start on */
+static void _draw_row(Screen *screen, size_t start) {
+	term_move(screen->current, start);
+	term_put(screen->row + start, screen->length - start);
+
+	/* A full row leaves the cursor on the next one, and has nothing left over
+	 * to clear anyway */
+	if( screen->length < screen->w ) {
+		term_clear_to_eol();
+	}
+}
+
+/* Returns the column where the row being put together starts to differ from
+ * the @length characters of @cells
+ *
+ * Columns only match bytes while every byte before them is printable ASCII,
+ * so past a tab, a control character or a multibyte character the whole row
+ * is drawn again
+ */
+static size_t _get_first_change(Screen *screen, char *cells, size_t length) {
+	const size_t common = MIN(length, screen->length);
+
+	size_t i = 0;
+	while( i < common && cells[i] == screen->row[i] ) {
+		const unsigned char ch = screen->row[i];
+		if( ch < 32 || ch > 126 ) {
+			return 0;
+		}
+
+		++i;
+	}
+
+	return i;
+}
+
+/* Returns how many words the damage bitmap of @rows rows takes up */
+static size_t _get_words(size_t rows) {
+	return (rows + SCREEN_WORD_BITS - 1) / SCREEN_WORD_BITS;
+}
+
+/* Reallocates @ptr to @size bytes, exiting if that fails */
+static void *_grow(void *ptr, size_t size) {
+	void *grown = realloc(ptr, size);
+	if( !grown ) {
+		fprintf(stderr, "Failed to allocate %zu bytes for the screen!\n", size);
+		exit(1);
+	}
+
+	return grown;
+}
@@ -0,0 +1,628 @@
+/* edit
+ * Undo history kept next to files
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SIDECAR_POSIX
+#endif
+
+#include "global.h"
+
+#include "cmd.h"
+#include "line.h"
+#include "piece.h"
+#include "undo.h"
+
+#include "sidecar.h"
+
+#define SIDECAR_SUFFIX ".edit-undo"
+#define SIDECAR_NONE (UINT64_MAX) /* No node, as written to the sidecar */
+
+static void _unmap(Sidecar *sidecar);
+
+static bool _decode(const char *data, size_t size, PieceTable *table,
+	UndoNode **nodes, size_t *count, size_t *current);
+static bool _decode_node(const char *data, size_t size, PieceTable *table,
+	size_t i, UndoNode *node, size_t *consumed);
+static Piece *_decode_lines(
+	PieceTable *table, const char *text, size_t length);
+static void _free_nodes(UndoNode *nodes, size_t count);
+
+static void _append(Sidecar *sidecar, size_t *capacity, const void *data,
+	size_t length);
+static size_t _get_lines_length(Command *cmd);
+static void _append_lines(Sidecar *sidecar, size_t *capacity, Command *cmd);
+static void _put(char *data, size_t at, uint64_t value);
+static uint64_t _get(const char *data, size_t at);
+
+#ifdef SIDECAR_POSIX
+static char *_get_path(const char *filename);
+static void _get_base(
+	const char *filename, uint64_t *size, int64_t *mtime, uint64_t *inode);
+static bool _write_all(int fd, const char *data, size_t length);
+#endif
+
+/* Initializes a sidecar with no history in it */
+void sidecar_init(Sidecar *sidecar) {
+	sidecar->map = NULL;
+	sidecar->size = 0;
+	sidecar->hash = 0;
+
+	sidecar->image = NULL;
+	sidecar->length = 0;
+}
+
+/* Frees a sidecar from memory, leaving its file alone */
+void sidecar_free(Sidecar *sidecar) {
+	_unmap(sidecar);
+	free(sidecar->image);
+
+	sidecar_init(sidecar);
+}
+
+/* Looks for history left by an earlier session for @filename, as it is on disk
+ *
+ * Only the header is checked, the rest is mapped until it is needed. If it
+ * fits, @tree carries on numbering states from where that history left off
+ */
+void sidecar_open(Sidecar *sidecar, const char *filename, UndoTree *tree) {
+	_unmap(sidecar);
+
+#ifdef SIDECAR_POSIX
+	char *path = _get_path(filename);
+	int fd = open(path, O_RDONLY);
+	free(path);
+
+	if( fd < 0 ) {
+		return;
+	}
+
+	struct stat st;
+	if( fstat(fd, &st) < 0 || (size_t)st.st_size < SIDECAR_HEADER_SIZE ) {
+		close(fd);
+		return;
+	}
+
+	const size_t size = (size_t)st.st_size;
+	char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if( map == MAP_FAILED ) {
+		return;
+	}
+
+	/* History of an older version of the file doesn't apply to it anymore */
+	uint64_t base_size, base_inode;
+	int64_t base_mtime;
+	_get_base(filename, &base_size, &base_mtime, &base_inode);
+
+	if( memcmp(map, SIDECAR_MAGIC, 4) != 0 || _get(map, 8) != base_size
+		|| (int64_t)_get(map, 16) != base_mtime || _get(map, 64) != base_inode
+		|| _get(map, 40) >= _get(map, 32) ) {
+		munmap(map, size);
+		return;
+	}
+
+	sidecar->map = map;
+	sidecar->size = size;
+	sidecar->hash = _get(map, 24);
+
+	undo_resume(tree, (size_t)_get(map, 48), (size_t)_get(map, 56));
+#else
+	UNUSED(filename);
+	UNUSED(tree);
+#endif
+}
+
+/* Returns if there is mapped history yet to be grafted onto the tree */
+bool sidecar_is_pending(Sidecar *sidecar) {
+	return sidecar->map != NULL;
+}
+
+/* Grafts the mapped history onto @tree, if it was saved with a file hashing
+ * to @hash
+ * Lines cut out of the file are added to @table, outside of the document
+ * Either way, the mapping is dropped
+ * Returns if anything was grafted
+ */
+bool sidecar_import(
+	Sidecar *sidecar, UndoTree *tree, PieceTable *table, uint64_t hash) {
+	if( !sidecar->map ) {
+		return false;
+	}
+
+	UndoNode *nodes = NULL;
+	size_t count = 0, current = 0;
+
+	const bool ok = hash == sidecar->hash
+		&& _decode(
+			sidecar->map, sidecar->size, table, &nodes, &count, &current);
+	_unmap(sidecar);
+
+	if( !ok ) {
+		return false;
+	}
+
+	undo_graft(tree, nodes, count, current);
+	free(nodes);
+
+	return true;
+}
+
+/* Takes an image of @tree as the file is being saved, to be written once the
+ * save is done
+ */
+void sidecar_snapshot(Sidecar *sidecar, UndoTree *tree) {
+	free(sidecar->image);
+	sidecar->image = NULL;
+	sidecar->length = 0;
+
+	/* Number the nodes so parents come first, and older siblings before
+	 * newer ones */
+	size_t *order = malloc(sizeof(*order) * tree->length);
+	size_t *number = malloc(sizeof(*number) * tree->length);
+	if( !order || !number ) {
+		fprintf(stderr, "Failed to allocate order of %zu states!\n",
+			tree->length);
+		exit(1);
+	}
+
+	size_t count = 0, pending = 0;
+	order[pending++] = tree->root;
+	while( pending > count ) {
+		/* Each node's children are pushed behind it, oldest first */
+		const size_t idx = order[count];
+		number[idx] = count++;
+
+		size_t children = 0;
+		for( size_t child = tree->nodes[idx].first_child; child != UNDO_NONE;
+			child = tree->nodes[child].sibling ) {
+			order[pending + children++] = child;
+		}
+
+		for( size_t i = 0; i < children / 2; ++i ) {
+			const size_t swap = order[pending + i];
+			order[pending + i] = order[pending + children - 1 - i];
+			order[pending + children - 1 - i] = swap;
+		}
+
+		pending += children;
+	}
+
+	size_t capacity = SIDECAR_HEADER_SIZE + count * SIDECAR_RECORD_SIZE;
+
+	char header[SIDECAR_HEADER_SIZE] = { 0 };
+	memcpy(header, SIDECAR_MAGIC, 4);
+	_put(header, 32, count);
+	_put(header, 40, number[tree->current]);
+	_put(header, 48, tree->nodes[tree->current].seq);
+	_put(header, 56, tree->seq);
+	_append(sidecar, &capacity, header, sizeof(header));
+
+	for( size_t i = 0; i < count; ++i ) {
+		UndoNode *node = &tree->nodes[order[i]];
+		Command *cmd = &node->cmd;
+
+		const char *text = NULL, *rest = NULL;
+		size_t length = 0, rest_length = 0;
+		if( cmd_has_text(cmd) ) {
+			line_get_spans(
+				&cmd->data.line, &text, &length, &rest, &rest_length);
+		} else if( cmd->type == CMD_ADD_LINE ) {
+			length = _get_lines_length(cmd);
+		}
+
+		/* A block of lines keeps whether it left an empty line behind in
+		 * place of the character */
+		char record[SIDECAR_RECORD_SIZE] = { 0 };
+		_put(record, 0, cmd->type);
+		if( cmd->type == CMD_ADD_LINE ) {
+			record[4] = cmd->data.block.placeholder;
+		} else if( !cmd_has_text(cmd) ) {
+			record[4] = cmd->data.ch;
+		}
+
+		_put(record, 8,
+			node->parent == UNDO_NONE ? SIDECAR_NONE : number[node->parent]);
+		_put(record, 16,
+			node->child == UNDO_NONE ? SIDECAR_NONE : number[node->child]);
+		_put(record, 24, node->seq);
+		_put(record, 32, (uint64_t)(int64_t)node->time);
+		_put(record, 40, cmd->line);
+		_put(record, 48, cmd->idx);
+		_put(record, 56, length + rest_length);
+		_put(record, 64, cmd->length);
+
+		_append(sidecar, &capacity, record, sizeof(record));
+		if( cmd->type == CMD_ADD_LINE ) {
+			_append_lines(sidecar, &capacity, cmd);
+		} else {
+			_append(sidecar, &capacity, text, length);
+			_append(sidecar, &capacity, rest, rest_length);
+		}
+	}
+
+	free(order);
+	free(number);
+}
+
+/* Writes the image taken for the save of @filename, which just finished
+ * writing a file hashing to @hash
+ *
+ * The sidecar is replaced atomically, but not flushed, as losing the history
+ * to a crash costs nothing the file itself doesn't have
+ * Returns if it was written
+ */
+bool sidecar_write(Sidecar *sidecar, const char *filename, uint64_t hash) {
+	if( !sidecar->image ) {
+		return false;
+	}
+
+	bool ok = false;
+
+#ifdef SIDECAR_POSIX
+	uint64_t base_size, base_inode;
+	int64_t base_mtime;
+	_get_base(filename, &base_size, &base_mtime, &base_inode);
+
+	_put(sidecar->image, 8, base_size);
+	_put(sidecar->image, 16, (uint64_t)base_mtime);
+	_put(sidecar->image, 24, hash);
+	_put(sidecar->image, 64, base_inode);
+
+	char *path = _get_path(filename);
+	const size_t size = strlen(path) + sizeof(".tmp");
+	char *temp = malloc(size);
+	if( !temp ) {
+		fprintf(stderr, "Failed to allocate %zu bytes for sidecar path!\n",
+			size);
+		exit(1);
+	}
+
+	snprintf(temp, size, "%s.tmp", path);
+
+	int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if( fd >= 0 ) {
+		ok = _write_all(fd, sidecar->image, sidecar->length);
+		ok = (close(fd) == 0) && ok;
+		ok = ok && rename(temp, path) == 0;
+
+		if( !ok ) {
+			unlink(temp);
+		}
+	}
+
+	free(temp);
+	free(path);
+#else
+	UNUSED(filename);
+	UNUSED(hash);
+#endif
+
+	free(sidecar->image);
+	sidecar->image = NULL;
+	sidecar->length = 0;
+
+	return ok;
+}
+
+/* Drops the mapping of an earlier session's history */
+static void _unmap(Sidecar *sidecar) {
+#ifdef SIDECAR_POSIX
+	if( sidecar->map ) {
+		munmap(sidecar->map, sidecar->size);
+	}
+#endif
+
+	sidecar->map = NULL;
+	sidecar->size = 0;
+}
+
+/* Reads the nodes out of a whole sidecar, into @nodes, which must be freed
+ * Returns false if it is cut short, or doesn't hold a valid tree
+ */
+static bool _decode(const char *data, size_t size, PieceTable *table,
+	UndoNode **nodes, size_t *count, size_t *current) {
+	const uint64_t found = _get(data, 32);
+	if( found == 0 || found > (size - SIDECAR_HEADER_SIZE) / SIDECAR_RECORD_SIZE
+		|| _get(data, 40) >= found ) {
+		return false;
+	}
+
+	*count = (size_t)found;
+	*current = (size_t)_get(data, 40);
+
+	*nodes = malloc(sizeof(**nodes) * *count);
+	if( !*nodes ) {
+		fprintf(stderr, "Failed to allocate %zu states!\n", *count);
+		exit(1);
+	}
+
+	size_t at = SIDECAR_HEADER_SIZE;
+	for( size_t i = 0; i < *count; ++i ) {
+		size_t consumed;
+		if( !_decode_node(
+				data + at, size - at, table, i, &(*nodes)[i], &consumed) ) {
+			_free_nodes(*nodes, i);
+			*nodes = NULL;
+			return false;
+		}
+
+		at += consumed;
+	}
+
+	/* Redo may only lead to a node's own children */
+	for( size_t i = 0; i < *count; ++i ) {
+		const size_t child = (*nodes)[i].child;
+		if( child != UNDO_NONE
+			&& (child >= *count || (*nodes)[child].parent != i) ) {
+			_free_nodes(*nodes, *count);
+			*nodes = NULL;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Reads node @i from the record at the start of @data, setting @consumed to
+ * its size
+ * Returns false if there isn't a whole, valid record there
+ */
+static bool _decode_node(const char *data, size_t size, PieceTable *table,
+	size_t i, UndoNode *node, size_t *consumed) {
+	if( size < SIDECAR_RECORD_SIZE ) {
+		return false;
+	}
+
+	const uint64_t type = _get(data, 0) & UINT32_MAX;
+	const uint64_t parent = _get(data, 8);
+	const uint64_t child = _get(data, 16);
+	const uint64_t length = _get(data, 56);
+	const uint64_t lines = _get(data, 64);
+
+	/* Only the first node may be a root, and parents come before children */
+	const bool parent_ok
+		= i == 0 ? parent == SIDECAR_NONE : parent < (uint64_t)i;
+	if( type > CMD_DEL_STR || !parent_ok
+		|| length > size - SIDECAR_RECORD_SIZE ) {
+		return false;
+	}
+
+	/* Blocks of lines can't be empty */
+	if( (type == CMD_DEL_LINE) != (lines > 0) ) {
+		return false;
+	}
+
+	memset(&node->cmd, 0, sizeof(node->cmd));
+	node->cmd.type = (CommandType)type;
+	node->cmd.line = (size_t)_get(data, 40);
+	node->cmd.idx = (size_t)_get(data, 48);
+	node->cmd.length = (size_t)lines;
+
+	const char *text = data + SIDECAR_RECORD_SIZE;
+	if( cmd_has_text(&node->cmd) ) {
+		line_init(&node->cmd.data.line);
+		line_insert_strn(&node->cmd.data.line, 0, text, length);
+	} else if( node->cmd.type == CMD_ADD_LINE ) {
+		node->cmd.data.block.table = table;
+		node->cmd.data.block.pieces = _decode_lines(table, text, length);
+		node->cmd.data.block.placeholder = data[4] != '\0';
+	} else if( length == 0 ) {
+		node->cmd.data.ch = data[4];
+	} else {
+		return false;
+	}
+
+	node->parent = parent == SIDECAR_NONE ? UNDO_NONE : (size_t)parent;
+	node->child = child == SIDECAR_NONE ? UNDO_NONE : (size_t)child;
+	node->first_child = UNDO_NONE;
+	node->sibling = UNDO_NONE;
+
+	node->seq = (size_t)_get(data, 24);
+	node->depth = 0;
+	node->time = (time_t)(int64_t)_get(data, 32);
+
+	*consumed = SIDECAR_RECORD_SIZE + (size_t)length;
+
+	return true;
+}
+
+/* Splits @length bytes of @text into lines, at each '\n', which are added to
+ * @table outside of the document
+ */
+static Piece *_decode_lines(
+	PieceTable *table, const char *text, size_t length) {
+	size_t count = 1;
+	for( size_t i = 0; i < length; ++i ) {
+		count += text[i] == '\n';
+	}
+
+	Line *lines = malloc(sizeof(*lines) * count);
+	if( !lines ) {
+		fprintf(stderr, "Failed to allocate %zu lines!\n", count);
+		exit(1);
+	}
+
+	const char *end = text + length;
+	for( size_t i = 0; i < count; ++i ) {
+		const char *eol = memchr(text, '\n', (size_t)(end - text));
+		const size_t line_length = (size_t)((eol ? eol : end) - text);
+
+		line_init_slab(&lines[i], table->slab);
+		line_insert_strn(&lines[i], 0, text, line_length);
+
+		text += line_length + 1;
+	}
+
+	Piece *pieces = piece_make_lines(table, lines, count);
+	free(lines);
+
+	return pieces;
+}
+
+/* Frees the commands of the first @count decoded nodes, and the nodes */
+static void _free_nodes(UndoNode *nodes, size_t count) {
+	for( size_t i = 0; i < count; ++i ) {
+		cmd_free_cmd(&nodes[i].cmd);
+	}
+
+	free(nodes);
+}
+
+/* Adds @length bytes to the image, which has room for @capacity */
+static void _append(Sidecar *sidecar, size_t *capacity, const void *data,
+	size_t length) {
+	if( length == 0 ) {
+		return;
+	}
+
+	if( !sidecar->image || sidecar->length + length > *capacity ) {
+		while( *capacity < sidecar->length + length ) {
+			*capacity *= 2;
+		}
+
+		char *new_image = realloc(sidecar->image, *capacity);
+		if( !new_image ) {
+			fprintf(stderr, "Failed to reallocate %zu bytes for history!\n",
+				*capacity);
+			exit(1);
+		}
+
+		sidecar->image = new_image;
+	}
+
+	memcpy(sidecar->image + sidecar->length, data, length);
+	sidecar->length += length;
+}
+
+/* Returns the length of the lines of a CMD_ADD_LINE command, joined by '\n'
+ */
+static size_t _get_lines_length(Command *cmd) {
+	PieceIter iter;
+	piece_iter_init_cut(&iter, cmd->data.block.table, cmd->data.block.pieces);
+
+	size_t total = 0, count = 0;
+
+	Line *line;
+	const char *text;
+	size_t length;
+	while( piece_iter_next(&iter, &line, &text, &length) ) {
+		total += line ? line->length : length;
+		++count;
+	}
+
+	return count > 0 ? total + count - 1 : 0;
+}
+
+/* Adds the lines of a CMD_ADD_LINE command to the image, joined by '\n' */
+static void _append_lines(Sidecar *sidecar, size_t *capacity, Command *cmd) {
+	PieceIter iter;
+	piece_iter_init_cut(&iter, cmd->data.block.table, cmd->data.block.pieces);
+
+	Line *line;
+	const char *text, *rest = NULL;
+	size_t length, rest_length = 0;
+	for( bool first = true; piece_iter_next(&iter, &line, &text, &length);
+		first = false ) {
+		if( line ) {
+			line_get_spans(line, &text, &length, &rest, &rest_length);
+		}
+
+		if( !first ) {
+			_append(sidecar, capacity, "\n", 1);
+		}
+
+		_append(sidecar, capacity, text, length);
+		if( line ) {
+			_append(sidecar, capacity, rest, rest_length);
+		}
+	}
+}
+
+/* Stores @value at offset @at of @data */
+static void _put(char *data, size_t at, uint64_t value) {
+	memcpy(data + at, &value, sizeof(value));
+}
+
+/* Loads the value at offset @at of @data */
+static uint64_t _get(const char *data, size_t at) {
+	uint64_t value;
+	memcpy(&value, data + at, sizeof(value));
+
+	return value;
+}
+
+#ifdef SIDECAR_POSIX
+/* Returns the path to the sidecar of @filename, a hidden file next to it */
+static char *_get_path(const char *filename) {
+	const char *slash = strrchr(filename, '/');
+	const int dir_length = slash ? (int)(slash - filename + 1) : 0;
+
+	const size_t size = strlen(filename) + sizeof("." SIDECAR_SUFFIX);
+	char *path = malloc(size);
+	if( !path ) {
+		fprintf(
+			stderr, "Failed to allocate %zu bytes for sidecar path!\n", size);
+		exit(1);
+	}
+
+	snprintf(path, size, "%.*s.%s" SIDECAR_SUFFIX, dir_length, filename,
+		filename + dir_length);
+
+	return path;
+}
+
+/* Gets the size, modification time (in nanoseconds) and inode of @filename,
+ * or zeros if it's missing
+ */
+static void _get_base(
+	const char *filename, uint64_t *size, int64_t *mtime, uint64_t *inode) {
+	*size = 0;
+	*mtime = 0;
+	*inode = 0;
+
+	struct stat st;
+	if( stat(filename, &st) == 0 ) {
+#ifdef __APPLE__
+		const struct timespec *ts = &st.st_mtimespec;
+#else
+		const struct timespec *ts = &st.st_mtim;
+#endif
+		*size = (uint64_t)st.st_size;
+		*mtime = (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+		*inode = (uint64_t)st.st_ino;
+	}
+}
+
+/* Writes @length bytes to @fd, picking up after short writes */
+static bool _write_all(int fd, const char *data, size_t length) {
+	while( length > 0 ) {
+		const ssize_t n = write(fd, data, length);
+		if( n < 0 ) {
+			if( errno == EINTR ) {
+				continue;
+			}
+
+			return false;
+		}
+
+		data += n;
+		length -= (size_t)n;
+	}
+
+	return true;
+}
+#endif
@@ -0,0 +1,209 @@
+/* edit
+ * Slab allocator for line text
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+
+#include "slab.h"
+
+static void *_alloc_big(Slab *slab, size_t size);
+static void _release_big(Slab *slab, void *ptr, size_t size);
+
+static void _new_slab(Slab *slab);
+static void _retire_slab(Slab *slab);
+
+static void _push_block(Slab *slab, size_t class, void *ptr);
+
+static size_t _get_class(size_t size);
+
+/* Initializes an empty allocator */
+void slab_init(Slab *slab) {
+	slab->slabs = NULL;
+	slab->big = NULL;
+
+	slab->cursor = NULL;
+	slab->remaining = 0;
+
+	for( size_t i = 0; i < SLAB_CLASSES; ++i ) {
+		slab->free[i] = NULL;
+	}
+
+	slab->reserved = 0;
+	slab->live = 0;
+}
+
+/* Frees every slab and block at once */
+void slab_free(Slab *slab) {
+	SlabHeader *lists[] = { slab->slabs, slab->big };
+	for( size_t i = 0; i < sizeof(lists) / sizeof(*lists); ++i ) {
+		SlabHeader *header = lists[i];
+		while( header ) {
+			SlabHeader *next = header->next;
+			free(header);
+			header = next;
+		}
+	}
+
+	slab_init(slab);
+}
+
+/* Allocates a block of at least @size bytes */
+void *slab_alloc(Slab *slab, size_t size) {
+	if( size > SLAB_MAX_BLOCK ) {
+		return _alloc_big(slab, size);
+	}
+
+	const size_t class = _get_class(size);
+	const size_t block_size = SLAB_MIN_BLOCK << class;
+
+	slab->live += block_size;
+
+	SlabBlock *block = slab->free[class];
+	if( block ) {
+		slab->free[class] = block->next;
+		return block;
+	}
+
+	if( slab->remaining < block_size ) {
+		_retire_slab(slab);
+		_new_slab(slab);
+	}
+
+	void *ptr = slab->cursor;
+	slab->cursor += block_size;
+	slab->remaining -= block_size;
+
+	return ptr;
+}
+
+/* Moves the @old_size byte block at @ptr into a block of @new_size bytes */
+void *slab_realloc(Slab *slab, void *ptr, size_t old_size, size_t new_size) {
+	if( ptr == NULL ) {
+		return slab_alloc(slab, new_size);
+	}
+
+	if( _get_class(old_size) == _get_class(new_size)
+		&& new_size <= SLAB_MAX_BLOCK ) {
+		return ptr;
+	}
+
+	void *new_ptr = slab_alloc(slab, new_size);
+	memcpy(new_ptr, ptr, MIN(old_size, new_size));
+	slab_release(slab, ptr, old_size);
+
+	return new_ptr;
+}
+
+/* Gives the @size byte block at @ptr back to the allocator */
+void slab_release(Slab *slab, void *ptr, size_t size) {
+	if( ptr == NULL ) {
+		return;
+	}
+
+	if( size > SLAB_MAX_BLOCK ) {
+		_release_big(slab, ptr, size);
+		return;
+	}
+
+	const size_t class = _get_class(size);
+	slab->live -= SLAB_MIN_BLOCK << class;
+	_push_block(slab, class, ptr);
+}
+
+/* Returns the number of bytes held from the system but not handed out */
+size_t slab_get_slack(Slab *slab) {
+	return slab->reserved - slab->live;
+}
+
+/* Allocates a block too big for any size class */
+static void *_alloc_big(Slab *slab, size_t size) {
+	SlabHeader *header = malloc(sizeof(*header) + size);
+	if( !header ) {
+		fprintf(stderr, "Failed to allocate %zu bytes for block!\n", size);
+		exit(1);
+	}
+
+	header->prev = NULL;
+	header->next = slab->big;
+	if( slab->big ) {
+		slab->big->prev = header;
+	}
+
+	slab->big = header;
+
+	slab->reserved += size;
+	slab->live += size;
+
+	return header + 1;
+}
+
+/* Frees a block too big for any size class */
+static void _release_big(Slab *slab, void *ptr, size_t size) {
+	SlabHeader *header = (SlabHeader *)ptr - 1;
+	if( header->prev ) {
+		header->prev->next = header->next;
+	} else {
+		slab->big = header->next;
+	}
+
+	if( header->next ) {
+		header->next->prev = header->prev;
+	}
+
+	free(header);
+
+	slab->reserved -= size;
+	slab->live -= size;
+}
+
+/* Starts carving blocks out of a new slab */
+static void _new_slab(Slab *slab) {
+	SlabHeader *header = malloc(sizeof(*header) + SLAB_SIZE);
+	if( !header ) {
+		fprintf(stderr, "Failed to allocate %d bytes for slab!\n", SLAB_SIZE);
+		exit(1);
+	}
+
+	header->prev = NULL;
+	header->next = slab->slabs;
+	slab->slabs = header;
+
+	slab->cursor = (char *)(header + 1);
+	slab->remaining = SLAB_SIZE;
+
+	slab->reserved += SLAB_SIZE;
+}
+
+/* Hands the unused tail of the newest slab over to the free lists */
+static void _retire_slab(Slab *slab) {
+	for( size_t class = SLAB_CLASSES; class-- > 0; ) {
+		const size_t block_size = SLAB_MIN_BLOCK << class;
+		while( slab->remaining >= block_size ) {
+			_push_block(slab, class, slab->cursor);
+			slab->cursor += block_size;
+			slab->remaining -= block_size;
+		}
+	}
+}
+
+/* Pushes a block onto the free list of its size class */
+static void _push_block(Slab *slab, size_t class, void *ptr) {
+	SlabBlock *block = ptr;
+	block->next = slab->free[class];
+	slab->free[class] = block;
+}
+
+/* Returns the size class for a block of @size bytes */
+static size_t _get_class(size_t size) {
+	size_t class = 0;
+	while( (size_t)(SLAB_MIN_BLOCK << class) < size ) {
+		++class;
+	}
+
+	return class;
+}
@@ -0,0 +1,137 @@
+/* edit
+ * Frame timing statistics
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "global.h"
+
+#include "stats.h"
+
+static long long _now(void);
+static int _compare_times(const void *a, const void *b);
+
+/* Initializes empty statistics */
+void stats_init(Stats *stats) {
+	memset(stats->current, 0, sizeof(stats->current));
+	stats->accrued = 0;
+	stats->skip = false;
+
+	stats->head = 0;
+	stats->count = 0;
+	stats->frames = 0;
+}
+
+/* Starts timing a phase */
+StatsTimer stats_start(Stats *stats) {
+	return (StatsTimer) { _now(), stats->accrued };
+}
+
+/* Stops timing a phase, adding the time since @timer started to @phase,
+ * less the time phases timed in the meantime took
+ */
+void stats_stop(Stats *stats, StatsTimer *timer, StatsPhase phase) {
+	const long long elapsed = _now() - timer->start
+		- (stats->accrued - timer->accrued);
+
+	stats->current[phase] += elapsed;
+	stats->accrued += elapsed;
+}
+
+/* Adds the frame to the window, making room by dropping the oldest one */
+void stats_end_frame(Stats *stats) {
+	if( stats->skip ) {
+		stats_drop_frame(stats);
+		return;
+	}
+
+	long long *current = stats->current;
+	current[STATS_FRAME] = current[STATS_INPUT] + current[STATS_APPLY]
+		+ current[STATS_LAYOUT] + current[STATS_RENDER];
+
+	for( size_t phase = 0; phase <= STATS_FRAME; ++phase ) {
+		stats->window[phase][stats->head] = current[phase];
+	}
+
+	stats->head = (stats->head + 1) % STATS_WINDOW;
+	stats->count = MIN(stats->count + 1, STATS_WINDOW);
+	++stats->frames;
+
+	stats_drop_frame(stats);
+}
+
+/* Forgets the frame, as for frames that only redraw */
+void stats_drop_frame(Stats *stats) {
+	memset(stats->current, 0, sizeof(stats->current));
+	stats->accrued = 0;
+	stats->skip = false;
+}
+
+/* Has the frame dropped when it ends, as for frames that waited on a prompt,
+ * whose time is mostly the user's
+ */
+void stats_skip_frame(Stats *stats) {
+	stats->skip = true;
+}
+
+/* Gets the 50th, 95th and 99th percentile time of @phase over the window, in
+ * nanoseconds, by nearest rank
+ */
+void stats_get_percentiles(
+	Stats *stats, StatsPhase phase, long long *p50, long long *p95,
+	long long *p99) {
+	*p50 = *p95 = *p99 = 0;
+	if( stats->count == 0 || phase > STATS_FRAME ) {
+		return;
+	}
+
+	long long sorted[STATS_WINDOW];
+	memcpy(sorted, stats->window[phase], sizeof(*sorted) * stats->count);
+	qsort(sorted, stats->count, sizeof(*sorted), _compare_times);
+
+	const size_t n = stats->count;
+	*p50 = sorted[(n * 50 + 99) / 100 - 1];
+	*p95 = sorted[(n * 95 + 99) / 100 - 1];
+	*p99 = sorted[(n * 99 + 99) / 100 - 1];
+}
+
+/* Returns the name of @phase */
+const char *stats_get_phase_name(StatsPhase phase) {
+	switch( phase ) {
+	case STATS_INPUT:
+		return "input";
+	case STATS_APPLY:
+		return "apply";
+	case STATS_LAYOUT:
+		return "layout";
+	case STATS_RENDER:
+		return "render";
+	case STATS_FRAME:
+		return "frame";
+	case STATS_IDLE:
+		return "idle";
+	default:
+		return "?";
+	}
+}
+
+/* Returns a monotonic clock reading, in nanoseconds */
+static long long _now(void) {
+#if defined(__linux__) || defined(__APPLE__)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	return (long long)clock() * (1000000000 / CLOCKS_PER_SEC);
+#endif
+}
+
+/* Orders times from shortest to longest */
+static int _compare_times(const void *a, const void *b) {
+	const long long x = *(const long long *)a, y = *(const long long *)b;
+	return (x > y) - (x < y);
+}
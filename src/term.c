@@ -0,0 +1,131 @@
+/* edit
+ * Terminal backends
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "global.h"
+
+#include "trace.h"
+#include "term.h"
+
+static Term *current = NULL; /* Terminal everything is drawn to */
+
+/* Frees the terminal from memory, handing the real one back to the shell */
+void term_free(Term *term) {
+	if( current == term ) {
+		current = NULL;
+	}
+
+	term->ops->free(term);
+}
+
+/* Makes @term the terminal everything is drawn to and read from */
+void term_use(Term *term) {
+	current = term;
+}
+
+/* Returns the terminal everything is drawn to */
+Term *term_get(void) {
+	return current;
+}
+
+/* Moves to row @y, column @x, where the next text goes */
+void term_move(size_t y, size_t x) {
+	current->ops->move_to(current, y, x);
+}
+
+/* Writes @length characters of @text */
+void term_put(const char *text, size_t length) {
+	current->ops->put(current, text, length);
+}
+
+/* Writes formatted text, cut off at TERM_PRINTF_MAX characters */
+void term_printf(const char *fmt, ...) {
+	char buf[TERM_PRINTF_MAX];
+
+	va_list args;
+	va_start(args, fmt);
+	const int len = vsnprintf(buf, TERM_PRINTF_MAX, fmt, args);
+	va_end(args);
+
+	if( len > 0 ) {
+		term_put(buf, MIN((size_t)len, TERM_PRINTF_MAX - 1));
+	}
+}
+
+/* Clears the rest of the row */
+void term_clear_to_eol(void) {
+	current->ops->clear_to_eol(current);
+}
+
+/* Scrolls rows @top to @bottom (inclusive) up @by rows, or down if @by is
+ * negative
+ */
+void term_scroll(size_t top, size_t bottom, long by) {
+	current->ops->scroll_rows(current, top, bottom, by);
+}
+
+/* Opens a popup of @h rows and @w columns at row @y, column @x */
+void term_popup_open(size_t y, size_t x, size_t h, size_t w) {
+	current->ops->popup_open(current, y, x, h, w);
+}
+
+/* Writes @length characters of @text at row @y, column @x of the popup */
+void term_popup_put(size_t y, size_t x, const char *text, size_t length) {
+	current->ops->popup_put(current, y, x, text, length);
+}
+
+/* Clears row @y of the popup from column @x on */
+void term_popup_clear_to_eol(size_t y, size_t x) {
+	current->ops->popup_clear_to_eol(current, y, x);
+}
+
+/* Draws a border around the edge of the popup */
+void term_popup_border(void) {
+	current->ops->popup_border(current);
+}
+
+/* Closes the popup, showing what was under it again */
+void term_popup_close(void) {
+	current->ops->popup_close(current);
+}
+
+/* Shows or hides the cursor */
+void term_show_cursor(bool visible) {
+	current->ops->show_cursor(current, visible);
+}
+
+/* Writes an escape sequence ncurses doesn't know about straight through */
+void term_write_raw(const char *seq) {
+	current->ops->write_raw(current, seq);
+}
+
+/* Shows everything written since the last refresh */
+void term_refresh(void) {
+	TRACE_BEGIN(span, "refresh");
+	current->ops->flush(current);
+	TRACE_END(span);
+}
+
+/* Waits up to @timeout milliseconds for a key, or forever if it is negative
+ * Returns ERR if there was none
+ */
+int term_get_key(int timeout) {
+	return current->ops->get_key(current, timeout);
+}
+
+/* Reads the text of a paste, up to its end marker, into @text */
+void term_read_paste(Line *text) {
+	current->ops->read_paste(current, text);
+}
+
+/* Puts @length characters of @text in front of the keys waiting to be read,
+ * so they are read next, in order
+ */
+void term_push_keys(const char *text, size_t length) {
+	current->ops->push_keys(current, text, length);
+}
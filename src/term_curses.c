@@ -0,0 +1,404 @@
+/* edit
+ * Terminal backend drawing to the real terminal through ncurses
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#ifdef USE_PDCURSES
+#include <curses.h>
+#else
+#include <ncurses.h>
+#endif
+
+#include "global.h"
+
+#include "line.h"
+#include "term.h"
+
+#define ENABLE_BRACKETED_PASTE "\x1b[?2004h"
+#define DISABLE_BRACKETED_PASTE "\x1b[?2004l"
+#define PASTE_BEGIN "\x1b[200~"
+#define PASTE_END "\x1b[201~"
+
+#define PASTE_TIMEOUT_MS (1000) /* How long a paste may stall before it ends */
+#define PASTE_CHUNK (64 * 1024) /* Bytes of a paste to read at once */
+
+static void _free(Term *term);
+
+static void _move(Term *term, size_t y, size_t x);
+static void _put(Term *term, const char *text, size_t length);
+static void _clear_to_eol(Term *term);
+static void _scroll(Term *term, size_t top, size_t bottom, long by);
+
+static void _popup_open(Term *term, size_t y, size_t x, size_t h, size_t w);
+static void _popup_put(
+	Term *term, size_t y, size_t x, const char *text, size_t length);
+static void _popup_clear_to_eol(Term *term, size_t y, size_t x);
+static void _popup_border(Term *term);
+static void _popup_close(Term *term);
+
+static void _show_cursor(Term *term, bool visible);
+static void _write_raw(Term *term, const char *seq);
+static void _refresh(Term *term);
+
+static int _get_key(Term *term, int ms);
+static void _read_paste(Term *term, Line *text);
+static void _push_keys(Term *term, const char *text, size_t length);
+static const char *_find_paste_end(const char *buf, size_t length);
+
+static const TermOps ops = {
+	.free = _free,
+
+	.move_to = _move,
+	.put = _put,
+	.clear_to_eol = _clear_to_eol,
+	.scroll_rows = _scroll,
+
+	.popup_open = _popup_open,
+	.popup_put = _popup_put,
+	.popup_clear_to_eol = _popup_clear_to_eol,
+	.popup_border = _popup_border,
+	.popup_close = _popup_close,
+
+	.show_cursor = _show_cursor,
+	.write_raw = _write_raw,
+	.flush = _refresh,
+
+	.get_key = _get_key,
+	.read_paste = _read_paste,
+	.push_keys = _push_keys,
+};
+
+/* Initializes ncurses and takes over the terminal */
+void term_init_curses(Term *term) {
+	initscr();
+
+	/* Set up ncurses to:
+	 * 1. Immediately return characters without waiting for a newline
+	 * 2. Not echo characters to the screen
+	 * 3. Read keypad input
+	 * 4. Move lines with the terminal's own scrolling and line insertion
+	 */
+	cbreak();
+	noecho();
+	keypad(stdscr, true);
+	idlok(stdscr, true);
+
+	curs_set(1);
+
+	/* Initializes color pairs */
+	if( has_colors() ) {
+		start_color();
+		init_pair(COLP_RED, COLOR_RED, COLOR_BLACK);
+		init_pair(COLP_GREEN, COLOR_GREEN, COLOR_BLACK);
+		init_pair(COLP_YELLOW, COLOR_YELLOW, COLOR_BLACK);
+		init_pair(COLP_BLUE, COLOR_BLUE, COLOR_BLACK);
+		init_pair(COLP_MAGENTA, COLOR_MAGENTA, COLOR_BLACK);
+		init_pair(COLP_CYAN, COLOR_CYAN, COLOR_BLACK);
+		init_pair(COLP_BLACK, COLOR_BLACK, COLOR_WHITE);
+	}
+
+	refresh();
+
+	term->ops = &ops;
+	term->w = COLS;
+	term->h = LINES;
+	memset(&term->stats, 0, sizeof(term->stats));
+
+	term->as.curses.input = newpad(1, 1);
+	keypad(term->as.curses.input, true);
+	nodelay(term->as.curses.input, true);
+	term->as.curses.popup = NULL;
+
+	term->as.curses.pushed = NULL;
+	term->as.curses.pushed_length = 0;
+	term->as.curses.pushed_capacity = 0;
+
+	/* Pastes come wrapped in markers, so they can be told apart from typing */
+#ifndef USE_PDCURSES
+	define_key(PASTE_BEGIN, KEY_PASTE_BEGIN);
+	define_key(PASTE_END, KEY_PASTE_END);
+#endif
+	_write_raw(term, ENABLE_BRACKETED_PASTE);
+}
+
+/* Hands the terminal back to the shell */
+static void _free(Term *term) {
+	if( term->as.curses.popup ) {
+		delwin(term->as.curses.popup);
+		term->as.curses.popup = NULL;
+	}
+
+	delwin(term->as.curses.input);
+	term->as.curses.input = NULL;
+
+	free(term->as.curses.pushed);
+	term->as.curses.pushed = NULL;
+	term->as.curses.pushed_length = 0;
+	_write_raw(term, DISABLE_BRACKETED_PASTE);
+
+	endwin();
+}
+
+/* Moves the cursor, which is where the next text goes */
+static void _move(Term *term, size_t y, size_t x) {
+	UNUSED(term);
+	move(y, x);
+}
+
+/* Writes @length characters of @text at the cursor */
+static void _put(Term *term, const char *text, size_t length) {
+	UNUSED(term);
+	addnstr(text, length);
+}
+
+/* Clears the rest of the cursor's row */
+static void _clear_to_eol(Term *term) {
+	UNUSED(term);
+	clrtoeol();
+}
+
+/* Scrolls through a scroll region, so the terminal moves the rows itself */
+static void _scroll(Term *term, size_t top, size_t bottom, long by) {
+	UNUSED(term);
+
+	scrollok(stdscr, true);
+	wsetscrreg(stdscr, top, bottom);
+	wscrl(stdscr, by);
+	scrollok(stdscr, false);
+}
+
+/* Opens a popup in a window of its own, so what is under it is still in the
+ * main window when it closes
+ */
+static void _popup_open(Term *term, size_t y, size_t x, size_t h, size_t w) {
+	WINDOW *win = newwin(h, w, y, x);
+	werase(win);
+
+	term->as.curses.popup = win;
+}
+
+/* Writes @length characters of @text into the popup */
+static void _popup_put(
+	Term *term, size_t y, size_t x, const char *text, size_t length) {
+	mvwaddnstr(term->as.curses.popup, y, x, text, length);
+}
+
+/* Clears a row of the popup */
+static void _popup_clear_to_eol(Term *term, size_t y, size_t x) {
+	wmove(term->as.curses.popup, y, x);
+	wclrtoeol(term->as.curses.popup);
+}
+
+/* Boxes in the popup */
+static void _popup_border(Term *term) {
+	box(term->as.curses.popup, 0, 0);
+}
+
+/* Closes the popup and draws what was under it again */
+static void _popup_close(Term *term) {
+	delwin(term->as.curses.popup);
+	term->as.curses.popup = NULL;
+
+	touchwin(stdscr);
+	refresh();
+}
+
+/* Shows or hides the cursor */
+static void _show_cursor(Term *term, bool visible) {
+	UNUSED(term);
+	curs_set(visible ? 1 : 0);
+}
+
+/* Writes a raw string to standard output */
+static void _write_raw(Term *term, const char *seq) {
+	UNUSED(term);
+
+	fputs(seq, stdout);
+	fflush(stdout);
+}
+
+/* Sends what changed to the terminal, with the popup over everything else */
+static void _refresh(Term *term) {
+	WINDOW *popup = term->as.curses.popup;
+	if( popup == NULL ) {
+		refresh();
+		return;
+	}
+
+	wnoutrefresh(stdscr);
+	touchwin(popup);
+	wnoutrefresh(popup);
+	doupdate();
+}
+
+/* Reads a key
+ *
+ * Keys already waiting are read from the input pad, as reading the main
+ * window refreshes it. Waiting for one is done on the main window, as what
+ * was drawn has to be shown by then anyway
+ */
+static int _get_key(Term *term, int ms) {
+	if( term->as.curses.pushed_length > 0 ) {
+		return (unsigned char)term->as.curses.pushed[
+			--term->as.curses.pushed_length];
+	}
+
+	int ch;
+	if( ms == 0 ) {
+		ch = wgetch(term->as.curses.input);
+	} else {
+		timeout(ms);
+		ch = getch();
+		timeout(-1);
+	}
+
+	if( ch == KEY_RESIZE ) {
+		endwin();
+		refresh();
+
+		term->w = COLS;
+		term->h = LINES;
+	}
+
+	return ch;
+}
+
+/* Reads the text of a paste, up to its end marker, into @text
+ *
+ * ncurses reads input a byte at a time, which is far too slow for a large
+ * paste, so where possible the terminal is read from directly, in chunks.
+ * Nothing ncurses read ahead is skipped, as it stops reading right after the
+ * start marker, and anything typed after the end marker is put back to be
+ * read next
+ */
+static void _read_paste(Term *term, Line *text) {
+#if defined(__linux__) || defined(__APPLE__)
+	size_t length = 0, capacity = PASTE_CHUNK;
+	char *buf = malloc(capacity);
+	if( !buf ) {
+		fprintf(stderr, "Failed to allocate paste of %zu bytes!\n", capacity);
+		exit(1);
+	}
+
+	const size_t marker = strlen(PASTE_END);
+	const char *end = NULL;
+
+	struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+	while( end == NULL && poll(&pfd, 1, PASTE_TIMEOUT_MS) > 0 ) {
+		if( capacity - length < PASTE_CHUNK ) {
+			capacity *= 2;
+			buf = realloc(buf, capacity);
+			if( !buf ) {
+				fprintf(stderr, "Failed to allocate paste of %zu bytes!\n",
+					capacity);
+				exit(1);
+			}
+		}
+
+		const ssize_t n = read(STDIN_FILENO, buf + length, PASTE_CHUNK);
+		if( n <= 0 ) {
+			break;
+		}
+
+		/* The marker may have been split between reads */
+		const size_t from = length > marker ? length - marker : 0;
+		length += (size_t)n;
+		end = _find_paste_end(buf + from, length - from);
+	}
+
+	size_t payload = length;
+	if( end ) {
+		payload = end - buf;
+		_push_keys(term, end + marker, length - payload - marker);
+	}
+
+	/* Terminals send line breaks as carriage returns */
+	for( size_t i = 0; i < payload; ++i ) {
+		if( buf[i] == '\r' ) {
+			if( i + 1 < payload && buf[i + 1] == '\n' ) {
+				continue;
+			}
+
+			buf[i] = '\n';
+		}
+
+		line_insert_char_at_end(text, buf[i]);
+	}
+
+	free(buf);
+#else
+	WINDOW *input = term->as.curses.input;
+	wtimeout(input, PASTE_TIMEOUT_MS);
+
+	int ch;
+	while( (ch = wgetch(input)) != ERR && ch != KEY_PASTE_END ) {
+		if( ch == '\r' ) {
+			ch = '\n';
+		}
+
+		/* Keys ncurses made out of escape sequences have no text */
+		if( ch >= 0 && ch <= 0xff ) {
+			line_insert_char_at_end(text, (char)ch);
+		}
+	}
+
+	nodelay(input, true);
+#endif
+}
+
+/* Returns where the end marker of a paste starts in @buf, or NULL */
+static const char *_find_paste_end(const char *buf, size_t length) {
+	const size_t marker = strlen(PASTE_END);
+
+	const char *c = buf;
+	while( (c = memchr(c, PASTE_END[0], buf + length - c)) ) {
+		if( (size_t)(buf + length - c) < marker ) {
+			return NULL;
+		}
+
+		if( memcmp(c, PASTE_END, marker) == 0 ) {
+			return c;
+		}
+
+		++c;
+	}
+
+	return NULL;
+}
+
+/* Puts @length characters of @text back to be read before anything else
+ *
+ * They are kept here rather than handed to ungetch(), which only has room for
+ * a few hundred keys
+ */
+static void _push_keys(Term *term, const char *text, size_t length) {
+	const size_t needed = term->as.curses.pushed_length + length;
+	if( needed > term->as.curses.pushed_capacity ) {
+		size_t capacity = MAX(term->as.curses.pushed_capacity, PASTE_CHUNK);
+		while( capacity < needed ) {
+			capacity *= 2;
+		}
+
+		term->as.curses.pushed = realloc(term->as.curses.pushed, capacity);
+		if( !term->as.curses.pushed ) {
+			fprintf(stderr, "Failed to allocate %zu keys!\n", capacity);
+			exit(1);
+		}
+		term->as.curses.pushed_capacity = capacity;
+	}
+
+	/* The last key in is the first out, so they go in backwards */
+	for( size_t i = length; i-- > 0; ) {
+		term->as.curses.pushed[term->as.curses.pushed_length++] = text[i];
+	}
+}
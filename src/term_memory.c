@@ -0,0 +1,413 @@
+/* edit
+ * Terminal backend drawing to a grid of cells in memory
+ *
+ * Nothing is sent anywhere, but what would have been is counted, so the
+ * editor can be run and measured without a terminal
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+
+#include "line.h"
+#include "term.h"
+
+#define MOVE_SEQ "\x1b[%zu;%zuH" /* Sequence moving the cursor */
+#define SCROLL_REGION_SEQ "\x1b[%zu;%zur" /* Sequence setting a scroll region */
+#define SCROLL_SEQ "\x1b[%luS" /* Sequence scrolling the region */
+#define RESET_REGION_SEQ "\x1b[r" /* Sequence resetting the scroll region */
+#define CLEAR_TO_EOL_SEQ "\x1b[K" /* Sequence clearing the rest of a row */
+#define CURSOR_SEQ "\x1b[?25h" /* Sequence showing or hiding the cursor */
+
+#define BORDER_CELL_BYTES (3) /* Bytes of a line-drawing character in UTF-8 */
+
+#define KEYS_INITIAL (64) /* Keys the queue has room for at first */
+
+#define CURSOR_UNKNOWN ((size_t)-1) /* Cursor position after a scroll */
+
+static void _free(Term *term);
+
+static void _move(Term *term, size_t y, size_t x);
+static void _put(Term *term, const char *text, size_t length);
+static void _clear_to_eol(Term *term);
+static void _scroll(Term *term, size_t top, size_t bottom, long by);
+
+static void _popup_open(Term *term, size_t y, size_t x, size_t h, size_t w);
+static void _popup_put(
+	Term *term, size_t y, size_t x, const char *text, size_t length);
+static void _popup_clear_to_eol(Term *term, size_t y, size_t x);
+static void _popup_border(Term *term);
+static void _popup_close(Term *term);
+
+static void _show_cursor(Term *term, bool visible);
+static void _write_raw(Term *term, const char *seq);
+static void _refresh(Term *term);
+
+static int _get_key(Term *term, int ms);
+static void _read_paste(Term *term, Line *text);
+static void _push_keys(Term *term, const char *text, size_t length);
+
+static void _send_move(Term *term, size_t y, size_t x);
+static void _write_cells(Term *term, char *cells, size_t w, size_t y,
+	size_t x, const char *text, size_t length);
+static void _grow_keys(Term *term);
+static void *_grow(void *ptr, size_t size);
+
+static const TermOps ops = {
+	.free = _free,
+
+	.move_to = _move,
+	.put = _put,
+	.clear_to_eol = _clear_to_eol,
+	.scroll_rows = _scroll,
+
+	.popup_open = _popup_open,
+	.popup_put = _popup_put,
+	.popup_clear_to_eol = _popup_clear_to_eol,
+	.popup_border = _popup_border,
+	.popup_close = _popup_close,
+
+	.show_cursor = _show_cursor,
+	.write_raw = _write_raw,
+	.flush = _refresh,
+
+	.get_key = _get_key,
+	.read_paste = _read_paste,
+	.push_keys = _push_keys,
+};
+
+/* Initializes a blank terminal of @w columns and @h rows in memory, with no
+ * keys to read
+ */
+void term_init_memory(Term *term, size_t w, size_t h) {
+	term->ops = &ops;
+	term->w = w;
+	term->h = h;
+	memset(&term->stats, 0, sizeof(term->stats));
+
+	term->as.memory.cells = _grow(NULL, MAX(w * h, 1));
+	memset(term->as.memory.cells, ' ', w * h);
+	term->as.memory.y = 0;
+	term->as.memory.x = 0;
+	term->as.memory.cy = 0;
+	term->as.memory.cx = 0;
+
+	term->as.memory.popup = NULL;
+	term->as.memory.py = 0;
+	term->as.memory.px = 0;
+	term->as.memory.ph = 0;
+	term->as.memory.pw = 0;
+
+	term->as.memory.keys = _grow(NULL, sizeof(int) * KEYS_INITIAL);
+	term->as.memory.head = 0;
+	term->as.memory.length = 0;
+	term->as.memory.capacity = KEYS_INITIAL;
+}
+
+/* Adds @key to the keys waiting to be read from a terminal in memory */
+void term_push_key(Term *term, int key) {
+	if( term->as.memory.length == term->as.memory.capacity ) {
+		_grow_keys(term);
+	}
+
+	const size_t tail = (term->as.memory.head + term->as.memory.length)
+		& (term->as.memory.capacity - 1);
+	term->as.memory.keys[tail] = key;
+	++term->as.memory.length;
+}
+
+/* Returns the @w cells of row @y of a terminal in memory, under any popup */
+const char *term_get_row(Term *term, size_t y) {
+	return term->as.memory.cells + y * term->w;
+}
+
+/* Frees the grid and the keys left unread */
+static void _free(Term *term) {
+	free(term->as.memory.cells);
+	free(term->as.memory.popup);
+	free(term->as.memory.keys);
+
+	term->as.memory.cells = NULL;
+	term->as.memory.popup = NULL;
+	term->as.memory.keys = NULL;
+	term->as.memory.length = 0;
+}
+
+/* Moves where the next text goes
+ * The terminal's cursor is only moved once something is written there
+ */
+static void _move(Term *term, size_t y, size_t x) {
+	term->as.memory.y = y;
+	term->as.memory.x = x;
+}
+
+/* Writes @length characters of @text, cut off at the edge of the terminal */
+static void _put(Term *term, const char *text, size_t length) {
+	const size_t y = term->as.memory.y, x = term->as.memory.x;
+	if( y >= term->h || x >= term->w || length == 0 ) {
+		return;
+	}
+
+	length = MIN(length, term->w - x);
+	_write_cells(term, term->as.memory.cells, term->w, y, x, text, length);
+	term->as.memory.x = x + length;
+}
+
+/* Blanks the rest of the row */
+static void _clear_to_eol(Term *term) {
+	const size_t y = term->as.memory.y, x = term->as.memory.x;
+	if( y >= term->h || x >= term->w ) {
+		return;
+	}
+
+	_send_move(term, y, x);
+	term->stats.bytes += strlen(CLEAR_TO_EOL_SEQ);
+	memset(term->as.memory.cells + y * term->w + x, ' ', term->w - x);
+}
+
+/* Moves the rows of the scroll region, blanking the ones scrolled in */
+static void _scroll(Term *term, size_t top, size_t bottom, long by) {
+	const size_t n = by < 0 ? (size_t)-by : (size_t)by;
+	const size_t rows = bottom - top + 1;
+	if( n == 0 || bottom >= term->h || top > bottom ) {
+		return;
+	}
+
+	term->stats.bytes
+		+= snprintf(NULL, 0, SCROLL_REGION_SEQ, top + 1, bottom + 1)
+		+ snprintf(NULL, 0, SCROLL_SEQ, (unsigned long)n)
+		+ strlen(RESET_REGION_SEQ);
+
+	const size_t w = term->w;
+	char *region = term->as.memory.cells + top * w;
+	if( n >= rows ) {
+		memset(region, ' ', rows * w);
+	} else if( by > 0 ) {
+		memmove(region, region + n * w, (rows - n) * w);
+		memset(region + (rows - n) * w, ' ', n * w);
+	} else {
+		memmove(region + n * w, region, (rows - n) * w);
+		memset(region, ' ', n * w);
+	}
+
+	/* Resetting the scroll region homes the cursor */
+	term->as.memory.cy = CURSOR_UNKNOWN;
+}
+
+/* Opens a blank popup */
+static void _popup_open(Term *term, size_t y, size_t x, size_t h, size_t w) {
+	term->as.memory.popup = _grow(term->as.memory.popup, MAX(w * h, 1));
+	memset(term->as.memory.popup, ' ', w * h);
+
+	term->as.memory.py = y;
+	term->as.memory.px = x;
+	term->as.memory.ph = h;
+	term->as.memory.pw = w;
+
+	/* The whole of it is blanked on the terminal */
+	for( size_t row = 0; row < h; ++row ) {
+		_write_cells(term, term->as.memory.popup, w, row, 0,
+			term->as.memory.popup + row * w, w);
+	}
+}
+
+/* Writes @length characters of @text into the popup */
+static void _popup_put(
+	Term *term, size_t y, size_t x, const char *text, size_t length) {
+	const size_t pw = term->as.memory.pw;
+	if( y >= term->as.memory.ph || x >= pw ) {
+		return;
+	}
+
+	_write_cells(term, term->as.memory.popup, pw, y, x, text,
+		MIN(length, pw - x));
+}
+
+/* Blanks row @y of the popup from column @x on */
+static void _popup_clear_to_eol(Term *term, size_t y, size_t x) {
+	const size_t pw = term->as.memory.pw;
+	if( y >= term->as.memory.ph || x >= pw ) {
+		return;
+	}
+
+	_send_move(term, term->as.memory.py + y, term->as.memory.px + x);
+	term->stats.bytes += strlen(CLEAR_TO_EOL_SEQ);
+	memset(term->as.memory.popup + y * pw + x, ' ', pw - x);
+}
+
+/* Boxes in the popup, with line-drawing characters on a real terminal */
+static void _popup_border(Term *term) {
+	const size_t ph = term->as.memory.ph, pw = term->as.memory.pw;
+	char *popup = term->as.memory.popup;
+	if( ph < 2 || pw < 2 ) {
+		return;
+	}
+
+	for( size_t x = 0; x < pw; ++x ) {
+		popup[x] = popup[(ph - 1) * pw + x] = '-';
+	}
+
+	for( size_t y = 0; y < ph; ++y ) {
+		popup[y * pw] = popup[y * pw + pw - 1] = '|';
+	}
+
+	const size_t cells = 2 * pw + 2 * (ph - 2);
+	term->stats.cells += cells;
+	term->stats.bytes += cells * BORDER_CELL_BYTES
+		+ ph * snprintf(NULL, 0, MOVE_SEQ, term->h, term->w);
+	term->as.memory.cy = CURSOR_UNKNOWN;
+}
+
+/* Closes the popup, drawing the rows of the grid under it again */
+static void _popup_close(Term *term) {
+	const size_t py = term->as.memory.py, px = term->as.memory.px;
+	const size_t ph = term->as.memory.ph, pw = term->as.memory.pw;
+
+	for( size_t y = py; y < py + ph && y < term->h; ++y ) {
+		if( px >= term->w ) {
+			break;
+		}
+
+		const size_t length = MIN(pw, term->w - px);
+		char *cells = term->as.memory.cells;
+		_write_cells(term, cells, term->w, y, px, cells + y * term->w + px,
+			length);
+	}
+
+	free(term->as.memory.popup);
+	term->as.memory.popup = NULL;
+	term->as.memory.ph = 0;
+	term->as.memory.pw = 0;
+
+	++term->stats.frames;
+}
+
+/* Counts the sequence showing or hiding the cursor */
+static void _show_cursor(Term *term, bool visible) {
+	UNUSED(visible);
+	term->stats.bytes += strlen(CURSOR_SEQ);
+}
+
+/* Counts a raw string, which changes nothing in the grid */
+static void _write_raw(Term *term, const char *seq) {
+	term->stats.bytes += strlen(seq);
+}
+
+/* Counts a frame
+ * The cursor is left where the editor put it
+ */
+static void _refresh(Term *term) {
+	_send_move(term, term->as.memory.y, term->as.memory.x);
+	++term->stats.frames;
+}
+
+/* Takes the next key off the queue, without waiting for one, so ERR means
+ * there are no keys left
+ */
+static int _get_key(Term *term, int ms) {
+	UNUSED(ms);
+
+	if( term->as.memory.length == 0 ) {
+		return ERR;
+	}
+
+	const int key = term->as.memory.keys[term->as.memory.head];
+	term->as.memory.head = (term->as.memory.head + 1)
+		& (term->as.memory.capacity - 1);
+	--term->as.memory.length;
+
+	return key;
+}
+
+/* Takes keys off the queue up to the end marker of a paste, as its text */
+static void _read_paste(Term *term, Line *text) {
+	int ch;
+	while( (ch = _get_key(term, 0)) != ERR && ch != KEY_PASTE_END ) {
+		if( ch == '\r' ) {
+			ch = '\n';
+		}
+
+		if( ch >= 0 && ch <= 0xff ) {
+			line_insert_char_at_end(text, (char)ch);
+		}
+	}
+}
+
+/* Puts @length characters of @text at the front of the queue */
+static void _push_keys(Term *term, const char *text, size_t length) {
+	while( term->as.memory.capacity - term->as.memory.length < length ) {
+		_grow_keys(term);
+	}
+
+	for( size_t i = length; i-- > 0; ) {
+		term->as.memory.head = (term->as.memory.head - 1)
+			& (term->as.memory.capacity - 1);
+		term->as.memory.keys[term->as.memory.head] = (unsigned char)text[i];
+		++term->as.memory.length;
+	}
+}
+
+/* Counts the bytes moving the cursor to row @y, column @x, unless it is
+ * already there
+ */
+static void _send_move(Term *term, size_t y, size_t x) {
+	if( term->as.memory.cy == y && term->as.memory.cx == x ) {
+		return;
+	}
+
+	term->stats.bytes += snprintf(NULL, 0, MOVE_SEQ, y + 1, x + 1);
+	term->as.memory.cy = y;
+	term->as.memory.cx = x;
+}
+
+/* Writes @length characters of @text to row @y, column @x of the @w columns
+ * wide @cells, which the caller has made sure they fit in
+ *
+ * Popup cells are counted where they are on the terminal
+ */
+static void _write_cells(Term *term, char *cells, size_t w, size_t y,
+	size_t x, const char *text, size_t length) {
+	size_t ty = y, tx = x;
+	if( cells == term->as.memory.popup ) {
+		ty += term->as.memory.py;
+		tx += term->as.memory.px;
+	}
+
+	_send_move(term, ty, tx);
+	memmove(cells + y * w + x, text, length);
+
+	term->stats.cells += length;
+	term->stats.bytes += length;
+	term->as.memory.cx = tx + length;
+}
+
+/* Doubles the ring of keys, unwrapping it so the next key is first */
+static void _grow_keys(Term *term) {
+	const size_t capacity = term->as.memory.capacity;
+	int *keys = _grow(NULL, sizeof(int) * capacity * 2);
+	for( size_t i = 0; i < term->as.memory.length; ++i ) {
+		keys[i] = term->as.memory.keys[(term->as.memory.head + i)
+			& (capacity - 1)];
+	}
+
+	free(term->as.memory.keys);
+	term->as.memory.keys = keys;
+	term->as.memory.head = 0;
+	term->as.memory.capacity = capacity * 2;
+}
+
+/* Reallocates @ptr to @size bytes, exiting if that fails */
+static void *_grow(void *ptr, size_t size) {
+	void *grown = realloc(ptr, size);
+	if( !grown ) {
+		fprintf(stderr, "Failed to allocate %zu bytes for the terminal!\n",
+			size);
+		exit(1);
+	}
+
+	return grown;
+}
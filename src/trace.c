@@ -0,0 +1,400 @@
+/* edit
+ * Trace-event export
+ *
+ * Spans are written as Chrome trace events, which Perfetto and
+ * chrome://tracing can both open
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(EDIT_TRACE) && defined(__GNUC__) \
+	&& (defined(__linux__) || defined(__APPLE__))
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#define TRACE_POSIX
+#endif
+
+#include "global.h"
+
+#include "trace.h"
+
+#ifdef TRACE_POSIX
+/* A finished span */
+typedef struct _TraceEvent {
+	const char *name;
+	const char *arg; /* Name of its argument, or NULL if it has none */
+	long long value; /* Value of its argument */
+	long long start; /* When it started, in nanoseconds */
+	long long duration; /* How long it took, in nanoseconds */
+	unsigned tid; /* Thread it ran on */
+} TraceEvent;
+
+/* Spans a thread has finished, waiting to be written out
+ *
+ * Only the thread owning the buffer moves the head, and only the flusher moves
+ * the tail, so neither ever waits on the other. Spans that don't fit are
+ * counted and dropped rather than waiting for room
+ */
+typedef struct _TraceBuffer {
+	TraceEvent events[TRACE_RING];
+	size_t head; /* Where the next event goes */
+	size_t tail; /* Next event to write out */
+	size_t dropped; /* Events that didn't fit */
+
+	size_t reported; /* Drops already counted by the flusher */
+	unsigned named; /* Last thread the flusher wrote the name of */
+
+	unsigned tid; /* Thread owning it */
+	bool claimed; /* Whether a thread owns it */
+	struct _TraceBuffer *next;
+} TraceBuffer;
+
+/* Buffers outlive their threads, and are handed to the next thread to trace
+ * anything, so threads made for each load or save don't use up memory
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; /* Guards below */
+static TraceBuffer *buffers = NULL; /* Every buffer made so far */
+static unsigned last_tid = 0; /* Last thread a buffer was claimed for */
+
+/* Only the flusher writes out while it runs, and only trace_start() and
+ * trace_stop() while it doesn't, so none of it needs the lock
+ */
+static FILE *out = NULL; /* File being traced to */
+static bool first = true; /* Whether no event has been written yet */
+static size_t lost = 0; /* Events dropped since tracing started */
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t key; /* Buffer of the calling thread */
+
+static pthread_t flusher; /* Thread writing out events */
+static bool running = false; /* Whether spans are being recorded */
+static bool stopping = false; /* Whether the flusher should finish */
+
+static long long epoch = 0; /* When tracing started */
+static unsigned main_tid = 0; /* Thread that started tracing */
+
+static void _create_key(void);
+static void _release_buffer(void *arg);
+static TraceBuffer *_get_buffer(void);
+
+static void *_run(void *arg);
+static void _drain(void);
+
+static void _begin_event(void);
+static void _write_event(TraceEvent *event);
+static void _write_name(const char *what, unsigned tid, const char *name);
+static void _write_time(const char *field, long long ns);
+
+static long long _now(void);
+#endif
+
+/* Starts writing spans to @filename, replacing it
+ * Returns false, with errno set, if it can't be opened, tracing has already
+ * started, or tracing isn't available
+ */
+bool trace_start(const char *filename) {
+#ifdef TRACE_POSIX
+	if( trace_is_running() ) {
+		errno = EBUSY;
+		return false;
+	}
+
+	pthread_once(&key_once, _create_key);
+
+	FILE *fp = fopen(filename, "w");
+	if( !fp ) {
+		return false;
+	}
+
+	pthread_mutex_lock(&lock);
+
+	out = fp;
+	first = true;
+	lost = 0;
+	epoch = _now();
+
+	/* Spans that finished after the last trace stopped don't belong here */
+	for( TraceBuffer *buffer = buffers; buffer; buffer = buffer->next ) {
+		const size_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+		__atomic_store_n(&buffer->tail, head, __ATOMIC_RELEASE);
+
+		buffer->reported = __atomic_load_n(&buffer->dropped, __ATOMIC_RELAXED);
+		buffer->named = 0;
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", out);
+	_write_name("process_name", 0, "edit");
+
+	main_tid = _get_buffer()->tid;
+
+	__atomic_store_n(&stopping, false, __ATOMIC_RELEASE);
+	__atomic_store_n(&running, true, __ATOMIC_RELEASE);
+
+	const int err = pthread_create(&flusher, NULL, _run, NULL);
+	if( err != 0 ) {
+		__atomic_store_n(&running, false, __ATOMIC_RELEASE);
+
+		fclose(out);
+		out = NULL;
+
+		errno = err;
+		return false;
+	}
+
+	return true;
+#else
+	UNUSED(filename);
+
+	errno = ENOSYS;
+	return false;
+#endif
+}
+
+/* Stops tracing, writing out every span that finished before it stopped
+ * Returns false, with errno set, if the trace couldn't be written in full
+ */
+bool trace_stop(void) {
+#ifdef TRACE_POSIX
+	if( !trace_is_running() ) {
+		return true;
+	}
+
+	__atomic_store_n(&running, false, __ATOMIC_RELEASE);
+	__atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+	pthread_join(flusher, NULL);
+
+	_drain();
+
+	if( lost > 0 ) {
+		_begin_event();
+		fprintf(out, "{\"name\":\"dropped events\",\"ph\":\"C\",\"pid\":%d,"
+			"\"tid\":%u,", (int)getpid(), main_tid);
+		_write_time("ts", _now() - epoch);
+		fprintf(out, ",\"args\":{\"count\":%zu}}", lost);
+	}
+
+	fputs("\n]}\n", out);
+
+	bool ok = !ferror(out);
+	ok = fclose(out) == 0 && ok;
+	out = NULL;
+
+	return ok;
+#else
+	return true;
+#endif
+}
+
+/* Returns if spans are being recorded */
+bool trace_is_running(void) {
+#ifdef TRACE_POSIX
+	return __atomic_load_n(&running, __ATOMIC_ACQUIRE);
+#else
+	return false;
+#endif
+}
+
+/* Starts a span called @name, which has to outlive the trace */
+TraceSpan trace_begin(const char *name) {
+	TraceSpan span = { name, -1 };
+
+#ifdef TRACE_POSIX
+	if( __atomic_load_n(&running, __ATOMIC_RELAXED) ) {
+		span.start = _now();
+	}
+#endif
+
+	return span;
+}
+
+/* Ends @span, giving it an argument called @arg with @value if @arg isn't NULL
+ * Only ever copies the span into the buffer of the calling thread
+ */
+void trace_end(TraceSpan *span, const char *arg, long long value) {
+#ifdef TRACE_POSIX
+	if( span->start < 0 || !__atomic_load_n(&running, __ATOMIC_ACQUIRE) ) {
+		return;
+	}
+
+	const long long end = _now();
+
+	TraceBuffer *buffer = _get_buffer();
+	const size_t head = buffer->head;
+	const size_t tail = __atomic_load_n(&buffer->tail, __ATOMIC_ACQUIRE);
+	if( head - tail == TRACE_RING ) {
+		__atomic_store_n(&buffer->dropped, buffer->dropped + 1,
+			__ATOMIC_RELAXED);
+		return;
+	}
+
+	TraceEvent *event = &buffer->events[head & (TRACE_RING - 1)];
+	event->name = span->name;
+	event->arg = arg;
+	event->value = value;
+	event->start = span->start;
+	event->duration = end - span->start;
+	event->tid = buffer->tid;
+
+	__atomic_store_n(&buffer->head, head + 1, __ATOMIC_RELEASE);
+#else
+	UNUSED(span);
+	UNUSED(arg);
+	UNUSED(value);
+#endif
+}
+
+#ifdef TRACE_POSIX
+/* Creates the key each thread finds its buffer under */
+static void _create_key(void) {
+	if( pthread_key_create(&key, _release_buffer) != 0 ) {
+		fprintf(stderr, "Failed to create trace buffer key!\n");
+		exit(1);
+	}
+}
+
+/* Hands the buffer of a thread that exited to the next one */
+static void _release_buffer(void *arg) {
+	TraceBuffer *buffer = arg;
+
+	pthread_mutex_lock(&lock);
+	buffer->claimed = false;
+	pthread_mutex_unlock(&lock);
+}
+
+/* Returns the buffer of the calling thread, claiming one the first time */
+static TraceBuffer *_get_buffer(void) {
+	TraceBuffer *buffer = pthread_getspecific(key);
+	if( buffer ) {
+		return buffer;
+	}
+
+	pthread_mutex_lock(&lock);
+
+	for( buffer = buffers; buffer && buffer->claimed; buffer = buffer->next ) {
+	}
+
+	if( !buffer ) {
+		buffer = calloc(1, sizeof(*buffer));
+		if( !buffer ) {
+			fprintf(stderr, "Failed to allocate trace buffer!\n");
+			exit(1);
+		}
+
+		buffer->next = buffers;
+		buffers = buffer;
+	}
+
+	buffer->claimed = true;
+	buffer->tid = ++last_tid;
+
+	pthread_mutex_unlock(&lock);
+
+	pthread_setspecific(key, buffer);
+	return buffer;
+}
+
+/* Writes out waiting events every TRACE_FLUSH_MS until told to stop */
+static void *_run(void *arg) {
+	UNUSED(arg);
+
+	const struct timespec wait = { 0, TRACE_FLUSH_MS * 1000000L };
+	while( !__atomic_load_n(&stopping, __ATOMIC_ACQUIRE) ) {
+		nanosleep(&wait, NULL);
+		_drain();
+	}
+
+	return NULL;
+}
+
+/* Writes out every waiting event, making room for more
+ *
+ * Buffers are only ever added to the front of the list, and never freed, so
+ * the list as it was can be walked without holding threads claiming buffers up
+ * on the writes
+ */
+static void _drain(void) {
+	pthread_mutex_lock(&lock);
+	TraceBuffer *const list = buffers;
+	pthread_mutex_unlock(&lock);
+
+	for( TraceBuffer *buffer = list; buffer; buffer = buffer->next ) {
+		const size_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+
+		size_t tail = buffer->tail;
+		for( ; tail != head; ++tail ) {
+			TraceEvent *event = &buffer->events[tail & (TRACE_RING - 1)];
+			if( event->start < epoch ) {
+				continue;
+			}
+
+			if( event->tid != buffer->named ) {
+				buffer->named = event->tid;
+				_write_name("thread_name", event->tid,
+					event->tid == main_tid ? "main" : "worker");
+			}
+
+			_write_event(event);
+		}
+
+		__atomic_store_n(&buffer->tail, tail, __ATOMIC_RELEASE);
+
+		const size_t dropped
+			= __atomic_load_n(&buffer->dropped, __ATOMIC_RELAXED);
+		lost += dropped - buffer->reported;
+		buffer->reported = dropped;
+	}
+
+	fflush(out);
+}
+
+/* Separates an event from the one before it */
+static void _begin_event(void) {
+	fputs(first ? "\n" : ",\n", out);
+	first = false;
+}
+
+/* Writes @event as a complete event */
+static void _write_event(TraceEvent *event) {
+	_begin_event();
+	fprintf(out, "{\"name\":\"%s\",\"cat\":\"edit\",\"ph\":\"X\",\"pid\":%d,"
+		"\"tid\":%u,", event->name, (int)getpid(), event->tid);
+
+	_write_time("ts", event->start - epoch);
+	fputc(',', out);
+	_write_time("dur", event->duration);
+
+	if( event->arg ) {
+		fprintf(out, ",\"args\":{\"%s\":%lld}", event->arg, event->value);
+	}
+
+	fputc('}', out);
+}
+
+/* Writes a metadata event naming the process, or thread @tid */
+static void _write_name(const char *what, unsigned tid, const char *name) {
+	_begin_event();
+	fprintf(out, "{\"name\":\"%s\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,"
+		"\"args\":{\"name\":\"%s\"}}", what, (int)getpid(), tid, name);
+}
+
+/* Writes @ns nanoseconds as the microseconds the format counts in */
+static void _write_time(const char *field, long long ns) {
+	fprintf(out, "\"%s\":%lld.%03lld", field, ns / 1000, ns % 1000);
+}
+
+/* Returns a monotonic clock reading, in nanoseconds */
+static long long _now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
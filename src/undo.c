@@ -0,0 +1,518 @@
+/* edit
+ * Undo tree
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "global.h"
+
+#include "cmd.h"
+
+#include "undo.h"
+
+static size_t _alloc(UndoTree *tree);
+static void _release(UndoTree *tree, size_t idx);
+
+static void _trim(UndoTree *tree);
+static size_t _get_oldest_branch(UndoTree *tree);
+static void _unlink(UndoTree *tree, size_t idx);
+static void _drop_subtree(UndoTree *tree, size_t idx);
+static void _shift_depth(UndoTree *tree, size_t idx, size_t by);
+static void _push(
+	size_t **stack, size_t *length, size_t *capacity, size_t idx);
+
+/* Initializes a tree holding only the file as loaded */
+void undo_init(UndoTree *tree) {
+	tree->nodes = NULL;
+	tree->length = 0;
+	tree->capacity = 0;
+	tree->free = UNDO_NONE;
+
+	tree->seq = 0;
+
+	tree->bytes = 0;
+	tree->budget = CMD_DEFAULT_BUDGET;
+
+	tree->root = _alloc(tree);
+	tree->current = tree->root;
+
+	UndoNode *root = &tree->nodes[tree->root];
+	memset(&root->cmd, 0, sizeof(root->cmd));
+
+	root->parent = UNDO_NONE;
+	root->child = UNDO_NONE;
+	root->first_child = UNDO_NONE;
+	root->sibling = UNDO_NONE;
+
+	root->seq = 0;
+	root->depth = 0;
+	root->time = time(NULL);
+
+	tree->bytes = cmd_get_size(&root->cmd);
+}
+
+/* Frees the tree and every command in it */
+void undo_free(UndoTree *tree) {
+	_drop_subtree(tree, tree->root);
+	free(tree->nodes);
+
+	tree->nodes = NULL;
+	tree->length = 0;
+	tree->capacity = 0;
+	tree->free = UNDO_NONE;
+
+	tree->root = UNDO_NONE;
+	tree->current = UNDO_NONE;
+}
+
+/* Sets how many bytes of commands the tree may hold, 0 meaning no limit
+ * The oldest states are dropped right away if they no longer fit
+ */
+void undo_set_budget(UndoTree *tree, size_t budget) {
+	tree->budget = budget;
+	_trim(tree);
+}
+
+/* Adds a new state, reached from the current one by @cmd's inverse
+ * @cmd is what takes the file back, and the tree takes ownership of it
+ */
+void undo_add(UndoTree *tree, Command cmd) {
+	const size_t idx = _alloc(tree);
+
+	UndoNode *parent = &tree->nodes[tree->current];
+	UndoNode *node = &tree->nodes[idx];
+
+	node->cmd = cmd;
+
+	node->parent = tree->current;
+	node->child = UNDO_NONE;
+	node->first_child = UNDO_NONE;
+	node->sibling = parent->first_child;
+
+	node->seq = ++tree->seq;
+	node->depth = parent->depth + 1;
+	node->time = time(NULL);
+
+	parent->first_child = idx;
+	parent->child = idx;
+
+	tree->current = idx;
+	tree->bytes += cmd_get_size(&cmd);
+
+	_trim(tree);
+}
+
+/* Moves the commands of @stack into the tree, oldest first
+ * Unless @all is set, a command that may still be merged into is left behind
+ */
+void undo_absorb(UndoTree *tree, CommandStack *stack, bool all) {
+	const size_t keep = (all || stack->sealed) ? 0 : 1;
+	while( stack->length > keep ) {
+		undo_add(tree, *cmd_shift(stack));
+	}
+}
+
+/* Steps back to the parent of the current state
+ *
+ * Returns the node left, whose command must be run to take the file back,
+ * and its inverse handed to undo_store(), or NULL if already at the root
+ */
+UndoNode *undo_back(UndoTree *tree) {
+	if( tree->current == tree->root ) {
+		return NULL;
+	}
+
+	UndoNode *node = &tree->nodes[tree->current];
+	tree->bytes -= cmd_get_size(&node->cmd);
+	tree->current = node->parent;
+
+	return node;
+}
+
+/* Steps forward to child @idx of the current state, or to the child last
+ * visited if it is UNDO_NONE
+ *
+ * Returns the node entered, whose command must be run to redo it, and its
+ * inverse handed to undo_store(), or NULL if there is nothing to redo
+ */
+UndoNode *undo_forward(UndoTree *tree, size_t idx) {
+	UndoNode *parent = &tree->nodes[tree->current];
+	if( idx == UNDO_NONE ) {
+		idx = parent->child;
+	}
+
+	if( idx == UNDO_NONE ) {
+		return NULL;
+	}
+
+	parent->child = idx;
+	tree->current = idx;
+
+	UndoNode *node = &tree->nodes[idx];
+	tree->bytes -= cmd_get_size(&node->cmd);
+
+	return node;
+}
+
+/* Stores the command that reverses what was just run for @node */
+void undo_store(UndoTree *tree, UndoNode *node, Command cmd) {
+	node->cmd = cmd;
+	tree->bytes += cmd_get_size(&cmd);
+}
+
+/* Returns the closest state both @a and @b descend from */
+size_t undo_get_common(UndoTree *tree, size_t a, size_t b) {
+	while( tree->nodes[a].depth > tree->nodes[b].depth ) {
+		a = tree->nodes[a].parent;
+	}
+
+	while( tree->nodes[b].depth > tree->nodes[a].depth ) {
+		b = tree->nodes[b].parent;
+	}
+
+	while( a != b ) {
+		a = tree->nodes[a].parent;
+		b = tree->nodes[b].parent;
+	}
+
+	return a;
+}
+
+/* Fills @path with the states after @from on the way down to @to, in order
+ * @to must descend from @from, and @path have room for the difference in their
+ * depths
+ * Returns the number of states
+ */
+size_t undo_get_path(UndoTree *tree, size_t from, size_t to, size_t *path) {
+	const size_t count = tree->nodes[to].depth - tree->nodes[from].depth;
+	for( size_t i = count; i-- > 0; ) {
+		path[i] = to;
+		to = tree->nodes[to].parent;
+	}
+
+	return count;
+}
+
+/* Returns the newest state numbered @seq or lower, or the root if none is */
+size_t undo_find_seq(UndoTree *tree, size_t seq) {
+	size_t found = tree->root;
+	for( size_t i = 0; i < tree->length; ++i ) {
+		UndoNode *node = &tree->nodes[i];
+		if( node->seq != UNDO_NONE && node->seq <= seq
+			&& node->seq > tree->nodes[found].seq ) {
+			found = i;
+		}
+	}
+
+	return found;
+}
+
+/* Returns the newest state made at @time or before, or the root if none was */
+size_t undo_find_time(UndoTree *tree, time_t time) {
+	size_t found = tree->root;
+	for( size_t i = 0; i < tree->length; ++i ) {
+		UndoNode *node = &tree->nodes[i];
+		if( node->seq != UNDO_NONE && node->time <= time
+			&& node->seq > tree->nodes[found].seq ) {
+			found = i;
+		}
+	}
+
+	return found;
+}
+
+/* Numbers the states as carrying on from a history saved earlier, which was
+ * in state @current_seq, and had made @seq states
+ * The tree must hold nothing but its root
+ */
+void undo_resume(UndoTree *tree, size_t current_seq, size_t seq) {
+	tree->nodes[tree->root].seq = current_seq;
+	tree->seq = MAX(tree->seq, seq);
+}
+
+/* Grafts @count nodes of an older history above the tree, taking ownership of
+ * their commands
+ *
+ * The nodes link to each other by their index in @nodes, and come after their
+ * parents. Node @current is the state the root of the tree is in, so the two
+ * are merged, keeping the root's children ahead of its older ones
+ */
+void undo_graft(UndoTree *tree, UndoNode *nodes, size_t count, size_t current) {
+	size_t *map = malloc(sizeof(*map) * MAX(count, 1));
+	if( !map ) {
+		fprintf(stderr, "Failed to allocate map of %zu states!\n", count);
+		exit(1);
+	}
+
+	/* Everything already in the tree ends up below @current */
+	size_t depth = 0;
+	for( size_t i = current; nodes[i].parent != UNDO_NONE; ) {
+		i = nodes[i].parent;
+		++depth;
+	}
+
+	const size_t root = tree->root;
+	_shift_depth(tree, root, depth);
+
+	/* Older children of the root go after the newest ones */
+	size_t anchor = UNDO_NONE;
+	for( size_t child = tree->nodes[root].first_child; child != UNDO_NONE;
+		child = tree->nodes[child].sibling ) {
+		anchor = child;
+	}
+
+	for( size_t i = 0; i < count; ++i ) {
+		size_t idx = root;
+		if( i == current ) {
+			UndoNode *node = &tree->nodes[root];
+			tree->bytes -= cmd_get_size(&node->cmd);
+			node->cmd = nodes[i].cmd;
+			node->seq = nodes[i].seq;
+			node->time = nodes[i].time;
+		} else {
+			idx = _alloc(tree);
+
+			UndoNode *node = &tree->nodes[idx];
+			*node = nodes[i];
+			node->child = UNDO_NONE;
+			node->first_child = UNDO_NONE;
+		}
+
+		map[i] = idx;
+
+		UndoNode *node = &tree->nodes[idx];
+		tree->bytes += cmd_get_size(&node->cmd);
+
+		if( nodes[i].parent == UNDO_NONE ) {
+			node->parent = UNDO_NONE;
+			node->sibling = UNDO_NONE;
+			node->depth = 0;
+			tree->root = idx;
+			continue;
+		}
+
+		const size_t parent = map[nodes[i].parent];
+		node->parent = parent;
+		node->depth = tree->nodes[parent].depth + 1;
+
+		/* Older nodes come first, so each goes ahead of its older siblings */
+		if( parent == root && anchor != UNDO_NONE ) {
+			node->sibling = tree->nodes[anchor].sibling;
+			tree->nodes[anchor].sibling = idx;
+		} else {
+			node->sibling = tree->nodes[parent].first_child;
+			tree->nodes[parent].first_child = idx;
+		}
+	}
+
+	/* Redo keeps going the way it last went, unless the root has been left */
+	for( size_t i = 0; i < count; ++i ) {
+		UndoNode *node = &tree->nodes[map[i]];
+		if( map[i] == root && node->child != UNDO_NONE ) {
+			continue;
+		}
+
+		node->child = UNDO_NONE;
+		if( nodes[i].child != UNDO_NONE ) {
+			node->child = map[nodes[i].child];
+		}
+	}
+
+	free(map);
+
+	_trim(tree);
+}
+
+/* Returns node @idx */
+UndoNode *undo_get(UndoTree *tree, size_t idx) {
+	return &tree->nodes[idx];
+}
+
+/* Takes a slot for a new node, reusing a freed one if there is any
+ * Nodes may move, so pointers to them must be taken again afterwards
+ */
+static size_t _alloc(UndoTree *tree) {
+	if( tree->free != UNDO_NONE ) {
+		const size_t idx = tree->free;
+		tree->free = tree->nodes[idx].parent;
+
+		return idx;
+	}
+
+	if( tree->length == tree->capacity ) {
+		tree->capacity
+			= tree->capacity ? tree->capacity * 2 : UNDO_INITIAL_NODES;
+
+		const size_t size = sizeof(*tree->nodes) * tree->capacity;
+		UndoNode *new_nodes = realloc(tree->nodes, size);
+		if( !new_nodes ) {
+			fprintf(stderr, "Failed to reallocate %zu bytes for undo tree!\n",
+				size);
+			exit(1);
+		}
+
+		tree->nodes = new_nodes;
+	}
+
+	return tree->length++;
+}
+
+/* Frees the command of node @idx, and gives its slot back */
+static void _release(UndoTree *tree, size_t idx) {
+	UndoNode *node = &tree->nodes[idx];
+	tree->bytes -= cmd_get_size(&node->cmd);
+	cmd_free_cmd(&node->cmd);
+	memset(&node->cmd, 0, sizeof(node->cmd));
+
+	node->seq = UNDO_NONE;
+	node->parent = tree->free;
+	tree->free = idx;
+}
+
+/* Drops the oldest states until the tree fits in its budget
+ *
+ * States older than the current one go first, by making the next state on
+ * the way to it the new root. Once there are none, the oldest branches that
+ * could still be redone go. The last edit can always be undone
+ */
+static void _trim(UndoTree *tree) {
+	while( tree->budget && tree->bytes > tree->budget ) {
+		const size_t old_root = tree->root;
+		UndoNode *root = &tree->nodes[old_root];
+
+		/* The child last visited is the one leading to the current state */
+		const size_t new_root = root->child;
+		if( tree->current == old_root || new_root == tree->current ) {
+			const size_t victim = _get_oldest_branch(tree);
+			if( victim == UNDO_NONE ) {
+				break;
+			}
+
+			_unlink(tree, victim);
+			_drop_subtree(tree, victim);
+			continue;
+		}
+
+		for( size_t child = root->first_child; child != UNDO_NONE; ) {
+			const size_t next = tree->nodes[child].sibling;
+			if( child != new_root ) {
+				_drop_subtree(tree, child);
+			}
+
+			child = next;
+		}
+
+		_release(tree, old_root);
+
+		UndoNode *node = &tree->nodes[new_root];
+		tree->bytes -= cmd_get_size(&node->cmd);
+		cmd_free_cmd(&node->cmd);
+		memset(&node->cmd, 0, sizeof(node->cmd));
+		tree->bytes += cmd_get_size(&node->cmd);
+
+		node->parent = UNDO_NONE;
+		node->sibling = UNDO_NONE;
+		tree->root = new_root;
+	}
+}
+
+/* Returns the oldest branch off the root or the current state that doesn't
+ * lead to the current state, or UNDO_NONE if there is none
+ */
+static size_t _get_oldest_branch(UndoTree *tree) {
+	const size_t parents[] = { tree->root, tree->current };
+	for( size_t i = 0; i < sizeof(parents) / sizeof(*parents); ++i ) {
+		size_t oldest = UNDO_NONE;
+		for( size_t child = tree->nodes[parents[i]].first_child;
+			child != UNDO_NONE; child = tree->nodes[child].sibling ) {
+			if( child != tree->current ) {
+				oldest = child;
+			}
+		}
+
+		if( oldest != UNDO_NONE ) {
+			return oldest;
+		}
+	}
+
+	return UNDO_NONE;
+}
+
+/* Takes node @idx out of its parent's list of children */
+static void _unlink(UndoTree *tree, size_t idx) {
+	UndoNode *parent = &tree->nodes[tree->nodes[idx].parent];
+
+	size_t *link = &parent->first_child;
+	while( *link != idx ) {
+		link = &tree->nodes[*link].sibling;
+	}
+
+	*link = tree->nodes[idx].sibling;
+	if( parent->child == idx ) {
+		parent->child = parent->first_child;
+	}
+}
+
+/* Drops node @idx and every state descending from it */
+static void _drop_subtree(UndoTree *tree, size_t idx) {
+	if( idx == UNDO_NONE ) {
+		return;
+	}
+
+	size_t *stack = NULL, length = 0, capacity = 0;
+	_push(&stack, &length, &capacity, idx);
+
+	while( length > 0 ) {
+		const size_t node = stack[--length];
+		for( size_t child = tree->nodes[node].first_child;
+			child != UNDO_NONE; child = tree->nodes[child].sibling ) {
+			_push(&stack, &length, &capacity, child);
+		}
+
+		_release(tree, node);
+	}
+
+	free(stack);
+}
+
+/* Moves node @idx and every state descending from it @by levels down */
+static void _shift_depth(UndoTree *tree, size_t idx, size_t by) {
+	size_t *stack = NULL, length = 0, capacity = 0;
+	_push(&stack, &length, &capacity, idx);
+
+	while( length > 0 ) {
+		UndoNode *node = &tree->nodes[stack[--length]];
+		node->depth += by;
+
+		for( size_t child = node->first_child; child != UNDO_NONE;
+			child = tree->nodes[child].sibling ) {
+			_push(&stack, &length, &capacity, child);
+		}
+	}
+
+	free(stack);
+}
+
+/* Pushes @idx onto a stack of nodes left to visit, growing it as needed */
+static void _push(
+	size_t **stack, size_t *length, size_t *capacity, size_t idx) {
+	if( *length == *capacity ) {
+		*capacity = *capacity ? *capacity * 2 : UNDO_INITIAL_NODES;
+
+		size_t *new_stack = realloc(*stack, sizeof(**stack) * *capacity);
+		if( !new_stack ) {
+			fprintf(stderr, "Failed to reallocate %zu nodes to visit!\n",
+				*capacity);
+			exit(1);
+		}
+
+		*stack = new_stack;
+	}
+
+	(*stack)[(*length)++] = idx;
+}